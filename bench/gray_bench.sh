@@ -0,0 +1,79 @@
+#!/usr/bin/env bash
+# Time --grayscale on a multi-page colour document: the old ImageMagick
+# pass (convert -colorspace Gray, which rasterises every page) against
+# the single gs pass lprun now runs, which keeps text and vectors.
+#
+#   bench/gray_bench.sh [pages]        (default 20)
+#
+# Skips itself (status 0) when gs or ImageMagick is missing.
+
+set -eu
+
+PAGES=${1:-20}
+
+if ! command -v gs >/dev/null 2>&1; then
+    echo "gray_bench: skipped (gs not installed)"
+    exit 0
+fi
+if command -v magick >/dev/null 2>&1; then
+    IM=(magick)
+elif command -v convert >/dev/null 2>&1; then
+    IM=(convert)
+else
+    echo "gray_bench: skipped (ImageMagick not installed)"
+    exit 0
+fi
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/lprun-gray.XXXXXX")
+trap 'rm -rf "$dir"' EXIT
+
+# colour text, rules and filled shapes on every page
+{
+    printf '%%!PS-Adobe-3.0\n%%%%Pages: %d\n%%%%EndComments\n' "$PAGES"
+    printf '/Helvetica findfont 11 scalefont setfont\n'
+    for ((p = 1; p <= PAGES; p++)); do
+        printf '%%%%Page: %d %d\n' "$p" "$p"
+        printf '0.8 0.1 0.1 setrgbcolor 72 720 moveto (Page %d of %d) show\n' "$p" "$PAGES"
+        for ((l = 0; l < 50; l++)); do
+            printf '%d 0.3 mul 0 0.6 setrgbcolor 72 %d moveto ' "$((l % 4))" "$((700 - l * 12))"
+            printf '(The quick brown fox jumps over the lazy dog, line %d.) show\n' "$l"
+        done
+        printf '0 0.5 0.9 0.1 setcmykcolor 400 100 120 80 rectfill\n'
+        printf '0.2 0.7 0.2 setrgbcolor 4 setlinewidth 72 80 moveto 540 80 lineto stroke\n'
+        printf 'showpage\n'
+    done
+    printf '%%%%EOF\n'
+} > "$dir/in.ps"
+
+TIMEFORMAT='%R %U %S'
+
+# run "$@" and print "<wall> <cpu>" seconds
+timed() {
+    local t
+    t=$( { time "$@" >/dev/null 2>&1; } 2>&1 ) || return 1
+    set -- $t
+    awk -v w="$1" -v u="$2" -v s="$3" 'BEGIN { print w, u + s }'
+}
+
+row() {
+    local name=$1 out=$2
+    shift 2
+    local r
+    if ! r=$(timed "$@"); then
+        printf '%-28s failed\n' "$name"
+        return
+    fi
+    set -- $r
+    printf '%-28s %8.2f %8.2f %10d\n' "$name" "$1" "$2" "$(stat -c %s "$out")"
+}
+
+echo "gray_bench: $PAGES pages, input $(stat -c %s "$dir/in.ps") bytes"
+printf '%-28s %8s %8s %10s\n' path "wall s" "cpu s" "out bytes"
+row "imagemagick -colorspace Gray" "$dir/im.ps" \
+    "${IM[@]}" "$dir/in.ps" -colorspace Gray "$dir/im.ps"
+# the arguments gs_argv() passes for --grayscale
+row "gs ColorConversionStrategy" "$dir/gs.ps" \
+    gs -q -dNOPAUSE -dBATCH -dSAFER -sDEVICE=ps2write \
+    -sColorConversionStrategy=Gray -dProcessColorModel=/DeviceGray \
+    -dPDFSETTINGS=/printer -dCompatibilityLevel=1.4 -dAutoRotatePages=/None \
+    -dEmbedAllFonts=true -sOutputFile="$dir/gs.ps" -f "$dir/in.ps"
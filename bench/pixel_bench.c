@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "pixel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Pixel kernel microbenchmark: every variant the CPU supports, selected
+ * with pix_use(), over a 600 dpi A4 raster (4960 x 7016), with each
+ * output checked against the scalar one. Exits 1 on any mismatch.
+ *
+ *   pixel_bench            timings and checks
+ *   pixel_bench --quick    checks on a small raster (for the test run)
+ */
+
+#define A4_600DPI_W 4960
+#define A4_600DPI_H 7016
+
+static const char *const variants[] = { "scalar", "sse4.1", "avx2", "neon" };
+#define NVARIANTS (int)(sizeof(variants) / sizeof(variants[0]))
+
+enum kernel { K_RGB, K_RGBA, K_ORDERED, NKERNELS };
+static const char *const kernel_names[NKERNELS] = { "rgb->gray", "rgba->gray", "ordered" };
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* the whole raster through one kernel, row by row as the print paths do */
+static void run(enum kernel k, const uint8_t *src, uint8_t *dst, size_t w, size_t h) {
+    size_t stride = (w + 7) / 8;
+    for (size_t y = 0; y < h; y++) {
+        switch (k) {
+        case K_RGB:
+            pix_rgb_to_gray(src + y * w * 3, dst + y * w, w);
+            break;
+        case K_RGBA:
+            pix_rgba_to_gray(src + y * w * 4, dst + y * w, w);
+            break;
+        default:
+            pix_dither_ordered(src + y * w, dst + y * stride, w, (unsigned)y);
+            break;
+        }
+    }
+}
+
+static size_t out_len(enum kernel k, size_t w, size_t h) {
+    return k == K_ORDERED ? (w + 7) / 8 * h : w * h;
+}
+
+/* every width up to a few vector lengths, so the tails get checked too */
+static int check_tails(const uint8_t *src) {
+    int bad = 0;
+    for (size_t w = 1; w <= 100; w++) {
+        uint8_t ref[NKERNELS][400], out[400];
+        pix_use("scalar");
+        for (int k = 0; k < NKERNELS; k++) run(k, src, ref[k], w, 1);
+        for (int v = 1; v < NVARIANTS; v++) {
+            if (pix_use(variants[v]) != 0) continue;
+            for (int k = 0; k < NKERNELS; k++) {
+                run(k, src, out, w, 1);
+                if (memcmp(ref[k], out, out_len(k, w, 1)) != 0) {
+                    printf("%-7s %-11s differs from scalar at width %zu\n",
+                           variants[v], kernel_names[k], w);
+                    bad = 1;
+                }
+            }
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    size_t w = quick ? 1000 : A4_600DPI_W, h = quick ? 64 : A4_600DPI_H;
+
+    uint8_t *src = malloc(w * h * 4);
+    uint8_t *ref[NKERNELS], *out = malloc(w * h);
+    int ok = src && out;
+    for (int k = 0; k < NKERNELS; k++) ok &= (ref[k] = malloc(out_len(k, w, h))) != NULL;
+    if (!ok) {
+        fprintf(stderr, "pixel_bench: out of memory\n");
+        return 2;
+    }
+    /* noise: no variant gets to skip work on flat areas */
+    srand(1);
+    for (size_t i = 0; i < w * h * 4; i++) src[i] = (uint8_t)rand();
+
+    printf("pixel_bench: %zux%zu, default kernel %s\n", w, h, pix_kernel());
+    printf("%-7s %-11s %9s %9s\n", "variant", "kernel", "ms", "Mpix/s");
+    int bad = 0;
+    for (int v = 0; v < NVARIANTS; v++) {
+        if (pix_use(variants[v]) != 0) {
+            printf("%-7s (not supported here)\n", variants[v]);
+            continue;
+        }
+        for (int k = 0; k < NKERNELS; k++) {
+            uint8_t *dst = v == 0 ? ref[k] : out;
+            double t0 = now_ms();
+            run(k, src, dst, w, h);
+            double ms = now_ms() - t0;
+            int same = v == 0 || memcmp(ref[k], out, out_len(k, w, h)) == 0;
+            bad |= !same;
+            printf("%-7s %-11s %9.1f %9.0f%s\n", variants[v], kernel_names[k], ms,
+                   ms > 0 ? w * h / ms / 1000.0 : 0.0, same ? "" : "  DIFFERS FROM SCALAR");
+        }
+    }
+
+    /* error diffusion has a single, scalar variant: timed, not compared */
+    struct pix_fs fs;
+    if (pix_fs_init(&fs, w) == 0) {
+        double t0 = now_ms();
+        for (size_t y = 0; y < h; y++) pix_fs_row(&fs, ref[K_RGB] + y * w, out + y * ((w + 7) / 8));
+        double ms = now_ms() - t0;
+        printf("%-7s %-11s %9.1f %9.0f\n", "scalar", "fs-dither", ms,
+               ms > 0 ? w * h / ms / 1000.0 : 0.0);
+        pix_fs_free(&fs);
+    }
+
+    bad |= check_tails(src);
+    printf("%s\n", bad ? "FAILED: a variant differs from scalar" : "all variants match scalar");
+
+    free(src);
+    free(out);
+    for (int k = 0; k < NKERNELS; k++) free(ref[k]);
+    return bad;
+}
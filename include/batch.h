@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include "print_raw.h"
+#include "prepare.h"
+
+/* converted jobs allowed to wait for one printer before the converters
+ * hold off; bounds the temp files in flight */
+#define BATCH_QUEUE_DEPTH 8
+
+/* one manifest line and its outcome */
+struct batch_job {
+    char file[1024];
+    char printer[256];      /* CUPS queue, or "" */
+    char ip[64];            /* raw printer, or "" */
+    int port;
+    int copies;
+    int color_mode;         /* 0 = auto, 1 = color, 2 = grayscale */
+    int line;               /* manifest line number */
+
+    int status;             /* 0 = printed, else lprun's exit code */
+    char error[128];
+    long long bytes;
+    double conv_ms, send_ms;
+};
+
+struct batch_opts {
+    const char *printer;    /* destination for lines that name none */
+    const char *ip;
+    int port;
+    int workers;            /* converter threads, 0 = one per online core */
+    int use_cache;
+    enum raw_copy_mode copy_mode;
+};
+
+/* "file [printer=Q | ip=A[:P]] [copies=N] [color|gray]"; the file may be
+ * double-quoted. returns 1 for a job, 0 for a blank/comment line, -1 if
+ * malformed (reason in j->error) */
+int batch_parse_line(const char *line, int lineno, const struct batch_opts *o,
+                     struct batch_job *j);
+/* whole manifest ("-" = stdin); *out is malloc'd; returns count or -1 */
+int batch_read(const char *path, const struct batch_opts *o, struct batch_job **out);
+/* the two halves of one job: convert into *pj, then print and release it */
+void batch_convert_job(struct batch_job *j, struct prep_job *pj, const struct batch_opts *o);
+void batch_send_job(struct batch_job *j, struct prep_job *pj, const struct batch_opts *o);
+/* convert on a worker pool and print through one ordered queue per
+ * printer; returns the number of failed jobs */
+int batch_run(struct batch_job *jobs, int n, const struct batch_opts *o);
+void batch_print_summary(const struct batch_job *jobs, int n, double seconds);
+#endif
@@ -0,0 +1,47 @@
+#ifndef CAPS_H
+#define CAPS_H
+#include <stddef.h>
+
+/* which document formats a printer accepts, so a PDF can go out as it is
+ * instead of through the converter. Learned once per printer and cached:
+ *   CUPS queue    document-format-supported from the scheduler
+ *   raw address   the mDNS TXT pdl= list when discovery saw one, else an
+ *                 IPP query on port 631, else PJL INFO CONFIG (LANGUAGES)
+ *                 on the raw port */
+
+enum {
+    CAPS_SRC_NONE,          /* nothing answered */
+    CAPS_SRC_MDNS,
+    CAPS_SRC_IPP,
+    CAPS_SRC_PJL
+};
+
+/* known formats are rechecked after a week, unknown ones after an hour */
+#define CAPS_TTL (7 * 24 * 60 * 60)
+#define CAPS_RETRY_TTL (60 * 60)
+/* budget for each network probe */
+#define CAPS_PROBE_MS 1500
+
+struct caps {
+    char pdl[256];          /* MIME types, comma separated; "" if unknown */
+    int source;             /* CAPS_SRC_* */
+    int cached;             /* read from the cache file, not probed */
+    long long checked_at;   /* unix time */
+};
+
+/* formats of a CUPS queue (is_cups) or of the raw printer at name:port.
+ * hint is a pdl list from discovery (NULL or "" if none) and wins over
+ * everything else. use_cache 0 neither reads nor writes the cache.
+ * returns 0 if anything is known */
+int caps_get(int is_cups, const char *name, int port, const char *hint, int use_cache,
+             struct caps *c);
+/* 1 if the printer lists this MIME type */
+int caps_accepts(const struct caps *c, const char *mime);
+const char *caps_source_name(int src);
+
+/* the probes themselves; a comma separated MIME list into pdl, 0 if the
+ * printer answered with at least one format */
+int caps_query_cups(const char *queue, char *pdl, size_t len);
+int caps_query_ipp(const char *host, int port, int timeout_ms, char *pdl, size_t len);
+int caps_query_pjl(const char *ip, int port, int timeout_ms, char *pdl, size_t len);
+#endif
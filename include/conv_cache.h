@@ -0,0 +1,33 @@
+#ifndef CONV_CACHE_H
+#define CONV_CACHE_H
+#include <stddef.h>
+
+/* converted documents kept under get_cache_dir()/conv; least recently
+ * used entries are evicted past this size */
+#define CONV_CACHE_MAX_BYTES (256LL * 1024 * 1024)
+
+struct conv_stats {
+    long long hits, misses;     /* lifetime counters, shared by all runs */
+    int entries;
+    long long bytes;
+};
+
+/* key over the input's content and size plus params (conversion kind,
+ * color mode and the converter binaries found in PATH); returns 0 on success */
+int conv_cache_key(const char *path, const char *params, char key[17]);
+/* malloc'd path of the cached conversion (and marks it used), or NULL */
+char *conv_cache_lookup(const char *key);
+/* copy a finished conversion into the cache and evict down to the limit */
+int conv_cache_store(const char *key, const char *file);
+/* the same for output produced incrementally: write to the returned fd
+ * (a temp file *tmp inside the cache), then commit; ok = 0 discards it.
+ * commit frees tmp */
+int conv_cache_begin(char **tmp);
+int conv_cache_commit(const char *key, char *tmp, int ok);
+/* bump the persistent hit or miss counter */
+void conv_cache_count(int hit);
+int conv_cache_stats(struct conv_stats *s);
+/* "name:size:mtime;" for each of the space separated tools found in PATH,
+ * so upgrading a converter invalidates its entries */
+void conv_tool_ids(const char *tools, char *buf, size_t len);
+#endif
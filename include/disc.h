@@ -1,7 +1,55 @@
 #ifndef DISCOVER_H
 #define DISCOVER_H
-/* returns malloc'd string with CUPS printer name or NULL */
+#include <stddef.h>
+#include "portscan.h"
+
+/* discovery backends, in order of preference */
+enum {
+    DISC_SRC_CUPS,
+    DISC_SRC_MDNS,
+    DISC_SRC_SCAN,
+    DISC_NSOURCES
+};
+
+/* a printer found by discovery: a CUPS queue name or a raw IPv4 address */
+struct disc_printer {
+    int source;             /* DISC_SRC_* that found it */
+    int is_cups;
+    char name[256];
+    int port;               /* raw port for addresses, 0 for CUPS queues */
+    char pdl[256];          /* advertised document formats, "" if unknown */
+    int color, duplex;      /* 1/0, -1 if unknown */
+    int state;              /* CUPS printer-state: 3 idle, 4 printing, 5 stopped; 0 if not enumerated */
+    int queued;             /* active jobs on the CUPS queue, valid when state != 0 */
+};
+
+/* returns malloc'd string with CUPS printer name (default destination first) or NULL */
 char *discover_cups_printer(void);
+/* configured CUPS queues, default first; *out is malloc'd; returns count or -1 */
+int discover_cups_queues(int timeout_ms, struct disc_printer **out);
+const char *disc_queue_status(const struct disc_printer *p, char *buf, size_t len);
 /* returns malloc'd ip string like "192.168.1.40" or NULL */
 char *discover_printer_ip(void);
+struct disc_opts {
+    int deadline_ms;        /* global budget (default 3000) */
+    int verbose;            /* print per-backend latency */
+};
+
+/* what each backend did during discover_all */
+struct disc_report {
+    int done[DISC_NSOURCES];
+    int nfound[DISC_NSOURCES];
+    double latency_ms[DISC_NSOURCES];
+};
+
+/* run all backends concurrently; merged, de-duplicated, best first.
+ * *out is malloc'd; returns count or -1 */
+int discover_all(const struct disc_opts *o, struct disc_printer **out,
+                 struct disc_report *rep);
+void disc_print_report(const struct disc_report *rep);
+const char *disc_source_name(int src);
+/* best printer from discover_all (o may be NULL); returns 0 if found */
+int discover_printer(struct disc_printer *p, const struct disc_opts *o);
+/* port scan every local interface's subnet in parallel; returns hit count or -1 */
+int discovery_scan_lan(const struct portscan_opts *o, struct portscan_hit **hits);
 #endif
@@ -0,0 +1,37 @@
+#ifndef EXEC_H
+#define EXEC_H
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/* deadlines for external tools; one still running then is killed */
+#define EXEC_CONVERT_TIMEOUT_MS (5 * 60 * 1000)
+#define EXEC_SCAN_TIMEOUT_MS    (3 * 60 * 1000)
+/* after SIGTERM, how long a process group gets before SIGKILL */
+#define EXEC_KILL_GRACE_MS      2000
+
+/* what a child's stdin/stdout/stderr is connected to, besides a plain fd */
+#define EXEC_INHERIT  (-1)      /* ours */
+#define EXEC_NULL     (-2)      /* /dev/null */
+#define EXEC_PIPE     (-3)      /* stdout only: a pipe whose read end is returned */
+
+/* absolute path of an executable found in $PATH, or NULL. Looked up once
+ * per process (misses included), so probing costs no fork */
+const char *exec_find(const char *name);
+
+/* start argv without a shell, in its own process group; argv[0] is looked
+ * up with exec_find. in/out/err are fds to hand the child or one of the
+ * EXEC_* values above. Returns the read end for EXEC_PIPE (a pipe of
+ * CONV_PIPE_BYTES), else 0; -1 if it could not be started */
+int exec_spawn(const char *const argv[], int in, int out, int err, pid_t *pid);
+
+/* reap a spawned child, killing its whole group if *cancel becomes set or
+ * timeout_ms (0 = none) passes. Returns the exit code, -1 if it was
+ * killed, cancelled or timed out */
+int exec_wait(pid_t pid, int timeout_ms, const atomic_int *cancel);
+
+/* spawn, wait and report: stderr goes through a pipe and its tail is
+ * printed with the tool's name if the tool fails. in/out as for
+ * exec_spawn (not EXEC_PIPE). Returns the exit code or -1 */
+int exec_run(const char *const argv[], int in, int out, int timeout_ms,
+             const atomic_int *cancel);
+#endif
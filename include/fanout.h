@@ -0,0 +1,30 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+#include "print_raw.h"
+
+/* one raw printer in a multi-printer send, plus its outcome */
+struct fanout_target {
+    char ip[64];
+    int port;
+    int status;             /* 0 = sent, <0 = failed */
+    char error[96];
+    long long sent;
+    double seconds;
+};
+
+struct fanout_opts {
+    int max_parallel;       /* connections in flight at once */
+    int connect_timeout_ms;
+    int idle_timeout_ms;    /* give up when a printer stops reading */
+    int copies;
+    enum raw_copy_mode copy_mode;
+};
+
+/* "a,b:9101,c" -> malloc'd array; returns count or -1 */
+int fanout_parse_targets(const char *list, int default_port, struct fanout_target **out);
+/* one address per line, '#' comments allowed; returns count or -1 */
+int fanout_read_targets(const char *path, int default_port, struct fanout_target **out);
+/* send filename ("-" = stdin) to every target; returns number of failures */
+int fanout_send_file(struct fanout_target *t, int n, const char *filename,
+                     const struct fanout_opts *o);
+#endif
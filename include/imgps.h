@@ -0,0 +1,45 @@
+#ifndef IMGPS_H
+#define IMGPS_H
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/* images to PostScript without ImageMagick. The compressed data is passed
+ * through wherever a PostScript filter can decode it: JPEG goes in
+ * unchanged as /DCTDecode, PNG's zlib stream as /FlateDecode with the PNG
+ * predictor; PNM is RunLength-encoded here. Everything is ASCII85-wrapped,
+ * fitted to the page (rotated if that makes it bigger) and turned upright
+ * per the EXIF orientation. Formats or variants not covered (alpha,
+ * interlacing, 16-bit samples, ...) report IMGPS_UNSUPPORTED so the
+ * caller can fall back to ImageMagick */
+
+#define IMGPS_UNSUPPORTED 1
+
+enum imgps_format {
+    IMGPS_JPEG,
+    IMGPS_PNG,
+    IMGPS_PNM
+};
+
+struct imgps_info {
+    enum imgps_format format;
+    int width, height;
+    int comps;              /* samples per pixel as stored (1 for palette) */
+    int bpc;                /* bits per sample */
+    int orientation;        /* EXIF 1-8, 1 = as stored */
+    int adobe;              /* JPEG: Adobe APP14 (CMYK stored inverted) */
+    int maxval;             /* PNM */
+    int palette_n;          /* PNG palette entries, 0 = none */
+    unsigned char palette[768];
+    off_t data;             /* PNG: first IDAT chunk; PNM: first sample */
+};
+
+/* read the header of the image on fd; 0 if it can be encoded here,
+ * IMGPS_UNSUPPORTED otherwise */
+int imgps_probe(int fd, struct imgps_info *info);
+/* the same for a path: 1 if imgps can take it */
+int imgps_supported(const char *path);
+/* write the image on in_fd (a regular file) as a one-page PostScript
+ * document; color_mode 2 = grayscale. Returns 0 on success,
+ * IMGPS_UNSUPPORTED before writing anything, -1 on errors or *cancel */
+int imgps_convert_fd(int in_fd, int out_fd, int color_mode, const atomic_int *cancel);
+#endif
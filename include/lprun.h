@@ -0,0 +1,107 @@
+#ifndef LPRUN_H
+#define LPRUN_H
+/* liblprun: submit print jobs from inside another program.
+ *
+ * All state lives in an lprun_ctx; nothing is global, so a process may run
+ * several contexts side by side and call into them from any thread. Each
+ * context owns a converter pool and one sender thread per printer, the
+ * same pipeline `lprun --daemon` serves over its socket.
+ *
+ *   lprun_ctx *ctx = lprun_ctx_new(NULL);
+ *   struct lprun_job_spec spec = { .file = "/tmp/a.pdf", .printer = "Office" };
+ *   lprun_job *job;
+ *   lprun_submit(ctx, &spec, NULL, NULL, &job);
+ *   int status = lprun_job_wait(job);
+ *   lprun_job_release(job);
+ *   lprun_ctx_free(ctx);
+ */
+
+typedef struct lprun_ctx lprun_ctx;
+typedef struct lprun_job lprun_job;
+
+enum lprun_state {
+    LPRUN_QUEUED,
+    LPRUN_CONVERTING,
+    LPRUN_READY,        /* converted, waiting for its printer */
+    LPRUN_SENDING,
+    LPRUN_DONE,
+    LPRUN_FAILED
+};
+
+/* lprun_submit errors */
+enum lprun_error {
+    LPRUN_EINVAL = -1,      /* bad spec */
+    LPRUN_ENOPRINTER = -2,  /* no printer given and none discovered */
+    LPRUN_EAGAIN = -3,      /* context shutting down, or no thread for the printer */
+    LPRUN_ENOMEM = -4
+};
+
+struct lprun_ctx_opts {
+    const char *printer;    /* default CUPS queue */
+    const char *ip;         /* or default raw printer; neither = discover */
+    int port;               /* 0 = 9100 */
+    int workers;            /* converter threads, 0 = one per online core */
+    int no_cache;           /* skip the conversion cache */
+    int copy_mode;          /* enum raw_copy_mode, 0 = auto */
+};
+
+struct lprun_job_spec {
+    const char *file;
+    const char *printer;    /* NULL = ip, else the context's default */
+    const char *ip;
+    int port;               /* 0 = the context's */
+    int copies;             /* 0 = 1 */
+    int color_mode;         /* 0 = auto, 1 = color, 2 = grayscale */
+};
+
+/* a snapshot of a job, safe to read while the job runs on */
+struct lprun_job_info {
+    int id;
+    enum lprun_state state;
+    int status;             /* 0 = printed, else lprun's exit code */
+    char error[128];
+    char file[1024];
+    char printer[256];      /* where it went: CUPS queue or raw address */
+    long long bytes;
+    double conv_ms, send_ms;
+};
+
+struct lprun_stats {
+    long long submitted, done, failed;
+    int active;
+};
+
+/* called once per job from a sender thread, after it has finished (state
+ * LPRUN_DONE or LPRUN_FAILED); the job is valid for the duration */
+typedef void (*lprun_done_cb)(lprun_job *job, void *user);
+
+/* NULL opts = defaults; NULL if threads or memory ran out */
+lprun_ctx *lprun_ctx_new(const struct lprun_ctx_opts *o);
+/* finish every submitted job, then stop the threads. Release your jobs first */
+void lprun_ctx_free(lprun_ctx *ctx);
+
+/* queue a document and return at once. Returns the job id (> 0) or an
+ * lprun_error. If out is set it receives a reference the caller must drop
+ * with lprun_job_release; pass NULL to fire and forget */
+int lprun_submit(lprun_ctx *ctx, const struct lprun_job_spec *spec,
+                 lprun_done_cb cb, void *user, lprun_job **out);
+
+/* pollable completion: the fd is readable while finished jobs submitted
+ * without a callback (and still referenced) are waiting; lprun_next_done
+ * hands them out in completion order, NULL when none is left. The job
+ * stays owned by the reference lprun_submit returned */
+int lprun_ctx_fd(lprun_ctx *ctx);
+lprun_job *lprun_next_done(lprun_ctx *ctx);
+
+/* block until the job has finished; returns its status */
+int lprun_job_wait(lprun_job *job);
+void lprun_job_info(lprun_job *job, struct lprun_job_info *info);
+void lprun_job_release(lprun_job *job);
+
+void lprun_ctx_stats(lprun_ctx *ctx, struct lprun_stats *s);
+/* the default printer, discovered on first use; 0 on success */
+int lprun_default_printer(lprun_ctx *ctx, char *buf, int len);
+
+const char *lprun_state_name(enum lprun_state s);
+const char *lprun_strerror(int err);
+#endif
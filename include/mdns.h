@@ -0,0 +1,27 @@
+#ifndef MDNS_H
+#define MDNS_H
+
+/* one DNS-SD printer service answer */
+struct mdns_printer {
+    char name[128];         /* instance, e.g. "Office Laser" */
+    char service[32];       /* "_ipp._tcp", "_ipps._tcp" or "_pdl-datastream._tcp" */
+    char host[256];         /* SRV target */
+    char ip[16];
+    int port;
+    char pdl[256];          /* TXT pdl=, comma separated MIME types */
+    int color;              /* TXT Color=T/F: 1/0, -1 if absent */
+    int duplex;             /* TXT Duplex=T/F: 1/0, -1 if absent */
+};
+
+struct mdns_opts {
+    int timeout_ms;         /* hard deadline (default 1500) */
+    int first_only;         /* return at the first fully resolved answer */
+    const char *group;      /* default 224.0.0.251 */
+    int port;               /* default 5353 */
+    const char *iface_addr; /* outgoing multicast interface, NULL = routing default */
+};
+
+/* query _ipp._tcp, _ipps._tcp and _pdl-datastream._tcp; *out is malloc'd
+ * and holds resolved services only. returns count or -1 */
+int mdns_browse(const struct mdns_opts *o, struct mdns_printer **out);
+#endif
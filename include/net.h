@@ -0,0 +1,13 @@
+#ifndef NET_H
+#define NET_H
+#include <stdint.h>
+
+/* monotonic clock in milliseconds */
+double net_now_ms(void);
+/* parse dotted IPv4 into network byte order; returns 0 on success */
+int net_parse_ipv4(const char *s, uint32_t *addr);
+/* start a nonblocking connect; returns the fd (connect may still be in progress) or -1 */
+int net_connect_nb(uint32_t addr, int port);
+/* after EPOLLOUT on a connecting fd: 0 if connected, else the errno */
+int net_connect_result(int fd);
+#endif
@@ -0,0 +1,25 @@
+#ifndef NETIF_H
+#define NETIF_H
+#include <stdint.h>
+#include <net/if.h>
+#include "portscan.h"
+
+/* an IPv4 interface that might have printers behind it */
+struct netif {
+    char name[IF_NAMESIZE];
+    uint32_t addr;          /* network byte order */
+    int prefix;             /* real netmask length */
+    int score;              /* higher = more likely to reach printers */
+};
+
+/* every up, non-loopback, non-virtual IPv4 interface, best first.
+ * *out is malloc'd; returns count or -1 */
+int netif_list(struct netif **out);
+/* "a.b.c.0/n" for an interface; buf should hold 20 bytes */
+void netif_cidr(const struct netif *nif, char *buf, int len);
+/* host ranges covering the interfaces in order, at most max_hosts in
+ * total; a subnet bigger than what is left is narrowed to a window around
+ * our own address. returns range count, *out is malloc'd */
+int netif_scan_ranges(const struct netif *ifs, int n, unsigned max_hosts,
+                      struct portscan_range **out);
+#endif
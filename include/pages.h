@@ -0,0 +1,38 @@
+#ifndef PAGES_H
+#define PAGES_H
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* a page selection as given to --pages: "3-5,10,20-". Pages are 1-based
+ * and counted in document order, whatever the pages are labelled */
+
+#define PAGES_MAX_RANGES 32
+
+struct page_ranges {
+    int n;                  /* 0 = every page */
+    struct {
+        int first;
+        int last;           /* 0 = to the end */
+    } r[PAGES_MAX_RANGES];
+};
+
+/* -1 (with a message) on syntax errors. Ranges are sorted into document
+ * order with overlaps and neighbours merged: "5-6,1-3,4" becomes 1-6 */
+int pages_parse(const char *spec, struct page_ranges *pr);
+/* back to the "3-5,10,20-" form (what gs -sPageList takes) */
+void pages_format(const struct page_ranges *pr, char *buf, size_t len);
+int pages_selected(const struct page_ranges *pr, int page);
+/* how many of pages 1..total are selected */
+int pages_count(const struct page_ranges *pr, int total);
+/* the span covering every selected page; *last is 0 if it is open ended */
+void pages_span(const struct page_ranges *pr, int *first, int *last);
+/* one range: pdftops -f/-l can select it */
+int pages_contiguous(const struct page_ranges *pr);
+
+/* copy DSC-conforming PostScript from in_fd to out_fd keeping the prolog,
+ * the selected %%Page sections (renumbered) and the trailer. Returns the
+ * number of pages in the input; 0 if it has no %%Page comments, in which
+ * case everything was copied. -1 on errors or *cancel */
+int pages_extract_ps(int in_fd, int out_fd, const struct page_ranges *pr,
+                     const atomic_int *cancel);
+#endif
@@ -0,0 +1,35 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* pixel kernels for the raster paths: luma conversion and 1-bit
+ * dithering. Each has a scalar version and, on x86, SSE4.1 and AVX2
+ * ones picked at first use from what the CPU supports (NEON on ARM).
+ * All variants give identical output */
+
+/* gray = (77 R + 151 G + 28 B) / 256, the BT.601 weights in 8 bits;
+ * gray may be the input buffer itself */
+void pix_rgb_to_gray(const uint8_t *rgb, uint8_t *gray, size_t n);
+/* the same over a white background: alpha 0 gives 255 */
+void pix_rgba_to_gray(const uint8_t *rgba, uint8_t *gray, size_t n);
+
+/* 8x8 Bayer ordered dither of row y: bits is (n + 7) / 8 bytes, MSB
+ * first, 1 = black (as PCL and PWG raster want it) */
+void pix_dither_ordered(const uint8_t *gray, uint8_t *bits, size_t n, unsigned y);
+
+/* Floyd-Steinberg error diffusion; carries the error between rows, so
+ * rows go in top to bottom. Scalar only: each pixel depends on the last */
+struct pix_fs {
+    size_t width;
+    int16_t *cur, *next;        /* error owed to this row and the next; */
+};                              /* pixel x at [x + 1] */
+int pix_fs_init(struct pix_fs *fs, size_t width);
+void pix_fs_row(struct pix_fs *fs, const uint8_t *gray, uint8_t *bits);
+void pix_fs_free(struct pix_fs *fs);
+
+/* the variant in use: "avx2", "sse4.1", "neon" or "scalar" */
+const char *pix_kernel(void);
+/* use a given variant (for comparisons); -1 if unknown or unsupported */
+int pix_use(const char *name);
+#endif
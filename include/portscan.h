@@ -0,0 +1,37 @@
+#ifndef PORTSCAN_H
+#define PORTSCAN_H
+#include <stdint.h>
+
+/* a host that accepted a TCP connection */
+struct portscan_hit {
+    char ip[16];
+    int port;
+    double rtt_ms;          /* time from connect() to established */
+};
+
+struct portscan_opts {
+    const int *ports;       /* NULL = 9100, 631, 8611 */
+    int nports;
+    int concurrency;        /* probes in flight at once */
+    int timeout_ms;         /* per probe */
+    int budget_ms;          /* whole scan, 0 = no limit; hits so far are kept */
+};
+
+/* inclusive host range, host byte order */
+struct portscan_range {
+    uint32_t first, last;
+};
+
+/* fill in defaults for zero fields */
+void portscan_defaults(struct portscan_opts *o);
+/* probe every host in first..last (host byte order, inclusive);
+ * *hits is malloc'd and sorted by RTT. returns hit count or -1 */
+int portscan_range(uint32_t first, uint32_t last, const struct portscan_opts *o,
+                   struct portscan_hit **hits);
+/* scan several ranges concurrently in one event loop */
+int portscan_ranges(const struct portscan_range *r, int nr, const struct portscan_opts *o,
+                    struct portscan_hit **hits);
+/* same for "a.b.c.d/n" without network and broadcast addresses */
+int portscan_cidr(const char *cidr, const struct portscan_opts *o,
+                  struct portscan_hit **hits);
+#endif
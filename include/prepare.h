@@ -0,0 +1,84 @@
+#ifndef PREPARE_H
+#define PREPARE_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "pages.h"
+#include "sniff.h"
+
+/* what the user asked to print */
+enum prep_kind {
+    PREP_TEXT,
+    PREP_IMAGE,
+    PREP_FILE
+};
+
+/* the pipeline a document goes down, picked from its content */
+enum prep_route {
+    PREP_AS_IS,             /* printer-ready (PS, PCL, PJL, raster) or unknown */
+    PREP_PDF,               /* pdftops/gs */
+    PREP_ENCODE_IMAGE,      /* imgps, ImageMagick for what it can't do */
+    PREP_TYPESET            /* textps */
+};
+
+/* a document being turned into something the printer can take. The
+ * conversion can run on a worker thread while discovery is in progress */
+struct prep_job {
+    /* input */
+    enum prep_kind kind;
+    const char *src;        /* text, or path of the image/file */
+    int color_mode;         /* 0 = auto, 1 = color, 2 = grayscale */
+    int use_cache;          /* look up/store the conversion (default 1) */
+    int stream;             /* images/PDFs/text files: deliver on fd instead of a file */
+    const struct page_ranges *pages;    /* PDF/PostScript: what to print, NULL = all */
+    enum doc_format format; /* sniffed by prep_init */
+    enum prep_route route;
+
+    /* result */
+    char *out;              /* path to send */
+    int owns_out;           /* out is a temp file we must unlink */
+    int cached;             /* out came from the conversion cache */
+    int fd;                 /* streaming: read end of the converter's output, or -1 */
+    int status;             /* 0 = ok, else lprun's exit code for the failure */
+
+    /* worker state */
+    atomic_int cancel;
+    pthread_t tid;
+    int running;
+
+    /* streaming state */
+    pid_t pid;
+    int conv_fd;            /* converter output when the relay tees it */
+    int relay_out;
+    pthread_t relay;
+    int relaying, relay_ok;
+    int cache_fd;
+    char *cache_tmp;
+    char key[17];
+    pthread_t gen;          /* text files and images encoded in process: */
+    int generating, gen_ok; /* the thread writing fd's pipe */
+    int gen_in, gen_out;
+};
+
+/* reads the head of a file to route it: by content, not by name, so
+ * --image and --file only differ for content nothing recognises */
+void prep_init(struct prep_job *j, enum prep_kind kind, const char *src, int color_mode);
+/* convert synchronously; returns j->status */
+int prep_run(struct prep_job *j);
+/* convert on a worker thread; prep_wait joins it */
+int prep_start(struct prep_job *j);
+int prep_wait(struct prep_job *j);
+/* streaming: after the sender is done with fd, reap the converter and
+ * file the cache copy; returns j->status (converter failures included) */
+int prep_finish(struct prep_job *j, int sent_ok);
+/* stop a running conversion (kills the converter) and discard its output */
+void prep_cancel(struct prep_job *j);
+/* the input could go out as it is, to a printer that takes PDF */
+int prep_native_candidate(const struct prep_job *j, int is_cups);
+/* a printer advertising these formats (pdl list) takes the input as is */
+int prep_native_ok(const struct prep_job *j, const char *pdl, int is_cups);
+/* send the original input instead of converting it */
+void prep_use_original(struct prep_job *j);
+/* unlink and free the output */
+void prep_release(struct prep_job *j);
+#endif
@@ -1,4 +1,15 @@
 #ifndef PRINT_CUPS_H
 #define PRINT_CUPS_H
-int cups_print_file(const char *printer_name, const char *filename);
+
+struct cups_job_opts {
+    int copies;             /* printed by the server from one spooled document */
+    int color_mode;         /* 0 = auto, 1 = color, 2 = grayscale */
+    const char *title;      /* default "lprun-job" */
+};
+
+/* one job, document streamed from fd (file or pipe); opts may be NULL.
+ * returns job id (>0) or <=0 on failure */
+int cups_submit_fd(const char *printer_name, int fd, const struct cups_job_opts *opts);
+int cups_print_file(const char *printer_name, const char *filename,
+                    const struct cups_job_opts *opts);
 #endif
@@ -1,4 +1,47 @@
 #ifndef PRINT_RAW_H
 #define PRINT_RAW_H
-int send_file_raw(const char *ip, int port, const char *filename, int copies);
+#include <stddef.h>
+
+/* accounting for one raw transmission (see raw_transmit_fd) */
+struct raw_xfer {
+    long long total;        /* expected bytes, -1 if unknown (pipe/stdin) */
+    long long sent;         /* bytes written to the socket */
+    double seconds;         /* wall time spent transmitting */
+    const char *method;     /* "sendfile", "splice" or "buffered" */
+    int quiet;              /* no progress output */
+};
+
+/* how multiple copies are produced on a raw (JetDirect) printer */
+enum raw_copy_mode {
+    RAW_COPIES_AUTO,        /* PS prolog for PostScript, PJL otherwise */
+    RAW_COPIES_PJL,         /* @PJL SET QTY=N header */
+    RAW_COPIES_PS,          /* << /NumCopies N >> setpagedevice prolog */
+    RAW_COPIES_RESEND       /* one connection per copy (legacy fallback) */
+};
+
+/* job framing that makes the printer repeat the document itself */
+struct raw_frame {
+    char pjl[256];          /* sent before the document */
+    size_t pjl_len;
+    size_t split;           /* document bytes sent before the prolog */
+    char prolog[128];       /* PostScript inserted after the DSC header */
+    size_t prolog_len;
+    char post[128];         /* sent after the document */
+    size_t post_len;
+    int resend;             /* caller must send the document once per copy */
+};
+
+/* filename may be "-" for stdin */
+int send_file_raw(const char *ip, int port, const char *filename, int copies,
+                  enum raw_copy_mode mode);
+/* same, from an open fd; total is -1 for pipes */
+int send_fd_raw(const char *ip, int port, int fd, long long total, int copies,
+                enum raw_copy_mode mode);
+/* send_fd_raw with the transfer accounting (and x->quiet) exposed */
+int raw_send_fd(const char *ip, int port, int fd, long long total, int copies,
+                enum raw_copy_mode mode, struct raw_xfer *x);
+void raw_frame_build(struct raw_frame *f, const char *head, size_t head_len,
+                     int copies, enum raw_copy_mode mode);
+int raw_transmit_fd(int sock, int fd, struct raw_xfer *x);
+void raw_print_summary(const struct raw_xfer *x);
 #endif
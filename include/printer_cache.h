@@ -0,0 +1,24 @@
+#ifndef PRINTER_CACHE_H
+#define PRINTER_CACHE_H
+#include "disc.h"
+
+/* discovery results older than this are revalidated in the background */
+#define PCACHE_TTL (24 * 60 * 60)
+
+struct pcache_entry {
+    struct disc_printer p;
+    long long found_at;     /* unix time of discovery */
+    long long used_at;      /* last successful use */
+};
+
+/* most recently used entry; returns 0 if there is one */
+int pcache_get(struct pcache_entry *e);
+/* insert or refresh (moves it to the front) */
+int pcache_put(const struct disc_printer *p);
+/* mark the printer as just used successfully */
+void pcache_touch(const struct disc_printer *p);
+void pcache_invalidate(const struct disc_printer *p);
+int pcache_fresh(const struct pcache_entry *e);
+/* cheap liveness check: TCP connect for addresses, a local lookup for CUPS */
+int pcache_alive(const struct disc_printer *p, int timeout_ms);
+#endif
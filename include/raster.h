@@ -0,0 +1,63 @@
+#ifndef RASTER_H
+#define RASTER_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* rendering PostScript/PDF into a raster language for raw printers that
+ * interpret PostScript slowly or not at all. Ghostscript renders PNM
+ * pages into a pipe; they are encoded here and stream out of r->fd:
+ *   PWG Raster  8-bit sgray or srgb, line repeats plus PackBits
+ *   PCL         1-bit (ordered dither), TIFF PackBits (mode 2) */
+
+enum raster_pdl {
+    RASTER_PS,              /* no raster: PostScript, or the document as is */
+    RASTER_PWG,
+    RASTER_PCL
+};
+
+#define RASTER_DEFAULT_DPI 300
+
+struct raster_opts {
+    enum raster_pdl pdl;
+    int dpi;                /* 0 = RASTER_DEFAULT_DPI */
+    int color_mode;         /* 2 = grayscale; PCL is always monochrome */
+    int copies;             /* PWG: into each page header (NumCopies) */
+};
+
+struct raster_job {
+    struct raster_opts o;
+    int fd;                 /* read end: the encoded stream */
+    pid_t pid;              /* gs */
+    int gs_out;             /* PNM pages from gs */
+    int enc_out;
+    pthread_t tid;
+    int ok;                 /* encoder finished cleanly */
+    int pages;
+    atomic_int cancel;
+};
+
+/* TIFF/PostScript PackBits: n bytes into at most n + n / 128 + 1 */
+size_t raster_packbits(const uint8_t *in, size_t n, uint8_t *out);
+
+/* "ps", "pwg" or "pcl"; -1 if unknown */
+int raster_parse_pdl(const char *name, enum raster_pdl *pdl);
+const char *raster_pdl_name(enum raster_pdl pdl);
+/* what to send to a printer advertising these formats (a pdl list from
+ * discovery, "" if unknown): no raster if it takes PostScript or PDF */
+enum raster_pdl raster_pick_pdl(const char *pdl);
+
+/* render path (if in_fd < 0) or the PostScript on in_fd; 0 and r->fd set
+ * on success, -1 if Ghostscript can't be started */
+int raster_start(struct raster_job *r, const char *path, int in_fd, const struct raster_opts *o);
+/* after the sender is done with r->fd: reap gs, join the encoder, close
+ * r->fd. Returns 0 if every page was rendered and encoded */
+int raster_finish(struct raster_job *r, int sent_ok);
+
+/* encode the PNM pages on in_fd to out_fd; the number of pages, -1 on
+ * errors or *cancel */
+int raster_encode_fd(int in_fd, int out_fd, const struct raster_opts *o,
+                     const atomic_int *cancel);
+#endif
@@ -0,0 +1,35 @@
+#ifndef SNIFF_H
+#define SNIFF_H
+#include <stddef.h>
+
+/* what a document is, from its leading bytes rather than its name */
+enum doc_format {
+    DOC_UNKNOWN,
+    DOC_PDF,
+    DOC_PS,
+    DOC_PJL,                /* UEL/@PJL job, whatever language it wraps */
+    DOC_PCL,
+    DOC_PCLXL,
+    DOC_PWG,                /* PWG Raster */
+    DOC_URF,                /* Apple raster */
+    DOC_JPEG,
+    DOC_PNG,
+    DOC_PNM,
+    DOC_WEBP,
+    DOC_GIF,
+    DOC_TIFF,
+    DOC_BMP,
+    DOC_TEXT,
+    DOC_NFORMATS
+};
+
+/* bytes looked at: a PDF header may sit behind up to 1 KB of junk, and
+ * text is judged on the first 4 KB */
+#define SNIFF_BYTES 4096
+
+enum doc_format sniff_buf(const void *buf, size_t n);
+/* DOC_UNKNOWN for "-" (stdin can't be read twice) or unreadable files */
+enum doc_format sniff_file(const char *path);
+/* "PDF", "PNG image", ... */
+const char *sniff_name(enum doc_format f);
+#endif
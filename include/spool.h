@@ -0,0 +1,34 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+#include <signal.h>
+#include <stddef.h>
+#include "batch.h"
+
+/* job ids the daemon remembers; a finished job's slot is reused this many
+ * submissions later, and a slot still in use makes SUBMIT fail */
+#define SPOOL_MAX_JOBS 4096
+
+struct spool_opts {
+    const char *socket_path;    /* NULL = spool_socket_path() */
+    struct batch_opts jobs;     /* default printer, workers, cache, copy mode */
+    volatile sig_atomic_t *stop;    /* set (e.g. from a signal handler) to shut down */
+};
+
+/* $XDG_RUNTIME_DIR/lprun.sock, else lprun.sock in the cache dir; malloc'd */
+char *spool_socket_path(void);
+
+/* lprun --daemon: serve the line protocol below on a UNIX socket, feeding
+ * an lprun_ctx, until *o->stop is set; then finish the queued jobs and return.
+ *   SUBMIT <manifest line>   -> OK <id>          (queued, returns at once)
+ *   STATUS <id>              -> OK <id> <state> [error]
+ *   STATS                    -> OK submitted N done N failed N active N
+ * anything else              -> ERR <reason>
+ * Manifest lines have no escapes: a quoted path can't hold '"', and no
+ * request can hold a newline, so lprun --submit refuses such paths.
+ */
+int spool_serve(const struct spool_opts *o);
+
+/* client side: one request line, one reply line (without newline).
+ * returns 0 if the daemon answered OK, 1 for ERR, -1 if unreachable */
+int spool_request(const char *socket_path, const char *request, char *reply, size_t len);
+#endif
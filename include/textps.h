@@ -0,0 +1,55 @@
+#ifndef TEXTPS_H
+#define TEXTPS_H
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* plain text to PostScript, typeset in Courier (600/1000 em per glyph)
+ * with wrapping, tab stops, form feeds and a running header/footer.
+ * Output goes out in 64K chunks as it is produced, so memory use does not
+ * depend on the size of the input */
+
+#define TEXTPS_MAX_COLS 512
+#define TEXTPS_OUT_BYTES 65536
+
+struct textps_opts {
+    const char *title;      /* header text, NULL = no header or footer */
+    double font_size;       /* points, 0 = 10 */
+    int tab_width;          /* columns, 0 = 8 */
+    double page_w, page_h;  /* points, 0 = /etc/papersize (A4 or Letter) */
+    double margin;          /* points, 0 = 36 */
+};
+
+struct textps {
+    int out;
+    int err;                        /* write failed (errno value) */
+    char obuf[TEXTPS_OUT_BYTES];
+    size_t olen;
+
+    /* layout */
+    double size, leading, page_w, page_h, lm, rm, top;
+    int cols, rows, tab;
+    char title[512];                /* escaped */
+    char date[32];
+
+    /* position */
+    int pages, row, in_page, col;
+    char line[TEXTPS_MAX_COLS * 4 + 1];     /* escaped: \ooo worst case */
+    size_t llen;
+
+    /* UTF-8 decoding across feed() calls */
+    unsigned cp;
+    int need;
+    unsigned char seq[4];           /* the bytes of it read so far */
+    int nseq;
+};
+
+/* write the prolog; 0 on success */
+int textps_begin(struct textps *t, int out_fd, const struct textps_opts *o);
+/* typeset a chunk of text; -1 once output failed */
+int textps_feed(struct textps *t, const char *buf, size_t n);
+/* finish the last page and write the trailer; 0 on success */
+int textps_end(struct textps *t);
+/* all of in_fd to out_fd; stops early if *cancel is set. 0 on success */
+int textps_convert_fd(int in_fd, int out_fd, const struct textps_opts *o,
+                      const atomic_int *cancel);
+#endif
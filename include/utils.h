@@ -1,13 +1,42 @@
 #ifndef UTILS_H
 #define UTILS_H
+#include <stdatomic.h>
+#include <sys/types.h>
+
+struct page_ranges;
+
+/* pipe between a streaming converter and the sender; the converter
+ * blocks once this much output is waiting, so memory use stays flat */
+#define CONV_PIPE_BYTES (1 << 20)
+
 char *create_temp_with_suffix(const char *suffix);
-char *create_temp_ps_from_text(const char *text, int color_mode);
-char *convert_image_to_ps(const char *path, int color_mode);
-char *convert_pdf_to_ps(const char *path, int color_mode);
+/* conversions return a malloc'd temp file path or NULL; cancel may be NULL */
+char *create_temp_ps_from_text(const char *text, int color_mode, const atomic_int *cancel);
+/* a plain text file, paginated with its name in the header */
+char *convert_text_to_ps(const char *path, const atomic_int *cancel);
+char *convert_image_to_ps(const char *path, int color_mode, const atomic_int *cancel);
+/* pages selects what is converted; NULL (or no ranges) for every page */
+char *convert_pdf_to_ps(const char *path, int color_mode, const struct page_ranges *pages,
+                        const atomic_int *cancel);
+/* the selected pages of a DSC PostScript file */
+char *convert_ps_pages(const char *path, const struct page_ranges *pages,
+                       const atomic_int *cancel);
+/* streaming conversions: PostScript arrives on the returned pipe (read
+ * end, -1 on failure) as it is produced; reap *pid with wait_converter */
+int stream_image_to_ps(const char *path, int color_mode, pid_t *pid);
+int stream_pdf_to_ps(const char *path, int color_mode, const struct page_ranges *pages,
+                     pid_t *pid);
+/* grayscale PDFs and scattered page ranges can only stream through
+ * GhostScript; without it they take the file route (pdftops plus a gray
+ * prolog or the DSC page extractor) */
+int pdf_streams(int color_mode, const struct page_ranges *pages);
+/* 1 if the converter exited cleanly; cancel kills it */
+int wait_converter(pid_t pid, const atomic_int *cancel);
 char *get_local_subnet_cidr(void);
+char *get_cache_dir(void);
+void default_paper_size(double *w, double *h);
 int ends_with_ci(const char *s, const char *suffix);
 void trim(char *s);
-const char *escape_shell_arg(const char *s);
 void progress_bar(int percent);
 long get_file_size(const char *path);
 #endif
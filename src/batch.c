@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include "batch.h"
+#include "caps.h"
+#include "prepare.h"
+#include "print_cups.h"
+#include "utils.h"
+#include "net.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* next whitespace separated word, "double quoted" allowed; returns 0 at end */
+static int next_token(const char **p, char *buf, size_t len) {
+    const char *s = *p;
+    size_t n = 0;
+    while (isspace((unsigned char)*s)) s++;
+    if (!*s) return 0;
+
+    if (*s == '"') {
+        for (s++; *s && *s != '"'; s++) {
+            if (n + 1 < len) buf[n++] = *s;
+        }
+        if (*s == '"') s++;
+    } else {
+        for (; *s && !isspace((unsigned char)*s); s++) {
+            if (n + 1 < len) buf[n++] = *s;
+        }
+    }
+    buf[n] = '\0';
+    *p = s;
+    return 1;
+}
+
+int batch_parse_line(const char *line, int lineno, const struct batch_opts *o,
+                     struct batch_job *j) {
+    memset(j, 0, sizeof(*j));
+    j->line = lineno;
+    j->copies = 1;
+    j->port = o && o->port ? o->port : 9100;
+    if (o && o->printer) snprintf(j->printer, sizeof(j->printer), "%s", o->printer);
+    else if (o && o->ip) snprintf(j->ip, sizeof(j->ip), "%s", o->ip);
+
+    const char *p = line;
+    char tok[1024];
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '#' || !next_token(&p, tok, sizeof(tok))) return 0;
+    snprintf(j->file, sizeof(j->file), "%s", tok);
+
+    while (next_token(&p, tok, sizeof(tok))) {
+        if (strncmp(tok, "printer=", 8) == 0) {
+            snprintf(j->printer, sizeof(j->printer), "%.255s", tok + 8);
+            j->ip[0] = '\0';
+        } else if (strncmp(tok, "ip=", 3) == 0) {
+            char *colon = strchr(tok + 3, ':');
+            if (colon) {
+                *colon = '\0';
+                j->port = atoi(colon + 1);
+            }
+            snprintf(j->ip, sizeof(j->ip), "%.63s", tok + 3);
+            j->printer[0] = '\0';
+        } else if (strncmp(tok, "copies=", 7) == 0) {
+            j->copies = atoi(tok + 7);
+        } else if (strcmp(tok, "color") == 0) {
+            j->color_mode = 1;
+        } else if (strcmp(tok, "gray") == 0 || strcmp(tok, "grayscale") == 0) {
+            j->color_mode = 2;
+        } else {
+            snprintf(j->error, sizeof(j->error), "unknown field '%.64s'", tok);
+            return -1;
+        }
+    }
+    if (j->copies < 1 || j->port <= 0 || j->port > 65535) {
+        snprintf(j->error, sizeof(j->error), "bad copies or port");
+        return -1;
+    }
+    return 1;
+}
+
+int batch_read(const char *path, const struct batch_opts *o, struct batch_job **out) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "re");
+    *out = NULL;
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    int n = 0, cap = 0, lineno = 0, bad = 0;
+    char line[2048];
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct batch_job *tmp = realloc(*out, cap * sizeof(*tmp));
+            if (!tmp) {
+                bad = 1;
+                break;
+            }
+            *out = tmp;
+        }
+        int r = batch_parse_line(line, lineno, o, &(*out)[n]);
+        if (r < 0) {
+            fprintf(stderr, "%s:%d: %s\n", path, lineno, (*out)[n].error);
+            bad = 1;
+        }
+        if (r > 0) n++;
+    }
+    if (f != stdin) fclose(f);
+    if (bad) {
+        free(*out);
+        *out = NULL;
+        return -1;
+    }
+    return n;
+}
+
+/* ---- pipeline ---- */
+
+/* jobs bound for one printer, sent in manifest order by their own thread */
+struct batch_dest {
+    struct batch_run *run;
+    int *order;             /* job indices, ascending */
+    int n;
+    int in_flight;          /* claimed by a converter, not yet sent */
+    int unbounded;          /* no sender thread: don't make converters wait */
+    pthread_t tid;
+};
+
+struct batch_run {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct batch_job *jobs;
+    struct prep_job *prep;
+    int *dest_of;
+    int *ready;
+    struct batch_dest *dests;
+    int njobs, ndests;
+    int next_job, finished;
+    const struct batch_opts *o;
+};
+
+static int same_dest(const struct batch_job *a, const struct batch_job *b) {
+    if (a->printer[0] || b->printer[0]) return strcmp(a->printer, b->printer) == 0;
+    return strcmp(a->ip, b->ip) == 0 && a->port == b->port;
+}
+
+static int is_image(const char *path) {
+    static const char *const ext[] = { ".png", ".jpg", ".jpeg", ".gif", ".bmp",
+                                       ".tif", ".tiff", ".webp" };
+    for (size_t i = 0; i < sizeof(ext) / sizeof(ext[0]); i++) {
+        if (ends_with_ci(path, ext[i])) return 1;
+    }
+    return 0;
+}
+
+static void *convert_worker(void *arg) {
+    struct batch_run *r = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        /* don't run too far ahead of a slow printer. The slot is taken
+         * with the job, so a printer's slots always hold its earliest
+         * unsent jobs and its sender can drain them */
+        struct batch_dest *d;
+        while (r->next_job < r->njobs &&
+               !(d = &r->dests[r->dest_of[r->next_job]])->unbounded &&
+               d->in_flight >= BATCH_QUEUE_DEPTH) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        int i = r->next_job;
+        if (i >= r->njobs) {
+            pthread_mutex_unlock(&r->lock);
+            return NULL;
+        }
+        r->next_job++;
+        r->dests[r->dest_of[i]].in_flight++;
+        pthread_mutex_unlock(&r->lock);
+
+        batch_convert_job(&r->jobs[i], &r->prep[i], r->o);
+
+        pthread_mutex_lock(&r->lock);
+        r->ready[i] = 1;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+void batch_convert_job(struct batch_job *j, struct prep_job *pj, const struct batch_opts *o) {
+    double t0 = net_now_ms();
+    prep_init(pj, is_image(j->file) ? PREP_IMAGE : PREP_FILE, j->file, j->color_mode);
+    pj->use_cache = o->use_cache;
+
+    /* a PDF goes as it is to a printer that takes PDF */
+    int is_cups = j->printer[0] != '\0';
+    struct caps c;
+    if (prep_native_candidate(pj, is_cups) &&
+        caps_get(is_cups, is_cups ? j->printer : j->ip, j->port, NULL, o->use_cache, &c) == 0 &&
+        prep_native_ok(pj, c.pdl, is_cups)) {
+        prep_use_original(pj);
+    } else {
+        prep_run(pj);
+    }
+    j->conv_ms = net_now_ms() - t0;
+}
+
+void batch_send_job(struct batch_job *j, struct prep_job *pj, const struct batch_opts *o) {
+    if (pj->status != 0) {
+        j->status = pj->status;
+        snprintf(j->error, sizeof(j->error), "conversion failed");
+        prep_release(pj);
+        return;
+    }
+
+    const char *out = pj->out;
+    double t0 = net_now_ms();
+    if (j->printer[0]) {
+        struct cups_job_opts jo = { .copies = j->copies, .color_mode = j->color_mode };
+        int id = cups_print_file(j->printer, out, &jo);
+        if (id <= 0) {
+            j->status = 20;
+            snprintf(j->error, sizeof(j->error), "CUPS submission failed");
+        } else {
+            long sz = get_file_size(out);
+            j->bytes = sz > 0 ? sz : 0;
+        }
+    } else {
+        struct raw_xfer x = { .quiet = 1 };
+        int fd = open(out, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        int rc = fd < 0 ? -5 : raw_send_fd(j->ip, j->port, fd,
+                                           fstat(fd, &st) == 0 ? (long long)st.st_size : -1,
+                                           j->copies, o->copy_mode, &x);
+        if (fd >= 0) close(fd);
+        j->bytes = x.sent;
+        if (rc != 0) {
+            j->status = 21;
+            snprintf(j->error, sizeof(j->error), "raw send failed (%d)", rc);
+        }
+    }
+    j->send_ms = net_now_ms() - t0;
+    prep_release(pj);
+}
+
+static void *sender_thread(void *arg) {
+    struct batch_dest *d = arg;
+    struct batch_run *r = d->run;
+
+    for (int k = 0; k < d->n; k++) {
+        int i = d->order[k];
+        pthread_mutex_lock(&r->lock);
+        while (!r->ready[i]) pthread_cond_wait(&r->cond, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+
+        struct batch_job *j = &r->jobs[i];
+        batch_send_job(j, &r->prep[i], r->o);
+
+        pthread_mutex_lock(&r->lock);
+        d->in_flight--;
+        r->finished++;
+        if (j->status == 0) {
+            printf("[%d/%d] %s -> %s: ok (convert %.0f ms, send %.0f ms)\n", r->finished, r->njobs,
+                   j->file, j->printer[0] ? j->printer : j->ip, j->conv_ms, j->send_ms);
+        } else {
+            printf("[%d/%d] %s -> %s: %s\n", r->finished, r->njobs,
+                   j->file, j->printer[0] ? j->printer : j->ip, j->error);
+        }
+        fflush(stdout);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+/* batch_run:
+ *  convert every job on o->workers threads while one sender thread per
+ *  printer submits them in manifest order. A printer's queue holds at
+ *  most BATCH_QUEUE_DEPTH converted-but-unsent documents.
+ */
+int batch_run(struct batch_job *jobs, int n, const struct batch_opts *o) {
+    struct batch_run r = { .jobs = jobs, .njobs = n, .o = o };
+    if (n <= 0) return 0;
+
+    r.prep = calloc(n, sizeof(*r.prep));
+    r.dest_of = calloc(n, sizeof(*r.dest_of));
+    r.ready = calloc(n, sizeof(*r.ready));
+    r.dests = calloc(n, sizeof(*r.dests));
+    int *order = calloc(n, sizeof(*order));
+    int *first = calloc(n, sizeof(*first));
+    if (!r.prep || !r.dest_of || !r.ready || !r.dests || !order || !first) {
+        free(r.prep); free(r.dest_of); free(r.ready); free(r.dests); free(order); free(first);
+        return n;
+    }
+
+    /* group jobs by printer; each group's slice of order[] stays ascending */
+    for (int i = 0; i < n; i++) {
+        int d = 0;
+        while (d < r.ndests && !same_dest(&jobs[first[d]], &jobs[i])) d++;
+        if (d == r.ndests) first[r.ndests++] = i;
+        r.dest_of[i] = d;
+        r.dests[d].n++;
+    }
+    for (int d = 0, off = 0; d < r.ndests; d++) {
+        r.dests[d].run = &r;
+        r.dests[d].order = order + off;
+        off += r.dests[d].n;
+        r.dests[d].n = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        struct batch_dest *d = &r.dests[r.dest_of[i]];
+        d->order[d->n++] = i;
+    }
+    free(first);
+
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.cond, NULL);
+
+    /* senders first, so converters always have someone draining their queue */
+    for (int d = 0; d < r.ndests; d++) {
+        r.dests[d].unbounded = pthread_create(&r.dests[d].tid, NULL, sender_thread, &r.dests[d]) != 0;
+    }
+
+    int nworkers = o->workers > 0 ? o->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > n) nworkers = n;
+    pthread_t *workers = calloc(nworkers, sizeof(*workers));
+    int started = 0;
+    for (int w = 0; workers && w < nworkers; w++) {
+        if (pthread_create(&workers[started], NULL, convert_worker, &r) == 0) started++;
+    }
+    if (!started) convert_worker(&r);     /* no threads: convert here */
+
+    for (int d = 0; d < r.ndests; d++) {
+        if (r.dests[d].unbounded) sender_thread(&r.dests[d]);
+        else pthread_join(r.dests[d].tid, NULL);
+    }
+    for (int w = 0; w < started; w++) pthread_join(workers[w], NULL);
+
+    int failed = 0;
+    for (int i = 0; i < n; i++) failed += jobs[i].status != 0;
+
+    pthread_cond_destroy(&r.cond);
+    pthread_mutex_destroy(&r.lock);
+    free(workers);
+    free(order);
+    free(r.prep);
+    free(r.dest_of);
+    free(r.ready);
+    free(r.dests);
+    return failed;
+}
+
+void batch_print_summary(const struct batch_job *jobs, int n, double seconds) {
+    int ok = 0;
+    long long bytes = 0;
+
+    printf("\n%-5s  %-32s  %-20s  %-6s  %9s  %9s\n", "line", "file", "printer", "status",
+           "conv ms", "send ms");
+    for (int i = 0; i < n; i++) {
+        const struct batch_job *j = &jobs[i];
+        printf("%-5d  %-32.32s  %-20.20s  %-6s  %9.0f  %9.0f\n", j->line, j->file,
+               j->printer[0] ? j->printer : j->ip, j->status ? "FAIL" : "ok",
+               j->conv_ms, j->send_ms);
+        if (j->status == 0) {
+            ok++;
+            bytes += j->bytes;
+        }
+    }
+
+    double s = seconds > 0 ? seconds : 1e-9;
+    printf("\n%d/%d jobs printed in %.2f s (%.1f jobs/s, %.2f MB/s)\n",
+           ok, n, seconds, ok / s, bytes / 1e6 / s);
+}
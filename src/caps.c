@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include "caps.h"
+#include "net.h"
+#include "utils.h"
+#include <cups/cups.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+/* one line per printer, tab separated, most recent first:
+ *   kind  name  port  checked_at  source  pdl
+ * kind is "cups" or "ip"; rewritten atomically, under caps.lock, like the
+ * printer cache */
+#define CAPS_MAX 32
+
+/* the INFO CONFIG reply is a few hundred bytes; stop well past that */
+#define PJL_REPLY_MAX 8192
+
+struct caps_entry {
+    int is_cups;
+    char name[256];
+    int port;
+    struct caps c;
+};
+
+/* PJL LANGUAGES names, matched as prefixes (PCL5E, POSTSCRIPT3, ...) */
+static const struct {
+    const char *lang;
+    const char *mime;
+} pjl_langs[] = {
+    { "POSTSCRIPT", "application/postscript" },
+    { "PDF", "application/pdf" },
+    { "PCLXL", "application/vnd.hp-pclxl" },
+    { "PCL", "application/vnd.hp-pcl" },
+    { "PWGRASTER", "image/pwg-raster" },
+    { "URF", "image/urf" },
+};
+
+const char *caps_source_name(int src) {
+    switch (src) {
+    case CAPS_SRC_MDNS: return "mdns";
+    case CAPS_SRC_IPP: return "ipp";
+    case CAPS_SRC_PJL: return "pjl";
+    default: return "none";
+    }
+}
+
+/* whole list items only: "application/pdf" is not "application/pdfx" */
+static int list_has(const char *list, const char *mime) {
+    size_t n = strlen(mime);
+    for (const char *p = list; (p = strcasestr(p, mime)) != NULL; p += n) {
+        if ((p == list || p[-1] == ',') && (p[n] == '\0' || p[n] == ',')) return 1;
+    }
+    return 0;
+}
+
+int caps_accepts(const struct caps *c, const char *mime) {
+    return list_has(c->pdl, mime);
+}
+
+/* add mime to a comma separated list unless it is there already */
+static void add_type(char *pdl, size_t len, const char *mime) {
+    if (!mime[0] || list_has(pdl, mime)) return;
+    size_t used = strlen(pdl);
+    if (used + (used > 0) + strlen(mime) >= len) return;
+    snprintf(pdl + used, len - used, "%s%s", used ? "," : "", mime);
+}
+
+/* ---- probes ---- */
+
+static void add_attr_types(ipp_attribute_t *a, char *pdl, size_t len) {
+    int n = a ? ippGetCount(a) : 0;
+    for (int i = 0; i < n; i++) {
+        const char *mime = ippGetString(a, i, NULL);
+        /* octet-stream only means "typed by the server" */
+        if (mime && strcasecmp(mime, "application/octet-stream") != 0) add_type(pdl, len, mime);
+    }
+}
+
+int caps_query_cups(const char *queue, char *pdl, size_t len) {
+    pdl[0] = '\0';
+    cups_dest_t *d = cupsGetNamedDest(CUPS_HTTP_DEFAULT, queue, NULL);
+    if (!d) return -1;
+    cups_dinfo_t *info = cupsCopyDestInfo(CUPS_HTTP_DEFAULT, d);
+    if (info) {
+        add_attr_types(cupsFindDestSupported(CUPS_HTTP_DEFAULT, d, info, "document-format"),
+                       pdl, len);
+        cupsFreeDestInfo(info);
+    }
+    cupsFreeDests(1, d);
+    return pdl[0] ? 0 : -1;
+}
+
+/* caps_query_ipp:
+ *  Get-Printer-Attributes for document-format-supported, straight to the
+ *  printer at /ipp/print (where IPP Everywhere puts it). Connect and
+ *  reply each get timeout_ms.
+ */
+int caps_query_ipp(const char *host, int port, int timeout_ms, char *pdl, size_t len) {
+    pdl[0] = '\0';
+    http_t *http = httpConnect2(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1,
+                                timeout_ms, NULL);
+    if (!http) return -1;
+    httpSetTimeout(http, timeout_ms / 1000.0, NULL, NULL);
+
+    char uri[512];
+    snprintf(uri, sizeof(uri), "ipp://%s:%d/ipp/print", host, port);
+    ipp_t *req = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+    ippAddString(req, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+    ippAddString(req, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+    ippAddString(req, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", NULL,
+                 "document-format-supported");
+
+    ipp_t *resp = cupsDoRequest(http, req, "/ipp/print");
+    if (resp) {
+        add_attr_types(ippFindAttribute(resp, "document-format-supported", IPP_TAG_MIMETYPE),
+                       pdl, len);
+        ippDelete(resp);
+    }
+    httpClose(http);
+    return pdl[0] ? 0 : -1;
+}
+
+/* the LANGUAGES [n ENUMERATED] block of an INFO CONFIG reply */
+static void parse_pjl_config(char *reply, char *pdl, size_t len) {
+    int left = -1;
+    char *save = NULL;
+    for (char *line = strtok_r(reply, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        while (isspace((unsigned char)*line)) line++;
+        if (left < 0) {
+            if (strncasecmp(line, "LANGUAGES", 9) == 0) {
+                const char *br = strchr(line, '[');
+                left = br ? atoi(br + 1) : 0;
+            }
+            continue;
+        }
+        if (left-- == 0) break;
+        for (size_t i = 0; i < sizeof(pjl_langs) / sizeof(pjl_langs[0]); i++) {
+            if (strncasecmp(line, pjl_langs[i].lang, strlen(pjl_langs[i].lang)) == 0) {
+                add_type(pdl, len, pjl_langs[i].mime);
+                break;
+            }
+        }
+    }
+}
+
+/* caps_query_pjl:
+ *  ask the raw port for its configuration. PJL replies on the same
+ *  connection and ends each reply with a form feed; the closing UEL ends
+ *  the job, so nothing is printed.
+ */
+int caps_query_pjl(const char *ip, int port, int timeout_ms, char *pdl, size_t len) {
+    static const char req[] = "\033%-12345X@PJL\r\n@PJL INFO CONFIG\r\n\033%-12345X";
+    pdl[0] = '\0';
+
+    uint32_t addr;
+    if (net_parse_ipv4(ip, &addr) != 0) return -1;
+    int fd = net_connect_nb(addr, port);
+    if (fd < 0) return -1;
+
+    double deadline = net_now_ms() + timeout_ms;
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    if (poll(&pfd, 1, timeout_ms) != 1 || net_connect_result(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    /* the request fits any socket buffer: one write on the fresh socket */
+    if (write(fd, req, sizeof(req) - 1) != (ssize_t)(sizeof(req) - 1)) {
+        close(fd);
+        return -1;
+    }
+
+    char *reply = malloc(PJL_REPLY_MAX + 1);
+    size_t got = 0;
+    pfd.events = POLLIN;
+    while (reply && got < PJL_REPLY_MAX) {
+        int wait = (int)(deadline - net_now_ms());
+        if (wait <= 0 || poll(&pfd, 1, wait) != 1) break;
+        ssize_t n = read(fd, reply + got, PJL_REPLY_MAX - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+        reply[got] = '\0';
+        if (strstr(reply, "LANGUAGES") && memchr(reply, '\f', got)) break;
+    }
+    close(fd);
+    if (reply) {
+        reply[got] = '\0';
+        parse_pjl_config(reply, pdl, len);
+        free(reply);
+    }
+    return pdl[0] ? 0 : -1;
+}
+
+/* ---- cache ---- */
+
+static char *cache_path(const char *name) {
+    char *dir = get_cache_dir();
+    if (!dir) return NULL;
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s", dir, name);
+    free(dir);
+    return path;
+}
+
+static char *cache_file(void) {
+    return cache_path("caps");
+}
+
+/* held from load_all to save_all, as for the printer cache: a run
+ * probing another printer must not drop this one's entry. -1: go on
+ * unlocked */
+static int lock_cache(void) {
+    char *path = cache_path("caps.lock");
+    if (!path) return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd >= 0) flock(fd, LOCK_EX);
+    return fd;
+}
+
+static void unlock_cache(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static int load_all(struct caps_entry *e, int max) {
+    char *path = cache_file();
+    if (!path) return 0;
+    FILE *f = fopen(path, "re");
+    free(path);
+    if (!f) return 0;
+
+    int n = 0;
+    char line[1024];
+    while (n < max && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *save = line;
+        char *fld[6] = { 0 };
+        for (int i = 0; i < 6; i++) fld[i] = strsep(&save, "\t");
+        if (!fld[5]) continue;      /* malformed */
+
+        struct caps_entry *c = &e[n];
+        memset(c, 0, sizeof(*c));
+        c->is_cups = strcmp(fld[0], "cups") == 0;
+        snprintf(c->name, sizeof(c->name), "%s", fld[1]);
+        c->port = atoi(fld[2]);
+        c->c.checked_at = atoll(fld[3]);
+        c->c.source = atoi(fld[4]);
+        snprintf(c->c.pdl, sizeof(c->c.pdl), "%s", fld[5]);
+        if (c->name[0]) n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int save_all(const struct caps_entry *e, int n) {
+    char *path = cache_file();
+    if (!path) return -1;
+    size_t len = strlen(path) + 8;
+    char *tmp = malloc(len);
+    if (!tmp) { free(path); return -1; }
+    snprintf(tmp, len, "%s.XXXXXX", path);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        free(tmp);
+        free(path);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%s\t%s\t%d\t%lld\t%d\t%s\n", e[i].is_cups ? "cups" : "ip", e[i].name,
+                e[i].port, e[i].c.checked_at, e[i].c.source, e[i].c.pdl);
+    }
+    int rc = fclose(f) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    free(path);
+    return rc;
+}
+
+static int same(const struct caps_entry *e, int is_cups, const char *name, int port) {
+    return e->is_cups == is_cups && strcmp(e->name, name) == 0 && (is_cups || e->port == port);
+}
+
+static int cache_get(int is_cups, const char *name, int port, struct caps *c) {
+    struct caps_entry all[CAPS_MAX];
+    int n = load_all(all, CAPS_MAX);
+    long long now = (long long)time(NULL);
+    for (int i = 0; i < n; i++) {
+        if (!same(&all[i], is_cups, name, port)) continue;
+        long long ttl = all[i].c.pdl[0] ? CAPS_TTL : CAPS_RETRY_TTL;
+        if (now - all[i].c.checked_at >= ttl) return -1;
+        *c = all[i].c;
+        c->cached = 1;
+        return 0;
+    }
+    return -1;
+}
+
+static void cache_put(int is_cups, const char *name, int port, const struct caps *c) {
+    struct caps_entry all[CAPS_MAX + 1];
+    int lock = lock_cache();
+    int n = load_all(all + 1, CAPS_MAX);
+
+    memset(&all[0], 0, sizeof(all[0]));
+    all[0].is_cups = is_cups;
+    snprintf(all[0].name, sizeof(all[0].name), "%s", name);
+    all[0].port = is_cups ? 0 : port;
+    all[0].c = *c;
+    all[0].c.cached = 0;
+
+    int out = 1;
+    for (int i = 1; i <= n; i++) {
+        if (!same(&all[i], is_cups, name, port)) all[out++] = all[i];
+    }
+    save_all(all, out > CAPS_MAX ? CAPS_MAX : out);
+    unlock_cache(lock);
+}
+
+/* caps_get:
+ *  a discovery hint is current and free; after that the cache, and only
+ *  then the network: the scheduler for a CUPS queue, IPP then PJL for an
+ *  address. A printer that answered nothing is remembered too, for
+ *  CAPS_RETRY_TTL, so it isn't probed on every job.
+ */
+int caps_get(int is_cups, const char *name, int port, const char *hint, int use_cache,
+             struct caps *c) {
+    memset(c, 0, sizeof(*c));
+    if (!name || !name[0]) return -1;
+
+    if (hint && hint[0]) {
+        snprintf(c->pdl, sizeof(c->pdl), "%s", hint);
+        c->source = CAPS_SRC_MDNS;
+    } else if (use_cache && cache_get(is_cups, name, port, c) == 0) {
+        return c->pdl[0] ? 0 : -1;
+    } else if (is_cups) {
+        if (caps_query_cups(name, c->pdl, sizeof(c->pdl)) == 0) c->source = CAPS_SRC_IPP;
+    } else if (caps_query_ipp(name, 631, CAPS_PROBE_MS, c->pdl, sizeof(c->pdl)) == 0) {
+        c->source = CAPS_SRC_IPP;
+    } else if (caps_query_pjl(name, port ? port : 9100, CAPS_PROBE_MS, c->pdl, sizeof(c->pdl)) == 0) {
+        c->source = CAPS_SRC_PJL;
+    }
+
+    c->checked_at = (long long)time(NULL);
+    if (use_cache) cache_put(is_cups, name, port, c);
+    return c->pdl[0] ? 0 : -1;
+}
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include "conv_cache.h"
+#include "utils.h"
+#include "exec.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* entries used this recently are never evicted: another lprun may be
+ * sending one right now */
+#define CONV_CACHE_GRACE 60
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t h, const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* get_cache_dir()/conv, created if missing; caller must free */
+static char *conv_dir(void) {
+    char *base = get_cache_dir();
+    if (!base) return NULL;
+    size_t len = strlen(base) + sizeof("/conv");
+    char *dir = malloc(len);
+    if (dir) snprintf(dir, len, "%s/conv", base);
+    free(base);
+    if (dir && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+static char *entry_path(const char *dir, const char *name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *p = malloc(len);
+    if (p) snprintf(p, len, "%s/%s", dir, name);
+    return p;
+}
+
+int conv_cache_key(const char *path, const char *params, char key[17]) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    uint64_t h = FNV_OFFSET;
+    unsigned char buf[65536];
+    long long size = 0;
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) > 0) {
+        h = fnv1a(h, buf, r);
+        size += r;
+    }
+    close(fd);
+    if (r < 0) return -1;
+
+    /* size and params go in after the content so equal prefixes differ */
+    h = fnv1a(h, (const unsigned char *)&size, sizeof(size));
+    h = fnv1a(h, (const unsigned char *)params, strlen(params));
+    snprintf(key, 17, "%016llx", (unsigned long long)h);
+    return 0;
+}
+
+char *conv_cache_lookup(const char *key) {
+    char *dir = conv_dir();
+    if (!dir) return NULL;
+    char name[32];
+    snprintf(name, sizeof(name), "%s.ps", key);
+    char *path = entry_path(dir, name);
+    free(dir);
+
+    struct stat st;
+    if (!path || stat(path, &st) != 0 || st.st_size == 0) {
+        free(path);
+        return NULL;
+    }
+    /* mtime is the LRU clock */
+    utimensat(AT_FDCWD, path, NULL, 0);
+    return path;
+}
+
+static int copy_fd(int in, int out) {
+    for (;;) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (n == 0) return 0;
+        if (n > 0) continue;
+        if (errno == EINTR) continue;
+        break;
+    }
+    /* EXDEV/ENOSYS/EINVAL on older kernels: plain copy */
+    char buf[65536];
+    ssize_t r;
+    while ((r = read(in, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0; off < r; ) {
+            ssize_t w = write(out, buf + off, r - off);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += w;
+        }
+    }
+    return r < 0 ? -1 : 0;
+}
+
+struct conv_entry {
+    char name[32];
+    long long size;
+    time_t used;
+};
+
+static int by_use(const void *a, const void *b) {
+    const struct conv_entry *x = a, *y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+/* list the cache entries; *out is malloc'd, returns count or -1 */
+static int list_entries(const char *dir, struct conv_entry **out, long long *total) {
+    *out = NULL;
+    *total = 0;
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+
+    int n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        size_t l = strlen(de->d_name);
+        if (l != 19 || strcmp(de->d_name + 16, ".ps") != 0) continue;
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, 0) != 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct conv_entry *e = realloc(*out, cap * sizeof(*e));
+            if (!e) break;
+            *out = e;
+        }
+        memcpy((*out)[n].name, de->d_name, l + 1);
+        (*out)[n].size = st.st_size;
+        (*out)[n].used = st.st_mtime;
+        *total += st.st_size;
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+/* drop least recently used entries until the cache fits CONV_CACHE_MAX_BYTES */
+static void evict(const char *dir) {
+    struct conv_entry *e;
+    long long total;
+    int n = list_entries(dir, &e, &total);
+    if (n <= 0 || total <= CONV_CACHE_MAX_BYTES) {
+        free(e);
+        return;
+    }
+
+    qsort(e, n, sizeof(*e), by_use);
+    time_t now = time(NULL);
+    for (int i = 0; i < n && total > CONV_CACHE_MAX_BYTES; i++) {
+        if (now - e[i].used < CONV_CACHE_GRACE) break;
+        char *p = entry_path(dir, e[i].name);
+        if (p && unlink(p) == 0) total -= e[i].size;
+        free(p);
+    }
+    free(e);
+}
+
+int conv_cache_begin(char **tmp) {
+    *tmp = NULL;
+    char *dir = conv_dir();
+    if (!dir) return -1;
+    *tmp = entry_path(dir, ".store.XXXXXX");
+    free(dir);
+    int fd = *tmp ? mkostemp(*tmp, O_CLOEXEC) : -1;
+    if (fd < 0) {
+        free(*tmp);
+        *tmp = NULL;
+    }
+    return fd;
+}
+
+int conv_cache_commit(const char *key, char *tmp, int ok) {
+    char *dir = conv_dir();
+    int rc = -1;
+    if (ok && dir) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s.ps", key);
+        char *path = entry_path(dir, name);
+        /* rename is atomic: readers see the old entry or the whole new one */
+        rc = path ? rename(tmp, path) : -1;
+        free(path);
+    }
+    if (rc != 0) unlink(tmp);
+    else evict(dir);
+    free(tmp);
+    free(dir);
+    return rc;
+}
+
+int conv_cache_store(const char *key, const char *file) {
+    char *tmp;
+    int out = conv_cache_begin(&tmp);
+    if (out < 0) return -1;
+
+    int in = open(file, O_RDONLY | O_CLOEXEC);
+    int ok = in >= 0 && copy_fd(in, out) == 0;
+    if (in >= 0) close(in);
+    close(out);
+    return conv_cache_commit(key, tmp, ok);
+}
+
+/* counters file: "hits misses\n", updated under flock */
+void conv_cache_count(int hit) {
+    char *dir = conv_dir();
+    if (!dir) return;
+    char *path = entry_path(dir, "stats");
+    free(dir);
+    if (!path) return;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd < 0) return;
+
+    flock(fd, LOCK_EX);
+    char buf[64] = { 0 };
+    long long hits = 0, misses = 0;
+    if (pread(fd, buf, sizeof(buf) - 1, 0) > 0) sscanf(buf, "%lld %lld", &hits, &misses);
+    if (hit) hits++;
+    else misses++;
+    /* counters only grow, so the new line never ends before the old one */
+    int len = snprintf(buf, sizeof(buf), "%lld %lld\n", hits, misses);
+    if (pwrite(fd, buf, len, 0) != len) fprintf(stderr, "Could not update conversion cache counters\n");
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+int conv_cache_stats(struct conv_stats *s) {
+    memset(s, 0, sizeof(*s));
+    char *dir = conv_dir();
+    if (!dir) return -1;
+
+    char *path = entry_path(dir, "stats");
+    FILE *f = path ? fopen(path, "re") : NULL;
+    if (f) {
+        if (fscanf(f, "%lld %lld", &s->hits, &s->misses) != 2) s->hits = s->misses = 0;
+        fclose(f);
+    }
+    free(path);
+
+    struct conv_entry *e;
+    int n = list_entries(dir, &e, &s->bytes);
+    s->entries = n > 0 ? n : 0;
+    free(e);
+    free(dir);
+    return 0;
+}
+
+void conv_tool_ids(const char *tools, char *buf, size_t len) {
+    size_t used = 0;
+    buf[0] = '\0';
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", tools);
+    char *save = NULL;
+    for (char *t = strtok_r(list, " ", &save); t; t = strtok_r(NULL, " ", &save)) {
+        const char *full = exec_find(t);
+        struct stat st;
+        if (full && stat(full, &st) == 0) {
+            int w = snprintf(buf + used, len - used, "%s:%lld:%lld;", t,
+                             (long long)st.st_size, (long long)st.st_mtime);
+            if (w > 0 && (size_t)w < len - used) used += w;
+        }
+    }
+}
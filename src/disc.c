@@ -2,92 +2,443 @@
 #define _POSIX_C_SOURCE 200809L
 #include "disc.h"
 #include "utils.h"
+#include "portscan.h"
+#include "netif.h"
+#include "mdns.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "net.h"
+#include <cups/cups.h>
 
-/* discover_cups_printer:
- *  - runs `lpinfo -v` and looks for first network or usb printer with a name
- *  - returns malloc'd C string with the CUPS printer name if found, else NULL
+/* hosts probed across all interfaces; keeps a /16 within the time budget */
+#define DISCOVERY_MAX_HOSTS 4096
+
+static void init_printer(struct disc_printer *p, int src) {
+    memset(p, 0, sizeof(*p));
+    p->source = src;
+    p->color = p->duplex = -1;
+}
+
+/* state of each queue from cupsEnumDests, collected by enum_cb */
+struct cups_enum {
+    struct disc_printer *p;
+    int n, cap;
+    int *is_default;
+};
+
+static int enum_cb(void *user_data, unsigned flags, cups_dest_t *dest) {
+    struct cups_enum *e = user_data;
+    if (flags & (CUPS_DEST_FLAGS_REMOVED | CUPS_DEST_FLAGS_ERROR)) return 1;
+    if (dest->instance) return 1;   /* lpoptions instances share the queue */
+
+    if (e->n == e->cap) {
+        int cap = e->cap ? e->cap * 2 : 8;
+        struct disc_printer *p = realloc(e->p, cap * sizeof(*p));
+        int *d = realloc(e->is_default, cap * sizeof(*d));
+        if (p) e->p = p;
+        if (d) e->is_default = d;
+        if (!p || !d) return 0;
+        e->cap = cap;
+    }
+
+    struct disc_printer *p = &e->p[e->n];
+    init_printer(p, DISC_SRC_CUPS);
+    p->is_cups = 1;
+    snprintf(p->name, sizeof(p->name), "%s", dest->name);
+
+    const char *v = cupsGetOption("printer-state", dest->num_options, dest->options);
+    p->state = v ? atoi(v) : 3;
+    v = cupsGetOption("printer-is-accepting-jobs", dest->num_options, dest->options);
+    if (v && strcmp(v, "false") == 0) p->state = 5;
+    v = cupsGetOption("queued-job-count", dest->num_options, dest->options);
+    p->queued = v ? atoi(v) : -1;
+
+    e->is_default[e->n++] = dest->is_default;
+    return 1;
+}
+
+/* default queue first, then idle before busy before stopped, then the
+ * shorter queue; otherwise keep the order CUPS reported them in */
+static int queue_before(const struct disc_printer *a, int adef,
+                        const struct disc_printer *b, int bdef) {
+    if (adef != bdef) return adef;
+    if (a->state != b->state) return a->state < b->state;
+    return a->queued < b->queued;
+}
+
+/* discover_cups_queues:
+ *  enumerate the locally configured CUPS queues in process (no lpstat),
+ *  giving up after timeout_ms. Scanners, fax queues and printers CUPS
+ *  merely sees on the network are masked out. Each entry carries the
+ *  printer state and its number of active jobs; the list is sorted with
+ *  the default destination first. *out is malloc'd; returns count or -1.
  */
-char *discover_cups_printer(void) {
-    FILE *fp = popen("lpstat -v 2>/dev/null", "r");
-    if (!fp) return NULL;
-    char line[1024];
-    while (fgets(line, sizeof(line), fp)) {
-        /* sample: device for Canon_G3020_series: usb://Canon/G3020%20series?serial=... */
-        if (strstr(line, "device for ")) {
-            char *p = strstr(line, "device for ");
-            p += strlen("device for ");
-            char *colon = strstr(p, ":");
-            if (colon) {
-                *colon = '\0';
-                char *name = strdup(p);
-                /* strip newline and spaces */
-                trim(name);
-                pclose(fp);
-                return name;
+int discover_cups_queues(int timeout_ms, struct disc_printer **out) {
+    struct cups_enum e = { 0 };
+    *out = NULL;
+
+    int ok = cupsEnumDests(CUPS_DEST_FLAGS_NONE, timeout_ms > 0 ? timeout_ms : 1000, NULL,
+                           0, CUPS_PRINTER_DISCOVERED | CUPS_PRINTER_SCANNER | CUPS_PRINTER_FAX,
+                           enum_cb, &e);
+    if (!ok && e.n == 0) {
+        free(e.p);
+        free(e.is_default);
+        return -1;
+    }
+
+    /* queue lengths the destination options didn't carry: one request for all */
+    int missing = 0;
+    for (int i = 0; i < e.n; i++) missing |= e.p[i].queued < 0;
+    if (missing) {
+        cups_job_t *jobs;
+        int nj = cupsGetJobs2(CUPS_HTTP_DEFAULT, &jobs, NULL, 0, CUPS_WHICHJOBS_ACTIVE);
+        for (int i = 0; i < e.n; i++) {
+            if (e.p[i].queued >= 0) continue;
+            e.p[i].queued = 0;
+            for (int j = 0; j < nj; j++) {
+                e.p[i].queued += jobs[j].dest && strcmp(jobs[j].dest, e.p[i].name) == 0;
             }
         }
+        if (nj > 0) cupsFreeJobs(nj, jobs);
     }
-    pclose(fp);
-    return NULL;
+
+    /* insertion sort: a handful of queues, and it keeps ties stable */
+    for (int i = 1; i < e.n; i++) {
+        struct disc_printer p = e.p[i];
+        int d = e.is_default[i], k = i;
+        while (k > 0 && queue_before(&p, d, &e.p[k - 1], e.is_default[k - 1])) {
+            e.p[k] = e.p[k - 1];
+            e.is_default[k] = e.is_default[k - 1];
+            k--;
+        }
+        e.p[k] = p;
+        e.is_default[k] = d;
+    }
+
+    free(e.is_default);
+    *out = e.p;
+    return e.n;
+}
+
+/* discover_cups_printer:
+ *  the preferred CUPS queue from discover_cups_queues (the default
+ *  destination if there is one); malloc'd name, or NULL
+ */
+char *discover_cups_printer(void) {
+    struct disc_printer *q;
+    int n = discover_cups_queues(1000, &q);
+    char *name = n > 0 ? strdup(q[0].name) : NULL;
+    free(q);
+    return name;
+}
+
+/* a short human description of a CUPS queue's state, e.g. "idle, 2 jobs queued" */
+const char *disc_queue_status(const struct disc_printer *p, char *buf, size_t len) {
+    const char *st = p->state == 3 ? "idle" : p->state == 4 ? "printing" :
+                     p->state == 5 ? "stopped" : "unknown";
+    if (p->queued > 0) snprintf(buf, len, "%s, %d job%s queued", st, p->queued, p->queued == 1 ? "" : "s");
+    else snprintf(buf, len, "%s", st);
+    return buf;
+}
+
+/* discovery_scan_lan:
+ *  port scan all usable interfaces at once, best-ranked first, with the
+ *  total host count capped at DISCOVERY_MAX_HOSTS
+ */
+int discovery_scan_lan(const struct portscan_opts *o, struct portscan_hit **hits) {
+    struct netif *ifs;
+    struct portscan_range *ranges;
+    *hits = NULL;
+
+    int nifs = netif_list(&ifs);
+    if (nifs <= 0) {
+        free(ifs);
+        return -1;
+    }
+    int nr = netif_scan_ranges(ifs, nifs, DISCOVERY_MAX_HOSTS, &ranges);
+    free(ifs);
+    if (nr <= 0) {
+        free(ranges);
+        return -1;
+    }
+
+    int n = portscan_ranges(ranges, nr, o, hits);
+    free(ranges);
+    return n;
 }
 
 /* discover_printer_ip:
- *  Try avahi-browse first, then nmap scan of local /24 subnet for common printer ports
+ *  Try an mDNS/DNS-SD browse first, then a port scan of the local subnets for common printer ports
  *  returns malloc'd ip string or NULL
  */
 char *discover_printer_ip(void) {
-    /* Try avahi-browse */
-    FILE *fp = popen("avahi-browse -rt _ipp._tcp --resolve --parsable 2>/dev/null", "r");
-    if (fp) {
-        char line[1024];
-        while (fgets(line, sizeof(line), fp)) {
-            /* parsable format: ;enp3s0;IPv4;My Printer;_ipp._tcp;local;hostname.local;192.168.1.40;631; */
-            char *cpy = strdup(line);
-            char *save = cpy;
-            char *tok;
-            int field = 0;
-            char *ip = NULL;
-            while ((tok = strsep(&cpy, ";")) != NULL) {
-                field++;
-                if (field == 8 && tok && strlen(tok) > 0) {
-                    ip = strdup(tok);
-                    break;
-                }
+    /* Try DNS-SD first: the first resolved printer service wins */
+    struct mdns_opts mo = { .timeout_ms = 1500, .first_only = 1 };
+    struct mdns_printer *found;
+    int nfound = mdns_browse(&mo, &found);
+    if (nfound > 0) {
+        char *ip = strdup(found[0].ip);
+        free(found);
+        return ip;
+    }
+    free(found);
+
+    /* Fallback: in-process port scan of every local subnet */
+    struct portscan_hit *hits;
+    int n = discovery_scan_lan(NULL, &hits);
+    if (n <= 0) return NULL;
+
+    /* hits are sorted by RTT: the closest responder wins */
+    char *res = strdup(hits[0].ip);
+    free(hits);
+    return res;
+}
+
+/* ---- concurrent discovery ---- */
+
+static const char *const source_names[DISC_NSOURCES] = { "cups", "mdns", "scan" };
+
+const char *disc_source_name(int src) {
+    return src >= 0 && src < DISC_NSOURCES ? source_names[src] : "?";
+}
+
+static int backend_cups(struct disc_printer **out, int budget_ms) {
+    return discover_cups_queues(budget_ms, out);
+}
+
+static int backend_mdns(struct disc_printer **out, int budget_ms) {
+    struct mdns_opts mo = { .timeout_ms = budget_ms < 1500 ? budget_ms : 1500, .first_only = 1 };
+    struct mdns_printer *found;
+    int n = mdns_browse(&mo, &found);
+    if (n <= 0) { free(found); return n; }
+
+    *out = calloc(n, sizeof(**out));
+    if (!*out) { free(found); return -1; }
+    for (int i = 0; i < n; i++) {
+        struct disc_printer *p = &(*out)[i];
+        init_printer(p, DISC_SRC_MDNS);
+        snprintf(p->name, sizeof(p->name), "%s", found[i].ip);
+        p->port = strcmp(found[i].service, "_pdl-datastream._tcp") == 0 ? found[i].port : 9100;
+        snprintf(p->pdl, sizeof(p->pdl), "%s", found[i].pdl);
+        p->color = found[i].color;
+        p->duplex = found[i].duplex;
+    }
+    free(found);
+    return n;
+}
+
+static int backend_scan(struct disc_printer **out, int budget_ms) {
+    struct portscan_opts so = { .budget_ms = budget_ms };
+    if (budget_ms < 300) so.timeout_ms = budget_ms;
+    struct portscan_hit *hits;
+    int n = discovery_scan_lan(&so, &hits);
+    if (n <= 0) return n;
+
+    /* one entry per host; JetDirect hosts first since that's what we print to */
+    *out = calloc(n, sizeof(**out));
+    if (!*out) { free(hits); return -1; }
+    int m = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < n; i++) {
+            if ((hits[i].port == 9100) != (pass == 0)) continue;
+            int dup = 0;
+            for (int k = 0; k < m; k++) dup |= strcmp((*out)[k].name, hits[i].ip) == 0;
+            if (dup) continue;
+            init_printer(&(*out)[m], DISC_SRC_SCAN);
+            snprintf((*out)[m].name, sizeof((*out)[m].name), "%s", hits[i].ip);
+            (*out)[m].port = 9100;
+            m++;
+        }
+    }
+    free(hits);
+    return m;
+}
+
+typedef int (*backend_fn)(struct disc_printer **out, int budget_ms);
+static const backend_fn backends[DISC_NSOURCES] = { backend_cups, backend_mdns, backend_scan };
+
+/* shared between discover_all and its backend threads. Threads are
+ * detached and may outlive the call, so the last one out frees it */
+struct race {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    int budget_ms;
+    int done[DISC_NSOURCES];
+    double latency_ms[DISC_NSOURCES];
+    struct disc_printer *found[DISC_NSOURCES];
+    int nfound[DISC_NSOURCES];
+    double started;
+};
+
+struct race_arg {
+    struct race *r;
+    int src;
+};
+
+static void race_release(struct race *r) {
+    pthread_mutex_lock(&r->lock);
+    int last = --r->refs == 0;
+    pthread_mutex_unlock(&r->lock);
+    if (!last) return;
+    for (int i = 0; i < DISC_NSOURCES; i++) free(r->found[i]);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
+
+static void *race_thread(void *arg) {
+    struct race_arg a = *(struct race_arg *)arg;
+    free(arg);
+
+    struct disc_printer *found = NULL;
+    int n = backends[a.src](&found, a.r->budget_ms);
+
+    pthread_mutex_lock(&a.r->lock);
+    a.r->found[a.src] = found;
+    a.r->nfound[a.src] = n;
+    a.r->latency_ms[a.src] = net_now_ms() - a.r->started;
+    a.r->done[a.src] = 1;
+    pthread_cond_broadcast(&a.r->cond);
+    pthread_mutex_unlock(&a.r->lock);
+
+    race_release(a.r);
+    return NULL;
+}
+
+/* settled once the best source with results can't be beaten any more,
+ * i.e. every more-preferred source has finished */
+static int race_settled(const struct race *r) {
+    for (int s = 0; s < DISC_NSOURCES; s++) {
+        if (!r->done[s]) return 0;
+        if (r->nfound[s] > 0) return 1;
+    }
+    return 1;
+}
+
+/* discover_all:
+ *  start CUPS, DNS-SD and port-scan discovery at once and return when the
+ *  most preferred source with an answer has no better source still
+ *  pending, or when the global deadline expires. Results are merged in
+ *  preference order with duplicate addresses folded together (keeping
+ *  the DNS-SD capabilities). *out is malloc'd; returns count or -1.
+ */
+int discover_all(const struct disc_opts *opts, struct disc_printer **out,
+                 struct disc_report *rep) {
+    struct disc_opts o = opts ? *opts : (struct disc_opts){ 0 };
+    if (o.deadline_ms <= 0) o.deadline_ms = 3000;
+    *out = NULL;
+
+    struct race *r = calloc(1, sizeof(*r));
+    if (!r) return -1;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->cond, &ca);
+    pthread_condattr_destroy(&ca);
+    r->refs = 1;
+    r->budget_ms = o.deadline_ms;
+    r->started = net_now_ms();
+
+    for (int s = 0; s < DISC_NSOURCES; s++) {
+        struct race_arg *a = malloc(sizeof(*a));
+        pthread_t tid;
+        if (a) {
+            *a = (struct race_arg){ r, s };
+            pthread_mutex_lock(&r->lock);
+            r->refs++;
+            pthread_mutex_unlock(&r->lock);
+            if (pthread_create(&tid, NULL, race_thread, a) == 0) {
+                pthread_detach(tid);
+                continue;
             }
-            free(save);
-            if (ip) { pclose(fp); return ip; }
+            free(a);
+            pthread_mutex_lock(&r->lock);
+            r->refs--;
+            pthread_mutex_unlock(&r->lock);
         }
-        pclose(fp);
-    }
-
-    /* Fallback: nmap scan on local subnet (requires nmap) */
-    char *subnet = get_local_subnet_cidr();
-    if (!subnet) return NULL;
-
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "nmap -p 9100,8611,631 --open -oG - %s 2>/dev/null", subnet);
-    FILE *nfp = popen(cmd, "r");
-    if (!nfp) { free(subnet); return NULL; }
-    char line[1024];
-    while (fgets(line, sizeof(line), nfp)) {
-        if (strncmp(line, "Host:", 5) == 0) {
-            /* Host: 192.168.1.40 ()    Ports: 9100/open/tcp//jetdirect/// */
-            char *p = line + strlen("Host:");
-            while (*p == ' ') p++;
-            char ipbuf[64] = {0};
-            sscanf(p, "%63s", ipbuf);
-            if (strstr(line, "Ports:") && (strstr(line, "9100/open") || strstr(line, "8611/open") || strstr(line, "631/open"))) {
-                char *res = strdup(ipbuf);
-                pclose(nfp);
-                free(subnet);
-                return res;
+        /* couldn't start it: count as finished with nothing */
+        r->done[s] = 1;
+    }
+
+    struct timespec dl;
+    clock_gettime(CLOCK_MONOTONIC, &dl);
+    dl.tv_sec += o.deadline_ms / 1000;
+    dl.tv_nsec += (long)(o.deadline_ms % 1000) * 1000000L;
+    if (dl.tv_nsec >= 1000000000L) {
+        dl.tv_sec++;
+        dl.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    while (!race_settled(r)) {
+        if (pthread_cond_timedwait(&r->cond, &r->lock, &dl) == ETIMEDOUT) break;
+    }
+
+    /* merge what we have, most preferred source first */
+    int total = 0, n = 0;
+    for (int s = 0; s < DISC_NSOURCES; s++) {
+        if (r->done[s] && r->nfound[s] > 0) total += r->nfound[s];
+    }
+    struct disc_printer *merged = calloc(total > 0 ? total : 1, sizeof(*merged));
+    for (int s = 0; merged && s < DISC_NSOURCES; s++) {
+        if (!r->done[s]) continue;
+        for (int i = 0; i < r->nfound[s]; i++) {
+            const struct disc_printer *p = &r->found[s][i];
+            int dup = 0;
+            for (int k = 0; k < n && !dup; k++) {
+                dup = merged[k].is_cups == p->is_cups && strcmp(merged[k].name, p->name) == 0;
             }
+            if (!dup) merged[n++] = *p;
         }
     }
-    pclose(nfp);
-    free(subnet);
-    return NULL;
+    if (rep) {
+        for (int s = 0; s < DISC_NSOURCES; s++) {
+            rep->done[s] = r->done[s];
+            rep->nfound[s] = r->done[s] ? r->nfound[s] : 0;
+            rep->latency_ms[s] = r->done[s] ? r->latency_ms[s] : net_now_ms() - r->started;
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    race_release(r);
+
+    if (!merged) return -1;
+    *out = merged;
+    return n;
+}
+
+void disc_print_report(const struct disc_report *rep) {
+    for (int s = 0; s < DISC_NSOURCES; s++) {
+        if (rep->done[s]) {
+            printf("  %-5s %d found in %.1f ms\n", source_names[s],
+                   rep->nfound[s] > 0 ? rep->nfound[s] : 0, rep->latency_ms[s]);
+        } else {
+            printf("  %-5s still running after %.1f ms, ignored\n",
+                   source_names[s], rep->latency_ms[s]);
+        }
+    }
+}
+
+/* discover_printer:
+ *  the single best printer from discover_all; with o->verbose the
+ *  per-backend latencies are printed
+ */
+int discover_printer(struct disc_printer *p, const struct disc_opts *o) {
+    struct disc_printer *all;
+    struct disc_report rep;
+    int n = discover_all(o, &all, &rep);
+
+    if (o && o->verbose) disc_print_report(&rep);
+    if (n <= 0) {
+        free(all);
+        return -1;
+    }
+    *p = all[0];
+    free(all);
+    return 0;
 }
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include "exec.h"
+#include "net.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* ---- PATH lookup ---- */
+
+struct exec_path {
+    char *name;
+    char *path;                 /* NULL: not in PATH */
+    struct exec_path *next;
+};
+
+static struct exec_path *path_cache;
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *search_path(const char *name) {
+    char full[1024];
+    struct stat st;
+
+    if (strchr(name, '/')) {
+        return access(name, X_OK) == 0 ? strdup(name) : NULL;
+    }
+    const char *p = getenv("PATH");
+    if (!p) p = "/usr/local/bin:/usr/bin:/bin";
+    for (;;) {
+        const char *end = strchr(p, ':');
+        size_t dl = end ? (size_t)(end - p) : strlen(p);
+        snprintf(full, sizeof(full), "%.*s/%s", (int)dl, dl ? p : ".", name);
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            return strdup(full);
+        }
+        if (!end) return NULL;
+        p = end + 1;
+    }
+}
+
+const char *exec_find(const char *name) {
+    pthread_mutex_lock(&path_lock);
+    struct exec_path *e = path_cache;
+    while (e && strcmp(e->name, name) != 0) e = e->next;
+    if (!e) {
+        e = calloc(1, sizeof(*e));
+        if (e && !(e->name = strdup(name))) {
+            free(e);
+            e = NULL;
+        }
+        if (e) {
+            e->path = search_path(name);
+            e->next = path_cache;
+            path_cache = e;
+        }
+    }
+    const char *path = e ? e->path : NULL;
+    pthread_mutex_unlock(&path_lock);
+    return path;
+}
+
+/* ---- spawning ---- */
+
+static void redirect(posix_spawn_file_actions_t *fa, int fd, int target) {
+    if (fd == EXEC_NULL) {
+        posix_spawn_file_actions_addopen(fa, target, "/dev/null",
+                                         target == STDIN_FILENO ? O_RDONLY : O_WRONLY, 0);
+    } else if (fd >= 0) {
+        posix_spawn_file_actions_adddup2(fa, fd, target);
+    }
+}
+
+int exec_spawn(const char *const argv[], int in, int out, int err, pid_t *pid) {
+    const char *path = exec_find(argv[0]);
+    if (!path) return -1;
+
+    int p[2] = { -1, -1 };
+    if (out == EXEC_PIPE) {
+        if (pipe2(p, O_CLOEXEC) != 0) return -1;
+#ifdef F_SETPIPE_SZ
+        fcntl(p[1], F_SETPIPE_SZ, CONV_PIPE_BYTES);
+#endif
+        out = p[1];
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawnattr_init(&attr);
+    redirect(&fa, in, STDIN_FILENO);
+    redirect(&fa, out, STDOUT_FILENO);
+    redirect(&fa, err, STDERR_FILENO);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    /* our descriptors are close-on-exec; this catches any a library opened */
+    posix_spawn_file_actions_addclosefrom_np(&fa, STDERR_FILENO + 1);
+#endif
+
+    /* own group, so a cancel reaches its helpers too; and the default
+     * SIGPIPE even if we ignore or block it */
+    sigset_t none, pipe_only;
+    sigemptyset(&none);
+    sigemptyset(&pipe_only);
+    sigaddset(&pipe_only, SIGPIPE);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &pipe_only);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK |
+                                    POSIX_SPAWN_SETSIGDEF);
+
+    int rc = posix_spawn(pid, path, &fa, &attr, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    if (p[1] >= 0) close(p[1]);
+    if (rc != 0) {
+        if (p[0] >= 0) close(p[0]);
+        return -1;
+    }
+    return p[0] >= 0 ? p[0] : 0;
+}
+
+/* keep the last len - 1 bytes of a child's stderr */
+static void tail_append(char *tail, size_t len, size_t *used, const char *buf, size_t n) {
+    if (len < 2) return;
+    if (n >= len - 1) {
+        memcpy(tail, buf + n - (len - 1), len - 1);
+        *used = len - 1;
+        return;
+    }
+    if (*used + n > len - 1) {
+        size_t drop = *used + n - (len - 1);
+        memmove(tail, tail + drop, *used - drop);
+        *used -= drop;
+    }
+    memcpy(tail + *used, buf, n);
+    *used += n;
+}
+
+/* wait for pid, reading errfd (if >= 0) into tail meanwhile. On cancel or
+ * deadline the group gets SIGTERM and, EXEC_KILL_GRACE_MS later, SIGKILL.
+ * Returns the exit code or -1 */
+static int reap(pid_t pid, int timeout_ms, const atomic_int *cancel, int errfd,
+                char *tail, size_t tail_len) {
+    double deadline = timeout_ms > 0 ? net_now_ms() + timeout_ms : 0;
+    double kill_at = 0;
+    size_t used = 0;
+    int status;
+    if (tail_len) tail[0] = '\0';
+
+    if (!deadline && !cancel && errfd < 0) {
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return -1;
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    int killed = 0;
+    for (;;) {
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) break;
+        if (r < 0 && errno != EINTR) return -1;
+
+        double now = net_now_ms();
+        if (!killed && ((cancel && atomic_load(cancel)) || (deadline && now >= deadline))) {
+            kill(-pid, SIGTERM);
+            killed = 1;
+            kill_at = now + EXEC_KILL_GRACE_MS;
+        } else if (killed && kill_at && now >= kill_at) {
+            kill(-pid, SIGKILL);
+            kill_at = 0;
+        }
+
+        /* sleep on stderr if we have it, else in short steps */
+        struct pollfd pfd = { .fd = errfd, .events = POLLIN };
+        if (poll(&pfd, errfd >= 0 ? 1 : 0, 20) > 0) {
+            char buf[512];
+            ssize_t n = read(errfd, buf, sizeof(buf));
+            if (n > 0) tail_append(tail, tail_len, &used, buf, n);
+            else if (n == 0) errfd = -1;    /* closed; keep polling the pid */
+        }
+    }
+    if (errfd >= 0) {
+        char buf[512];
+        ssize_t n;
+        while ((n = read(errfd, buf, sizeof(buf))) > 0) tail_append(tail, tail_len, &used, buf, n);
+    }
+    if (tail_len) tail[used] = '\0';
+    if (killed) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int exec_wait(pid_t pid, int timeout_ms, const atomic_int *cancel) {
+    return reap(pid, timeout_ms, cancel, -1, NULL, 0);
+}
+
+int exec_run(const char *const argv[], int in, int out, int timeout_ms,
+             const atomic_int *cancel) {
+    int e[2];
+    if (pipe2(e, O_CLOEXEC | O_NONBLOCK) != 0) return -1;
+
+    pid_t pid;
+    int rc = exec_spawn(argv, in, out, e[1], &pid);
+    close(e[1]);
+    if (rc < 0) {
+        close(e[0]);
+        fprintf(stderr, "Cannot run %s\n", argv[0]);
+        return -1;
+    }
+
+    char tail[512];
+    double t0 = net_now_ms();
+    int code = reap(pid, timeout_ms, cancel, e[0], tail, sizeof(tail));
+    close(e[0]);
+    if (code != 0 && !(cancel && atomic_load(cancel))) {
+        /* the last line is usually the reason */
+        size_t n = strlen(tail);
+        while (n && (tail[n - 1] == '\n' || tail[n - 1] == '\r')) tail[--n] = '\0';
+        char *last = strrchr(tail, '\n');
+        last = last ? last + 1 : tail;
+        if (code < 0 && timeout_ms > 0 && net_now_ms() - t0 >= timeout_ms) {
+            fprintf(stderr, "%s killed (no result after %g s)\n", argv[0], timeout_ms / 1000.0);
+        } else {
+            fprintf(stderr, "%s failed (status %d)%s%s\n", argv[0], code,
+                    last[0] ? ": " : "", last);
+        }
+    }
+    return code;
+}
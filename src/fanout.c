@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include "fanout.h"
+#include "net.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* the transmission is a short list of segments, either bytes from memory
+ * (PJL header, PS prolog, trailer) or a range of the document file */
+struct segment {
+    const char *mem;        /* NULL = file range */
+    off_t off;
+    size_t len;
+};
+
+#define MAX_SEGS 5
+
+/* per-connection state for the event loop */
+struct conn {
+    int idx;                /* index into the target array */
+    int fd;
+    int connecting;
+    int seg;                /* current segment */
+    size_t seg_done;        /* bytes of it already sent */
+    int copy;               /* resend mode: copies already sent */
+    double started;         /* first connect, for the target's timing */
+    double dialed, last_progress;
+};
+
+static int add_target(struct fanout_target **arr, int *n, int *cap,
+                      const char *spec, int default_port) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *colon = strchr(buf, ':');
+    int port = default_port;
+    if (colon) {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+
+    uint32_t a;
+    if (net_parse_ipv4(buf, &a) != 0 || port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid printer address: %s\n", spec);
+        return -1;
+    }
+
+    if (*n == *cap) {
+        int ncap = *cap ? *cap * 2 : 16;
+        struct fanout_target *t = realloc(*arr, ncap * sizeof(**arr));
+        if (!t) return -1;
+        *arr = t;
+        *cap = ncap;
+    }
+    struct fanout_target *t = &(*arr)[(*n)++];
+    memset(t, 0, sizeof(*t));
+    snprintf(t->ip, sizeof(t->ip), "%s", buf);
+    t->port = port;
+    return 0;
+}
+
+int fanout_parse_targets(const char *list, int default_port, struct fanout_target **out) {
+    struct fanout_target *arr = NULL;
+    int n = 0, cap = 0;
+    char *copy = strdup(list);
+    if (!copy) return -1;
+
+    char *save = copy, *tok;
+    while ((tok = strsep(&save, ",")) != NULL) {
+        while (isspace((unsigned char)*tok)) tok++;
+        if (*tok == '\0') continue;
+        if (add_target(&arr, &n, &cap, tok, default_port) != 0) {
+            free(copy);
+            free(arr);
+            return -1;
+        }
+    }
+    free(copy);
+    *out = arr;
+    return n;
+}
+
+int fanout_read_targets(const char *path, int default_port, struct fanout_target **out) {
+    FILE *f = fopen(path, "re");
+    if (!f) { perror(path); return -1; }
+
+    struct fanout_target *arr = NULL;
+    int n = 0, cap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        char *end = p;
+        while (*end && !isspace((unsigned char)*end)) end++;
+        *end = '\0';
+        if (*p == '\0') continue;
+        if (add_target(&arr, &n, &cap, p, default_port) != 0) {
+            fclose(f);
+            free(arr);
+            return -1;
+        }
+    }
+    fclose(f);
+    *out = arr;
+    return n;
+}
+
+/* every target needs its own pass over the data, so stdin is spooled once */
+static int open_document(const char *filename, char **spooled) {
+    *spooled = NULL;
+    if (strcmp(filename, "-") != 0) return open(filename, O_RDONLY | O_CLOEXEC);
+
+    char tmpl[] = "/tmp/lprun_fanout_XXXXXX";
+    int fd = mkostemp(tmpl, O_CLOEXEC);
+    if (fd < 0) return -1;
+    char buf[65536];
+    ssize_t r;
+    while ((r = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        if (write(fd, buf, r) != r) { close(fd); unlink(tmpl); return -1; }
+    }
+    lseek(fd, 0, SEEK_SET);
+    *spooled = strdup(tmpl);
+    return fd;
+}
+
+static void fail(struct fanout_target *t, const char *what, int err) {
+    t->status = -1;
+    snprintf(t->error, sizeof(t->error), "%s: %s", what, strerror(err));
+}
+
+/* start a nonblocking connection to tg in slot and watch it; -1 on errors */
+static int dial(int ep, int slot, struct conn *c, const struct fanout_target *tg) {
+    uint32_t a;
+    net_parse_ipv4(tg->ip, &a);
+    int fd = net_connect_nb(a, tg->port);
+    if (fd < 0) return -1;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = (uint32_t)slot };
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    c->fd = fd;
+    c->connecting = 1;
+    c->seg = 0;
+    c->seg_done = 0;
+    c->dialed = c->last_progress = net_now_ms();
+    return 0;
+}
+
+/* push as much as the socket accepts; 1 = finished, 0 = would block, -1 = error */
+static int pump(struct conn *c, int doc_fd, const struct segment *segs, int nsegs,
+                long long *sent) {
+    for (;;) {
+        if (c->seg == nsegs) return 1;
+        const struct segment *s = &segs[c->seg];
+        if (c->seg_done == s->len) {
+            c->seg++;
+            c->seg_done = 0;
+            continue;
+        }
+
+        ssize_t w;
+        if (s->mem) {
+            w = send(c->fd, s->mem + c->seg_done, s->len - c->seg_done, MSG_NOSIGNAL);
+        } else {
+            off_t off = s->off + (off_t)c->seg_done;
+            w = sendfile(c->fd, doc_fd, &off, s->len - c->seg_done);
+        }
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        c->seg_done += (size_t)w;
+        *sent += w;
+    }
+}
+
+/* fanout_send_file:
+ *  drive every target from one epoll loop: at most o->max_parallel
+ *  nonblocking connections are open at any time and each streams the
+ *  document with sendfile at its own offset, so the total time tracks
+ *  the slowest printer rather than the sum of all of them.
+ */
+int fanout_send_file(struct fanout_target *t, int n, const char *filename,
+                     const struct fanout_opts *o) {
+    char *spooled;
+    int doc_fd = open_document(filename, &spooled);
+    if (doc_fd < 0) { perror(filename); return n; }
+
+    struct stat st;
+    fstat(doc_fd, &st);
+    size_t total = (size_t)st.st_size;
+
+    char head[4096];
+    ssize_t head_len = pread(doc_fd, head, sizeof(head), 0);
+    if (head_len < 0) head_len = 0;
+
+    struct raw_frame f;
+    raw_frame_build(&f, head, (size_t)head_len, o->copies, o->copy_mode);
+
+    struct segment segs[MAX_SEGS];
+    int nsegs = 0;
+    if (f.pjl_len) segs[nsegs++] = (struct segment){ f.pjl, 0, f.pjl_len };
+    if (f.split) segs[nsegs++] = (struct segment){ NULL, 0, f.split };
+    if (f.prolog_len) segs[nsegs++] = (struct segment){ f.prolog, 0, f.prolog_len };
+    segs[nsegs++] = (struct segment){ NULL, (off_t)f.split, total - f.split };
+    if (f.post_len) segs[nsegs++] = (struct segment){ f.post, 0, f.post_len };
+
+    /* resend mode sends the document once per copy, each on its own
+     * connection: a printer that ignores copy counts takes one job each */
+    int copies = f.resend ? o->copies : 1;
+    int max_par = o->max_parallel > 0 ? o->max_parallel : 8;
+
+    int ep = epoll_create1(0);
+    struct conn *conns = calloc(max_par, sizeof(*conns));
+    if (ep < 0 || !conns) {
+        perror("epoll");
+        if (ep >= 0) close(ep);
+        free(conns);
+        close(doc_fd);
+        return n;
+    }
+    for (int i = 0; i < max_par; i++) conns[i].fd = -1;
+
+    int next = 0, active = 0, finished = 0, failures = 0;
+    double t0 = net_now_ms();
+
+    while (finished < n) {
+        /* top up the window */
+        for (int i = 0; i < max_par && next < n; i++) {
+            if (conns[i].fd >= 0) continue;
+            struct fanout_target *tg = &t[next];
+            conns[i] = (struct conn){ .idx = next, .fd = -1, .started = net_now_ms() };
+            next++;
+            if (dial(ep, i, &conns[i], tg) < 0) {
+                fail(tg, "connect", errno);
+                printf("[%d/%d] %s:%d failed: %s\n", ++finished, n, tg->ip, tg->port, tg->error);
+                failures++;
+                continue;
+            }
+            active++;
+        }
+        if (active == 0) continue;
+
+        /* sleep until the nearest deadline */
+        double now = net_now_ms(), wait = 1000;
+        for (int i = 0; i < max_par; i++) {
+            if (conns[i].fd < 0) continue;
+            double dl = conns[i].connecting
+                ? conns[i].dialed + o->connect_timeout_ms
+                : conns[i].last_progress + o->idle_timeout_ms;
+            if (dl - now < wait) wait = dl - now;
+        }
+        if (wait < 0) wait = 0;
+
+        struct epoll_event evs[64];
+        int ne = epoll_wait(ep, evs, 64, (int)wait + 1);
+        if (ne < 0 && errno != EINTR) {
+            /* the loop can't go on: every target not yet done fails */
+            int err = errno;
+            perror("epoll_wait");
+            now = net_now_ms();
+            for (int i = 0; i < max_par; i++) {
+                struct conn *c = &conns[i];
+                if (c->fd < 0) continue;
+                struct fanout_target *tg = &t[c->idx];
+                fail(tg, c->connecting ? "connect" : "send", err);
+                tg->seconds = (now - c->started) / 1000.0;
+                printf("[%d/%d] %s:%d failed: %s\n", ++finished, n, tg->ip, tg->port, tg->error);
+                failures++;
+                close(c->fd);
+                c->fd = -1;
+                active--;
+            }
+            for (; next < n; next++) {
+                fail(&t[next], "connect", err);
+                printf("[%d/%d] %s:%d failed: %s\n", ++finished, n, t[next].ip, t[next].port,
+                       t[next].error);
+                failures++;
+            }
+            break;
+        }
+
+        for (int k = 0; k < ne; k++) {
+            int slot = (int)evs[k].data.u32;
+            struct conn *c = &conns[slot];
+            struct fanout_target *tg = &t[c->idx];
+            int done = 0;
+
+            if (c->connecting) {
+                int err = net_connect_result(c->fd);
+                if (err) {
+                    fail(tg, "connect", err);
+                    done = -1;
+                } else {
+                    c->connecting = 0;
+                    if (copies > 1) {
+                        printf("[%s:%d] connected, sending copy %d/%d\n", tg->ip, tg->port,
+                               c->copy + 1, copies);
+                    } else {
+                        printf("[%s:%d] connected, sending\n", tg->ip, tg->port);
+                    }
+                }
+            }
+            if (!done && !c->connecting) {
+                long long before = tg->sent;
+                done = pump(c, doc_fd, segs, nsegs, &tg->sent);
+                if (done < 0) fail(tg, "send", errno);
+                if (tg->sent != before) c->last_progress = net_now_ms();
+            }
+            if (done > 0 && ++c->copy < copies) {
+                /* next copy as a new job */
+                close(c->fd);
+                c->fd = -1;
+                if (dial(ep, slot, c, tg) == 0) continue;
+                fail(tg, "connect", errno);
+                done = -1;
+            }
+            if (done) {
+                tg->seconds = (net_now_ms() - c->started) / 1000.0;
+                if (done > 0) {
+                    printf("[%d/%d] %s:%d done, %lld bytes in %.2f s\n",
+                           finished + 1, n, tg->ip, tg->port, tg->sent, tg->seconds);
+                } else {
+                    printf("[%d/%d] %s:%d failed: %s\n",
+                           finished + 1, n, tg->ip, tg->port, tg->error);
+                    failures++;
+                }
+                if (c->fd >= 0) close(c->fd);
+                c->fd = -1;
+                active--;
+                finished++;
+            }
+        }
+
+        /* expire stalled connections */
+        now = net_now_ms();
+        for (int i = 0; i < max_par; i++) {
+            struct conn *c = &conns[i];
+            if (c->fd < 0) continue;
+            int expired = c->connecting
+                ? now - c->dialed >= o->connect_timeout_ms
+                : now - c->last_progress >= o->idle_timeout_ms;
+            if (!expired) continue;
+            struct fanout_target *tg = &t[c->idx];
+            fail(tg, c->connecting ? "connect" : "send", ETIMEDOUT);
+            tg->seconds = (now - c->started) / 1000.0;
+            printf("[%d/%d] %s:%d failed: %s\n", ++finished, n, tg->ip, tg->port, tg->error);
+            failures++;
+            close(c->fd);
+            c->fd = -1;
+            active--;
+        }
+    }
+
+    double secs = (net_now_ms() - t0) / 1000.0;
+    long long bytes = 0;
+    for (int i = 0; i < n; i++) bytes += t[i].sent;
+    printf("Sent to %d/%d printers, %lld bytes in %.2f s (%.2f MB/s aggregate)\n",
+           n - failures, n, bytes, secs, secs > 0 ? bytes / 1e6 / secs : 0.0);
+
+    free(conns);
+    close(ep);
+    close(doc_fd);
+    if (spooled) { unlink(spooled); free(spooled); }
+    return failures;
+}
@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include "imgps.h"
+#include "pixel.h"
+#include "raster.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IMGPS_OUT_BYTES 65536
+#define IMGPS_MARGIN 18         /* points around the image */
+#define IMGPS_MAX_DIM 65535
+#define JPEG_SEGMENT_MAX 65536  /* length field is 16 bits */
+
+/* ---- output: plain text and ASCII85 ---- */
+
+struct out {
+    int fd;
+    int err;                    /* write failed (errno value) */
+    size_t len;
+    char buf[IMGPS_OUT_BYTES];
+    uint32_t tuple;             /* ASCII85 state */
+    int count, col;
+};
+
+static void flush_out(struct out *o) {
+    size_t off = 0;
+    while (!o->err && off < o->len) {
+        ssize_t w = write(o->fd, o->buf + off, o->len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) o->err = w < 0 ? errno : EIO;
+        else off += w;
+    }
+    o->len = 0;
+}
+
+static void emit(struct out *o, const char *fmt, ...) {
+    if (o->len > sizeof(o->buf) - 4096) flush_out(o);
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, sizeof(o->buf) - o->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) o->len += (size_t)n < sizeof(o->buf) - o->len ? (size_t)n : 0;
+}
+
+static void a85_char(struct out *o, char c) {
+    if (o->len > sizeof(o->buf) - 4) flush_out(o);
+    /* a line starting with % could be taken for a DSC comment */
+    if (o->col == 0 && c == '%') o->buf[o->len++] = ' ';
+    o->buf[o->len++] = c;
+    if (++o->col == 76) {
+        o->buf[o->len++] = '\n';
+        o->col = 0;
+    }
+}
+
+static void a85_tuple(struct out *o, int bytes) {
+    if (bytes == 4 && o->tuple == 0) {
+        a85_char(o, 'z');
+        return;
+    }
+    char d[5];
+    uint32_t v = o->tuple;
+    for (int i = 4; i >= 0; i--) {
+        d[i] = (char)('!' + v % 85);
+        v /= 85;
+    }
+    for (int i = 0; i <= bytes; i++) a85_char(o, d[i]);
+}
+
+static void a85_write(struct out *o, const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        o->tuple |= (uint32_t)p[i] << (24 - 8 * o->count);
+        if (++o->count == 4) {
+            a85_tuple(o, 4);
+            o->tuple = 0;
+            o->count = 0;
+        }
+    }
+}
+
+static void a85_end(struct out *o) {
+    if (o->count) a85_tuple(o, o->count);
+    o->tuple = 0;
+    o->count = 0;
+    if (o->len > sizeof(o->buf) - 4) flush_out(o);
+    memcpy(o->buf + o->len, "~>\n", 3);
+    o->len += 3;
+    o->col = 0;
+}
+
+/* ---- probing ---- */
+
+static unsigned be16(const unsigned char *p) { return (unsigned)p[0] << 8 | p[1]; }
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int read_at(int fd, void *buf, size_t n, off_t off) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = pread(fd, (char *)buf + got, n - got, off + got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        got += r;
+    }
+    return 0;
+}
+
+/* the orientation tag of IFD0 in an Exif APP1 body */
+static int exif_orientation(const unsigned char *p, size_t n) {
+    if (n < 14 || memcmp(p, "Exif\0\0", 6) != 0) return 1;
+    p += 6;
+    n -= 6;
+    int le = p[0] == 'I';
+    if (!(le && p[1] == 'I') && !(p[0] == 'M' && p[1] == 'M')) return 1;
+#define U16(q) (le ? (unsigned)(q)[0] | (unsigned)(q)[1] << 8 : be16(q))
+#define U32(q) (le ? (uint32_t)U16(q) | (uint32_t)U16((q) + 2) << 16 : be32(q))
+    uint32_t ifd = U32(p + 4);
+    /* the offset comes from the file: compare without wrapping */
+    if (ifd > n || n - ifd < 2) return 1;
+    unsigned count = U16(p + ifd);
+    for (unsigned i = 0; i < count && (size_t)ifd + 2 + 12 * ((size_t)i + 1) <= n; i++) {
+        const unsigned char *e = p + ifd + 2 + 12 * i;
+        if (U16(e) == 0x0112) {
+            unsigned v = U16(e + 8);
+            return v >= 1 && v <= 8 ? (int)v : 1;
+        }
+    }
+#undef U32
+#undef U16
+    return 1;
+}
+
+/* walk the markers up to the frame header; seg takes APP1/APP14 bodies */
+static int scan_jpeg(int fd, struct imgps_info *in, unsigned char *seg) {
+    unsigned char m[4];
+    off_t pos = 2;
+    in->format = IMGPS_JPEG;
+    for (;;) {
+        if (read_at(fd, m, 2, pos) != 0 || m[0] != 0xff) return IMGPS_UNSUPPORTED;
+        if (m[1] == 0xff) {         /* fill byte */
+            pos++;
+            continue;
+        }
+        if (m[1] == 0xd8 || (m[1] >= 0xd0 && m[1] <= 0xd7) || m[1] == 0x01) {
+            pos += 2;               /* no length */
+            continue;
+        }
+        if (read_at(fd, m + 2, 2, pos + 2) != 0) return IMGPS_UNSUPPORTED;
+        unsigned len = be16(m + 2);
+        if (len < 2) return IMGPS_UNSUPPORTED;
+        unsigned code = m[1];
+
+        if (code == 0xc0 || code == 0xc1 || code == 0xc2) {
+            /* baseline, extended or progressive Huffman: what DCTDecode takes */
+            unsigned char sof[6];
+            if (len < 8 || read_at(fd, sof, 6, pos + 4) != 0) return IMGPS_UNSUPPORTED;
+            in->bpc = sof[0];
+            in->height = (int)be16(sof + 1);
+            in->width = (int)be16(sof + 3);
+            in->comps = sof[5];
+            if (in->bpc != 8 || in->height == 0 || in->width == 0) return IMGPS_UNSUPPORTED;
+            return in->comps == 1 || in->comps == 3 || in->comps == 4 ? 0 : IMGPS_UNSUPPORTED;
+        }
+        /* the other SOFn (lossless, hierarchical, arithmetic) or no frame
+         * at all; DHT (c4), JPG (c8) and DAC (cc) are tables, skipped below */
+        if ((code >= 0xc3 && code <= 0xcf && code != 0xc4 && code != 0xc8 && code != 0xcc) ||
+            code == 0xda || code == 0xd9) {
+            return IMGPS_UNSUPPORTED;
+        }
+        if (code == 0xe1 || code == 0xee) {
+            size_t n = len - 2;
+            if (read_at(fd, seg, n, pos + 4) != 0) return IMGPS_UNSUPPORTED;
+            if (code == 0xe1 && in->orientation == 1) in->orientation = exif_orientation(seg, n);
+            if (code == 0xee && n >= 5 && memcmp(seg, "Adobe", 5) == 0) in->adobe = 1;
+        }
+        pos += 2 + len;
+    }
+}
+
+static int probe_jpeg(int fd, struct imgps_info *in) {
+    /* a segment can be 64K: too much for a conversion thread's stack */
+    unsigned char *seg = malloc(JPEG_SEGMENT_MAX);
+    if (!seg) return IMGPS_UNSUPPORTED;
+    int rc = scan_jpeg(fd, in, seg);
+    free(seg);
+    return rc;
+}
+
+static int probe_png(int fd, struct imgps_info *in) {
+    unsigned char h[8 + 25];
+    if (read_at(fd, h, sizeof(h), 0) != 0 || memcmp(h + 12, "IHDR", 4) != 0) {
+        return IMGPS_UNSUPPORTED;
+    }
+    in->format = IMGPS_PNG;
+    in->width = (int)be32(h + 16);
+    in->height = (int)be32(h + 20);
+    in->bpc = h[24];
+    int ctype = h[25], interlace = h[28];
+    if (in->width <= 0 || in->height <= 0 || interlace != 0) return IMGPS_UNSUPPORTED;
+    switch (ctype) {
+    case 0:                 /* gray */
+    case 3:                 /* palette */
+        if (in->bpc != 1 && in->bpc != 2 && in->bpc != 4 && in->bpc != 8) return IMGPS_UNSUPPORTED;
+        in->comps = 1;
+        break;
+    case 2:                 /* RGB */
+        if (in->bpc != 8) return IMGPS_UNSUPPORTED;
+        in->comps = 3;
+        break;
+    default:                /* alpha would need compositing */
+        return IMGPS_UNSUPPORTED;
+    }
+
+    /* PLTE, if any, comes before the image data */
+    off_t pos = 8;
+    for (;;) {
+        unsigned char c[8];
+        if (read_at(fd, c, 8, pos) != 0) return IMGPS_UNSUPPORTED;
+        uint32_t len = be32(c);
+        if (memcmp(c + 4, "IDAT", 4) == 0) {
+            in->data = pos;
+            break;
+        }
+        if (memcmp(c + 4, "IEND", 4) == 0) return IMGPS_UNSUPPORTED;
+        if (memcmp(c + 4, "PLTE", 4) == 0 && len % 3 == 0 && len <= sizeof(in->palette)) {
+            if (read_at(fd, in->palette, len, pos + 8) != 0) return IMGPS_UNSUPPORTED;
+            in->palette_n = (int)(len / 3);
+        }
+        pos += 12 + (off_t)len;
+    }
+    return ctype == 3 && !in->palette_n ? IMGPS_UNSUPPORTED : 0;
+}
+
+/* the next header field of a PNM file, skipping # comments */
+static int pnm_field(const char *buf, size_t n, size_t *i) {
+    for (;;) {
+        while (*i < n && (buf[*i] == ' ' || buf[*i] == '\t' || buf[*i] == '\n' || buf[*i] == '\r')) {
+            (*i)++;
+        }
+        if (*i < n && buf[*i] == '#') {
+            while (*i < n && buf[*i] != '\n') (*i)++;
+            continue;
+        }
+        break;
+    }
+    long v = 0;
+    size_t start = *i;
+    while (*i < n && buf[*i] >= '0' && buf[*i] <= '9' && v <= IMGPS_MAX_DIM) v = v * 10 + (buf[(*i)++] - '0');
+    return *i > start && *i < n && v <= IMGPS_MAX_DIM ? (int)v : -1;
+}
+
+static int probe_pnm(int fd, struct imgps_info *in) {
+    char buf[1024];
+    ssize_t n = pread(fd, buf, sizeof(buf), 0);
+    if (n < 3) return IMGPS_UNSUPPORTED;
+    in->format = IMGPS_PNM;
+    size_t i = 2;
+    in->width = pnm_field(buf, n, &i);
+    in->height = pnm_field(buf, n, &i);
+    in->maxval = buf[1] == '4' ? 1 : pnm_field(buf, n, &i);
+    if (in->width <= 0 || in->height <= 0 || in->maxval <= 0 || in->maxval > 255) {
+        return IMGPS_UNSUPPORTED;
+    }
+    in->comps = buf[1] == '6' ? 3 : 1;
+    in->bpc = buf[1] == '4' ? 1 : 8;
+    in->data = (off_t)i + 1;        /* one whitespace byte ends the header */
+    return 0;
+}
+
+int imgps_probe(int fd, struct imgps_info *info) {
+    unsigned char m[8];
+    memset(info, 0, sizeof(*info));
+    info->orientation = 1;
+    if (read_at(fd, m, sizeof(m), 0) != 0) return IMGPS_UNSUPPORTED;
+
+    if (m[0] == 0xff && m[1] == 0xd8 && m[2] == 0xff) return probe_jpeg(fd, info);
+    if (memcmp(m, "\x89PNG\r\n\x1a\n", 8) == 0) return probe_png(fd, info);
+    if (m[0] == 'P' && (m[1] == '4' || m[1] == '5' || m[1] == '6')) return probe_pnm(fd, info);
+    return IMGPS_UNSUPPORTED;
+}
+
+int imgps_supported(const char *path) {
+    struct imgps_info info;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    int ok = imgps_probe(fd, &info) == 0;
+    close(fd);
+    return ok;
+}
+
+/* ---- document ---- */
+
+/* EXIF orientation as a map of the unit square (stored image, y up) onto
+ * the upright one */
+static const int orient_matrix[9][6] = {
+    { 1, 0, 0, 1, 0, 0 },
+    { 1, 0, 0, 1, 0, 0 },       /* 1: as stored */
+    { -1, 0, 0, 1, 1, 0 },      /* 2: mirrored */
+    { -1, 0, 0, -1, 1, 1 },     /* 3: upside down */
+    { 1, 0, 0, -1, 0, 1 },      /* 4: flipped */
+    { 0, -1, -1, 0, 1, 1 },     /* 5: transposed */
+    { 0, -1, 1, 0, 0, 1 },      /* 6: turned 90 ccw */
+    { 0, 1, 1, 0, 0, 0 },       /* 7: transversed */
+    { 0, 1, -1, 0, 1, 0 },      /* 8: turned 90 cw */
+};
+
+/* gray without decoding: the samples become tints of colorants no device
+ * has, so the interpreter renders them through the DeviceGray fallback */
+static const char gray_rgb_space[] =
+    "[/DeviceN [/lprunR /lprunG /lprunB] /DeviceGray\n"
+    " { 0.11 mul exch 0.59 mul add exch 0.3 mul add }] setcolorspace\n";
+static const char gray_cmyk_space[] =
+    "[/DeviceN [/lprunC /lprunM /lprunY /lprunK] /DeviceGray\n"
+    " { 4 1 roll 0.11 mul exch 0.59 mul add exch 0.3 mul add add\n"
+    "   dup 1 gt { pop 1 } if 1 exch sub }] setcolorspace\n";
+
+/* page placement, color space and the image dictionary up to its data */
+static void write_header(struct out *o, const struct imgps_info *in, int gray) {
+    double pw, ph;
+    default_paper_size(&pw, &ph);
+    double bw = pw - 2 * IMGPS_MARGIN, bh = ph - 2 * IMGPS_MARGIN;
+
+    /* upright size, then the bigger of the two ways onto the page */
+    int swap = in->orientation >= 5;
+    double w = swap ? in->height : in->width;
+    double h = swap ? in->width : in->height;
+    double s = bw / w < bh / h ? bw / w : bh / h;
+    double sr = bw / h < bh / w ? bw / h : bh / w;
+    int rotate = sr > s * 1.01;
+    if (rotate) s = sr;
+    double dw = w * s, dh = h * s;
+    double pw_used = rotate ? dh : dw, ph_used = rotate ? dw : dh;
+    double x = (pw - pw_used) / 2, y = (ph - ph_used) / 2;
+
+    int level3 = in->format == IMGPS_PNG || (gray && in->comps > 1 && in->format != IMGPS_PNM);
+    emit(o, "%%!PS-Adobe-3.0\n%%%%Creator: lprun\n");
+    emit(o, "%%%%BoundingBox: %d %d %d %d\n", (int)x, (int)y,
+         (int)(x + pw_used + 0.999), (int)(y + ph_used + 0.999));
+    emit(o, "%%%%LanguageLevel: %d\n%%%%Pages: 1\n%%%%EndComments\n", level3 ? 3 : 2);
+    emit(o, "%%%%Page: 1 1\nsave\n");
+    if (rotate) emit(o, "%.3f %.3f translate 90 rotate\n", x + pw_used, y);
+    else emit(o, "%.3f %.3f translate\n", x, y);
+    const int *m = orient_matrix[in->orientation];
+    emit(o, "%.3f %.3f scale [%d %d %d %d %d %d] concat\n", dw, dh,
+         m[0], m[1], m[2], m[3], m[4], m[5]);
+
+    /* color space and Decode */
+    char decode[64] = "";
+    int comps = in->comps;
+    if (in->format == IMGPS_PNM && gray) comps = 1;      /* converted while encoding */
+    if (in->palette_n) {
+        emit(o, "[/Indexed /Device%s %d <", gray ? "Gray" : "RGB", in->palette_n - 1);
+        for (int i = 0; i < in->palette_n; i++) {
+            const unsigned char *c = in->palette + 3 * i;
+            if (gray) emit(o, "%02x", (77 * c[0] + 151 * c[1] + 28 * c[2]) >> 8);
+            else emit(o, "%02x%02x%02x", c[0], c[1], c[2]);
+            if (i % 16 == 15) emit(o, "\n");
+        }
+        emit(o, ">] setcolorspace\n");
+        snprintf(decode, sizeof(decode), "0 %d", (1 << in->bpc) - 1);
+    } else if (comps == 1) {
+        emit(o, "/DeviceGray setcolorspace\n");
+        if (in->format == IMGPS_PNM && in->bpc == 1) snprintf(decode, sizeof(decode), "1 0");
+        else if (in->maxval && in->maxval != 255) snprintf(decode, sizeof(decode), "0 %.4f", 255.0 / in->maxval);
+        else snprintf(decode, sizeof(decode), "0 1");
+    } else if (comps == 3) {
+        if (gray) emit(o, "%s", gray_rgb_space);
+        else emit(o, "/DeviceRGB setcolorspace\n");
+        double d = in->maxval && in->maxval != 255 ? 255.0 / in->maxval : 1;
+        snprintf(decode, sizeof(decode), "0 %g 0 %g 0 %g", d, d, d);
+    } else {
+        if (gray) emit(o, "%s", gray_cmyk_space);
+        else emit(o, "/DeviceCMYK setcolorspace\n");
+        snprintf(decode, sizeof(decode), in->adobe ? "1 0 1 0 1 0 1 0" : "0 1 0 1 0 1 0 1");
+    }
+
+    /* the data follows exec; flushfile eats whatever the decoder leaves
+     * before ~> so none of it is read as PostScript */
+    emit(o, "/lprun_src currentfile /ASCII85Decode filter def\n");
+    emit(o, "{ << /ImageType 1 /Width %d /Height %d /BitsPerComponent %d\n"
+            "     /Decode [%s] /ImageMatrix [%d 0 0 %d 0 %d]\n     /DataSource lprun_src ",
+         in->width, in->height, in->bpc, decode, in->width, -in->height, in->height);
+    if (in->format == IMGPS_JPEG) {
+        emit(o, "/DCTDecode filter");
+    } else if (in->format == IMGPS_PNG) {
+        emit(o, "<< /Predictor 15 /Colors %d /BitsPerComponent %d /Columns %d >> /FlateDecode filter",
+             in->comps, in->bpc, in->width);
+    } else {
+        emit(o, "/RunLengthDecode filter");
+    }
+    emit(o, " >> image\n  lprun_src flushfile } exec\n");
+}
+
+static void write_trailer(struct out *o) {
+    emit(o, "restore showpage\n%%%%Trailer\n%%%%EOF\n");
+}
+
+static int cancelled(const atomic_int *cancel) {
+    return cancel && atomic_load(cancel);
+}
+
+/* bytes [off, off + len) of in_fd through ASCII85 */
+static int copy_range(struct out *o, int fd, off_t off, off_t len, unsigned char *buf,
+                      const atomic_int *cancel) {
+    while (len != 0 && !o->err) {
+        if (cancelled(cancel)) return -1;
+        size_t want = len < 0 || len > IMGPS_OUT_BYTES ? IMGPS_OUT_BYTES : (size_t)len;
+        ssize_t n = pread(fd, buf, want, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) return len < 0 ? 0 : -1;    /* truncated */
+        a85_write(o, buf, n);
+        off += n;
+        if (len > 0) len -= n;
+    }
+    return o->err ? -1 : 0;
+}
+
+/* the zlib stream is the IDAT chunks' contents, in order */
+static int copy_idat(struct out *o, int fd, off_t pos, unsigned char *buf,
+                     const atomic_int *cancel) {
+    for (;;) {
+        unsigned char c[8];
+        if (read_at(fd, c, 8, pos) != 0) return -1;
+        uint32_t len = be32(c);
+        if (memcmp(c + 4, "IEND", 4) == 0) return 0;
+        if (memcmp(c + 4, "IDAT", 4) == 0 && copy_range(o, fd, pos + 8, len, buf, cancel) != 0) {
+            return -1;
+        }
+        pos += 12 + (off_t)len;
+    }
+}
+
+/* PNM samples, row by row, optionally to gray, then RunLength */
+static int copy_pnm(struct out *o, int fd, const struct imgps_info *in, int gray,
+                    unsigned char *buf, const atomic_int *cancel) {
+    size_t row = in->bpc == 1 ? (size_t)(in->width + 7) / 8 : (size_t)in->width * in->comps;
+    unsigned char *rle = malloc(row + row / 128 + 2);
+    unsigned char *line = malloc(row);
+    off_t pos = in->data;
+    int rc = rle && line ? 0 : -1;
+
+    for (int y = 0; y < in->height && rc == 0; y++) {
+        if (cancelled(cancel) || read_at(fd, line, row, pos) != 0) {
+            rc = -1;
+            break;
+        }
+        pos += row;
+        size_t n = row;
+        if (gray && in->comps == 3) {
+            pix_rgb_to_gray(line, line, in->width);     /* in place: the output trails */
+            n = in->width;
+        }
+        a85_write(o, rle, raster_packbits(line, n, rle));
+        if (o->err) rc = -1;
+    }
+    if (rc == 0) {
+        buf[0] = 128;           /* EOD */
+        a85_write(o, buf, 1);
+    }
+    free(rle);
+    free(line);
+    return rc;
+}
+
+/* imgps_convert_fd:
+ *  probe, then header, the image data through ASCII85 and the trailer.
+ *  Constant memory: the data is read and written in 64K pieces.
+ */
+int imgps_convert_fd(int in_fd, int out_fd, int color_mode, const atomic_int *cancel) {
+    struct imgps_info in;
+    if (imgps_probe(in_fd, &in) != 0) return IMGPS_UNSUPPORTED;
+
+    struct out *o = calloc(1, sizeof(*o));
+    unsigned char *buf = malloc(IMGPS_OUT_BYTES);
+    int rc = -1;
+    if (o && buf) {
+        int gray = color_mode == 2;
+        o->fd = out_fd;
+        write_header(o, &in, gray);
+        if (in.format == IMGPS_JPEG) rc = copy_range(o, in_fd, 0, -1, buf, cancel);
+        else if (in.format == IMGPS_PNG) rc = copy_idat(o, in_fd, in.data, buf, cancel);
+        else rc = copy_pnm(o, in_fd, &in, gray, buf, cancel);
+        if (rc == 0) {
+            a85_end(o);
+            write_trailer(o);
+        }
+        flush_out(o);
+        if (o->err) rc = -1;
+    }
+    free(buf);
+    free(o);
+    return rc;
+}
@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include "lprun.h"
+#include "batch.h"
+#include "disc.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static const char *const state_names[] = {
+    "queued", "converting", "ready", "sending", "done", "failed"
+};
+
+struct lprun_dest;
+
+struct lprun_job {
+    lprun_ctx *ctx;
+    int id;
+    int refs;                       /* the context's, plus the caller's */
+    enum lprun_state state;
+    struct batch_job j;
+    struct prep_job prep;
+    struct lprun_dest *dest;
+    lprun_done_cb cb;
+    void *user;
+    int in_done;                    /* on the ctx's done list */
+    struct lprun_job *next_conv;    /* conversion FIFO */
+    struct lprun_job *next_send;    /* this printer's FIFO */
+    struct lprun_job *next_done;
+};
+
+/* one printer: its jobs go out in submission order from a thread that
+ * lives as long as the context, keeping its CUPS connection warm */
+struct lprun_dest {
+    lprun_ctx *ctx;
+    char printer[256];
+    char ip[64];
+    int port;
+    lprun_job *head, *tail;
+    int in_flight;                  /* converting or converted, not yet sent */
+    pthread_t tid;
+    struct lprun_dest *next;
+};
+
+struct lprun_ctx {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int next_id;
+    lprun_job *conv_head, *conv_tail;
+    lprun_job *done_head, *done_tail;
+    struct lprun_dest *dests;
+    int active;                     /* submitted, not yet done or failed */
+    long long submitted, done, failed;
+    int stopping;
+
+    char printer[256], ip[64];      /* o.printer / o.ip point here */
+    struct batch_opts o;
+    struct disc_printer def;        /* resolved default printer */
+    int have_def;
+
+    pthread_t *workers;
+    int nworkers;
+    int efd;                        /* eventfd counting done-list entries */
+};
+
+/* ---- workers ---- */
+
+static void *convert_worker(void *arg) {
+    lprun_ctx *c = arg;
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        if (!c->conv_head && c->stopping) break;
+        /* the first job whose printer has room; a printer with a full
+         * queue doesn't hold up the others, and each printer's jobs are
+         * still taken in the order they were submitted */
+        lprun_job *job = c->conv_head, *prev = NULL;
+        while (job && job->dest->in_flight >= BATCH_QUEUE_DEPTH) {
+            prev = job;
+            job = job->next_conv;
+        }
+        if (!job) {
+            pthread_cond_wait(&c->cond, &c->lock);
+            continue;
+        }
+        if (prev) prev->next_conv = job->next_conv;
+        else c->conv_head = job->next_conv;
+        if (c->conv_tail == job) c->conv_tail = prev;
+        job->dest->in_flight++;
+        job->state = LPRUN_CONVERTING;
+        pthread_mutex_unlock(&c->lock);
+
+        batch_convert_job(&job->j, &job->prep, &c->o);
+
+        pthread_mutex_lock(&c->lock);
+        job->state = LPRUN_READY;
+        pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/* drop one reference; called with the lock held */
+static void job_unref(lprun_job *job) {
+    if (--job->refs == 0) free(job);
+}
+
+static void finish_job(lprun_ctx *c, struct lprun_dest *d, lprun_job *job) {
+    pthread_mutex_lock(&c->lock);
+    struct batch_job *j = &job->j;
+    job->state = j->status == 0 ? LPRUN_DONE : LPRUN_FAILED;
+    d->head = job->next_send;
+    if (!d->head) d->tail = NULL;
+    d->in_flight--;
+    if (j->status == 0) {
+        c->done++;
+    } else {
+        c->failed++;
+        /* a discovered printer that fails is looked up again next time */
+        if (c->have_def && strcmp(c->def.is_cups ? j->printer : j->ip, c->def.name) == 0) {
+            c->have_def = 0;
+        }
+    }
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    if (job->cb) job->cb(job, job->user);
+
+    pthread_mutex_lock(&c->lock);
+    if (!job->cb && job->refs > 1) {
+        /* someone still holds it: hand it out through lprun_next_done */
+        if (c->done_tail) c->done_tail->next_done = job;
+        else c->done_head = job;
+        c->done_tail = job;
+        job->in_done = 1;
+        uint64_t one = 1;
+        if (write(c->efd, &one, sizeof(one)) < 0) { /* counter cannot overflow */ }
+    }
+    c->active--;
+    job_unref(job);
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void *sender_thread(void *arg) {
+    struct lprun_dest *d = arg;
+    lprun_ctx *c = d->ctx;
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        lprun_job *job = d->head;
+        if (!job && c->stopping) break;
+        if (!job || job->state != LPRUN_READY) {
+            pthread_cond_wait(&c->cond, &c->lock);
+            continue;
+        }
+        job->state = LPRUN_SENDING;
+        pthread_mutex_unlock(&c->lock);
+
+        batch_send_job(&job->j, &job->prep, &c->o);
+        finish_job(c, d, job);
+
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/* find or start the queue for j's printer; called with the lock held */
+static struct lprun_dest *dest_for(lprun_ctx *c, const struct batch_job *j) {
+    for (struct lprun_dest *d = c->dests; d; d = d->next) {
+        if (strcmp(d->printer, j->printer) == 0 && strcmp(d->ip, j->ip) == 0 &&
+            (j->printer[0] || d->port == j->port)) {
+            return d;
+        }
+    }
+
+    struct lprun_dest *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->ctx = c;
+    snprintf(d->printer, sizeof(d->printer), "%s", j->printer);
+    snprintf(d->ip, sizeof(d->ip), "%s", j->ip);
+    d->port = j->port;
+
+    if (pthread_create(&d->tid, NULL, sender_thread, d) != 0) {
+        free(d);
+        return NULL;
+    }
+    d->next = c->dests;
+    c->dests = d;
+    return d;
+}
+
+/* ---- context ---- */
+
+/* lprun_ctx_new:
+ *  copy the options and start the converter pool; sender threads are
+ *  started per printer as jobs for it arrive.
+ */
+lprun_ctx *lprun_ctx_new(const struct lprun_ctx_opts *o) {
+    struct lprun_ctx_opts defaults = { 0 };
+    if (!o) o = &defaults;
+
+    lprun_ctx *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+    if (c->efd < 0) {
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    if (o->printer) {
+        snprintf(c->printer, sizeof(c->printer), "%s", o->printer);
+        c->o.printer = c->printer;
+    } else if (o->ip) {
+        snprintf(c->ip, sizeof(c->ip), "%s", o->ip);
+        c->o.ip = c->ip;
+    }
+    c->o.port = o->port > 0 ? o->port : 9100;
+    c->o.use_cache = !o->no_cache;
+    c->o.copy_mode = (enum raw_copy_mode)o->copy_mode;
+
+    int n = o->workers > 0 ? o->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    c->workers = calloc(n, sizeof(*c->workers));
+    for (int w = 0; c->workers && w < n; w++) {
+        if (pthread_create(&c->workers[c->nworkers], NULL, convert_worker, c) == 0) c->nworkers++;
+    }
+    c->o.workers = c->nworkers;
+    if (!c->nworkers) {
+        lprun_ctx_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void lprun_ctx_free(lprun_ctx *c) {
+    if (!c) return;
+
+    pthread_mutex_lock(&c->lock);
+    while (c->active > 0) pthread_cond_wait(&c->cond, &c->lock);
+    c->stopping = 1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    for (int w = 0; w < c->nworkers; w++) pthread_join(c->workers[w], NULL);
+    while (c->dests) {
+        struct lprun_dest *d = c->dests;
+        c->dests = d->next;
+        pthread_join(d->tid, NULL);
+        free(d);
+    }
+    free(c->workers);
+    close(c->efd);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/* the default printer for jobs that name none: from the options, or
+ * discovered once and remembered until it fails */
+static int resolve_default(lprun_ctx *c, struct disc_printer *p) {
+    pthread_mutex_lock(&c->lock);
+    int have = c->have_def;
+    *p = c->def;
+    pthread_mutex_unlock(&c->lock);
+
+    if (have) return 0;
+    if (discover_printer(p, NULL) != 0) return -1;
+    pthread_mutex_lock(&c->lock);
+    c->def = *p;
+    c->have_def = 1;
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+int lprun_default_printer(lprun_ctx *c, char *buf, int len) {
+    if (c->o.printer || c->o.ip) {
+        snprintf(buf, len, "%s", c->o.printer ? c->o.printer : c->o.ip);
+        return 0;
+    }
+    struct disc_printer p;
+    if (resolve_default(c, &p) != 0) return -1;
+    snprintf(buf, len, "%s", p.name);
+    return 0;
+}
+
+/* lprun_submit:
+ *  fill in the defaults, then put the job on the conversion FIFO and on
+ *  its printer's send FIFO. Only a job without any printer may block, to
+ *  discover the default printer the first time.
+ */
+int lprun_submit(lprun_ctx *c, const struct lprun_job_spec *spec,
+                 lprun_done_cb cb, void *user, lprun_job **out) {
+    if (out) *out = NULL;
+    if (!spec || !spec->file || !spec->file[0] || spec->copies < 0 ||
+        spec->port < 0 || spec->port > 65535 || spec->color_mode < 0 || spec->color_mode > 2) {
+        return LPRUN_EINVAL;
+    }
+
+    lprun_job *job = calloc(1, sizeof(*job));
+    if (!job) return LPRUN_ENOMEM;
+    struct batch_job *j = &job->j;
+    snprintf(j->file, sizeof(j->file), "%s", spec->file);
+    j->copies = spec->copies ? spec->copies : 1;
+    j->color_mode = spec->color_mode;
+    j->port = spec->port ? spec->port : c->o.port;
+    if (spec->printer) snprintf(j->printer, sizeof(j->printer), "%s", spec->printer);
+    else if (spec->ip) snprintf(j->ip, sizeof(j->ip), "%s", spec->ip);
+    else if (c->o.printer) snprintf(j->printer, sizeof(j->printer), "%s", c->o.printer);
+    else if (c->o.ip) snprintf(j->ip, sizeof(j->ip), "%s", c->o.ip);
+    else {
+        struct disc_printer p;
+        if (resolve_default(c, &p) != 0) {
+            free(job);
+            return LPRUN_ENOPRINTER;
+        }
+        if (p.is_cups) {
+            snprintf(j->printer, sizeof(j->printer), "%s", p.name);
+        } else {
+            snprintf(j->ip, sizeof(j->ip), "%.63s", p.name);
+            if (p.port && !spec->port) j->port = p.port;
+        }
+    }
+    job->ctx = c;
+    job->cb = cb;
+    job->user = user;
+    job->refs = out ? 2 : 1;
+
+    pthread_mutex_lock(&c->lock);
+    job->dest = c->stopping ? NULL : dest_for(c, j);
+    if (!job->dest) {
+        pthread_mutex_unlock(&c->lock);
+        free(job);
+        return LPRUN_EAGAIN;
+    }
+    job->id = ++c->next_id;
+    j->line = job->id;
+    job->state = LPRUN_QUEUED;
+
+    if (c->conv_tail) c->conv_tail->next_conv = job;
+    else c->conv_head = job;
+    c->conv_tail = job;
+    if (job->dest->tail) job->dest->tail->next_send = job;
+    else job->dest->head = job;
+    job->dest->tail = job;
+
+    c->active++;
+    c->submitted++;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    if (out) *out = job;
+    return job->id;
+}
+
+int lprun_ctx_fd(lprun_ctx *c) {
+    return c->efd;
+}
+
+/* take job off the done list and its count off the eventfd; lock held */
+static void done_unlink(lprun_ctx *c, lprun_job *job) {
+    lprun_job **pp = &c->done_head, *prev = NULL;
+    while (*pp && *pp != job) {
+        prev = *pp;
+        pp = &(*pp)->next_done;
+    }
+    if (!*pp) return;
+    *pp = job->next_done;
+    if (c->done_tail == job) c->done_tail = prev;
+    job->next_done = NULL;
+    job->in_done = 0;
+    uint64_t one;
+    if (read(c->efd, &one, sizeof(one)) < 0) { /* already drained */ }
+}
+
+lprun_job *lprun_next_done(lprun_ctx *c) {
+    pthread_mutex_lock(&c->lock);
+    lprun_job *job = c->done_head;
+    if (job) done_unlink(c, job);
+    pthread_mutex_unlock(&c->lock);
+    return job;
+}
+
+int lprun_job_wait(lprun_job *job) {
+    lprun_ctx *c = job->ctx;
+    pthread_mutex_lock(&c->lock);
+    while (job->state != LPRUN_DONE && job->state != LPRUN_FAILED) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    int status = job->j.status;
+    pthread_mutex_unlock(&c->lock);
+    return status;
+}
+
+void lprun_job_info(lprun_job *job, struct lprun_job_info *info) {
+    lprun_ctx *c = job->ctx;
+    pthread_mutex_lock(&c->lock);
+    const struct batch_job *j = &job->j;
+    info->id = job->id;
+    info->state = job->state;
+    info->status = j->status;
+    snprintf(info->error, sizeof(info->error), "%s", j->error);
+    snprintf(info->file, sizeof(info->file), "%s", j->file);
+    snprintf(info->printer, sizeof(info->printer), "%s", j->printer[0] ? j->printer : j->ip);
+    info->bytes = j->bytes;
+    info->conv_ms = j->conv_ms;
+    info->send_ms = j->send_ms;
+    pthread_mutex_unlock(&c->lock);
+}
+
+void lprun_job_release(lprun_job *job) {
+    if (!job) return;
+    lprun_ctx *c = job->ctx;
+    pthread_mutex_lock(&c->lock);
+    if (job->in_done) done_unlink(c, job);
+    job_unref(job);
+    pthread_mutex_unlock(&c->lock);
+}
+
+void lprun_ctx_stats(lprun_ctx *c, struct lprun_stats *s) {
+    pthread_mutex_lock(&c->lock);
+    s->submitted = c->submitted;
+    s->done = c->done;
+    s->failed = c->failed;
+    s->active = c->active;
+    pthread_mutex_unlock(&c->lock);
+}
+
+const char *lprun_state_name(enum lprun_state s) {
+    return (unsigned)s < sizeof(state_names) / sizeof(state_names[0]) ? state_names[s] : "unknown";
+}
+
+const char *lprun_strerror(int err) {
+    switch (err) {
+    case LPRUN_EINVAL:     return "bad job";
+    case LPRUN_ENOPRINTER: return "no printer given and none discovered";
+    case LPRUN_EAGAIN:     return "cannot start printer queue";
+    case LPRUN_ENOMEM:     return "out of memory";
+    default:               return err >= 0 ? "ok" : "unknown error";
+    }
+}
@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 #include <sys/types.h>
 #include <time.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdatomic.h>
 
 #include "disc.h"
@@ -18,6 +20,18 @@
 #include "printer_list.h"
 #include "history.h"
 #include "scanner.h"
+#include "fanout.h"
+#include "portscan.h"
+#include "printer_cache.h"
+#include "prepare.h"
+#include "conv_cache.h"
+#include "batch.h"
+#include "caps.h"
+#include "spool.h"
+#include "net.h"
+#include "raster.h"
+#include "sniff.h"
+#include "pages.h"
 
 /* Global variables for progress indicators */
 static atomic_bool printing_stop = false;
@@ -85,6 +99,7 @@ void print_usage(void) {
 
     printf("USAGE:\n");
     printf("  lprun --list\n");
+    printf("  lprun --discover [subnet] [--scan-timeout MS] [--scan-window N]\n");
     printf("  lprun --printer <name> [OPTIONS]\n");
     printf("  lprun --ip <address> [--port <port>] [OPTIONS]\n");
     printf("  lprun scanner [--pdf | --img] <output_file>\n");
@@ -95,7 +110,11 @@ void print_usage(void) {
     printf("  --text \"STRING\"         Print plain text\n");
     printf("  --image <file>           Print an image (PNG/JPG/WebP)\n");
     printf("  --file <file>            Print any file (PDF, PS, etc.)\n");
+    printf("                           (typed by content: PDFs, images and text\n");
+    printf("                           are converted, PS/PCL/PJL/PWG go as is;\n");
+    printf("                           '-' reads stdin; raw --ip printing only)\n");
     printf("  --copies N               Print multiple copies (default: 1)\n");
+    printf("  --pages 3-5,10,20-       Print only these pages (PDF and PostScript)\n");
     printf("\n");
 
     printf("COLOR OPTIONS (mutually exclusive):\n");
@@ -106,9 +125,26 @@ void print_usage(void) {
 
     printf("PRINTER SELECTION:\n");
     printf("  --list                   List available printers via CUPS\n");
+    printf("  --discover [subnet]      Probe the LAN for ports 9100/631/8611\n");
+    printf("                           (per-probe timeout 300 ms, 256 in flight)\n");
     printf("  --printer <name>         Use a specific CUPS printer\n");
     printf("  --ip <addr>              Send raw job directly to printer (LAN)\n");
+    printf("  --ip <a,b:port,c>        Send the same job to several raw printers\n");
+    printf("  --ip-file <file>         Read raw printer addresses from a file\n");
+    printf("                           (one per line, '#' comments allowed)\n");
+    printf("  --parallel N             Max simultaneous raw connections (default: 8)\n");
     printf("  --port <port>            Raw printing port (default: 9100)\n");
+    printf("  --no-cache               Ignore the cached printer, formats and conversions\n");
+    printf("  --verbose                Show per-backend discovery latency and the\n");
+    printf("                           printer's document formats\n");
+    printf("                           (cache: $XDG_CACHE_HOME/lprun/printers)\n");
+    printf("  --copy-mode <mode>       Raw copies: auto, pjl, ps or resend\n");
+    printf("                           (default auto: one transmission, printer\n");
+    printf("                           repeats it; resend reconnects per copy)\n");
+    printf("  --pdl <lang>             Raw printer language: auto, ps, pwg or pcl\n");
+    printf("                           (pwg/pcl render pages here with gs; auto\n");
+    printf("                           does so for printers without PostScript)\n");
+    printf("  --dpi N                  Resolution for --pdl pwg/pcl (default: 300)\n");
     printf("\n");
 
     printf("SCANNER MODULE:\n");
@@ -116,8 +152,26 @@ void print_usage(void) {
     printf("  lprun scanner --img <output.png>\n");
     printf("\n");
 
+    printf("BATCH:\n");
+    printf("  lprun --batch <manifest|-> [--printer Q | --ip A] [--workers N]\n");
+    printf("                           One job per line: file [printer=Q | ip=A[:port]]\n");
+    printf("                           [copies=N] [color|gray]; converts on all cores,\n");
+    printf("                           keeps each printer's jobs in manifest order\n");
+    printf("\n");
+
+    printf("DAEMON:\n");
+    printf("  lprun --daemon [--socket P] [--printer Q | --ip A] [--workers N]\n");
+    printf("                           Keep printers, converters and caches warm and\n");
+    printf("                           take jobs on a UNIX socket\n");
+    printf("                           ($XDG_RUNTIME_DIR/lprun.sock)\n");
+    printf("  lprun --submit <file> [--printer Q | --ip A] [--copies N]\n");
+    printf("                           Queue a job with the daemon; prints its id\n");
+    printf("  lprun --job-status <id>  queued, converting, sending, done or failed\n");
+    printf("\n");
+
     printf("HISTORY:\n");
     printf("  lprun history            Show print history\n");
+    printf("  lprun --cache-stats      Conversion cache size and hit rate\n");
     printf("\n");
 
     printf("EXAMPLES:\n");
@@ -155,14 +209,395 @@ int ensure_dir(const char *path) {
     return 0;
 }
 
+/* Send a prepared document to a CUPS queue as a single job carrying the
+ * copy count; a streamed conversion comes in on in_fd (else -1) */
+static int print_to_cups(const char *printer_name, const char *out, int in_fd,
+                         int copies, int color_mode) {
+    printf("Sending to CUPS printer: %s (copies=%d)\n", printer_name, copies);
+
+    // Start printing spinner
+    pthread_t print_spinner_tid;
+    atomic_store(&printing_stop, false);
+    pthread_create(&print_spinner_tid, NULL, printing_spinner_func, NULL);
+
+    struct cups_job_opts jo = { .copies = copies, .color_mode = color_mode };
+    int job = in_fd >= 0 ? cups_submit_fd(printer_name, in_fd, &jo)
+                         : cups_print_file(printer_name, out, &jo);
+
+    // Stop spinner
+    atomic_store(&printing_stop, true);
+    pthread_join(print_spinner_tid, NULL);
+
+    clear_line();
+    if (job <= 0) {
+        fprintf(stderr, "CUPS print failed\n");
+        return 20;
+    }
+    printf("✓ Job %d submitted (%d cop%s)\n", job, copies, copies == 1 ? "y" : "ies");
+    return 0;
+}
+
+/* Send a prepared document straight to a JetDirect socket; a streamed
+ * conversion comes in on in_fd (else -1) */
+static int print_to_raw(const char *ip, int port, const char *out, int in_fd, int copies,
+                        enum raw_copy_mode copy_mode) {
+    int rc;
+    printf("Sending to raw printer %s:%d (copies=%d)\n", ip, port, copies);
+
+    // Start spinner for raw printing
+    pthread_t raw_spinner_tid;
+    atomic_store(&printing_stop, false);
+    pthread_create(&raw_spinner_tid, NULL, printing_spinner_func, NULL);
+
+    if (in_fd >= 0) rc = send_fd_raw(ip, port, in_fd, -1, copies, copy_mode);
+    else rc = send_file_raw(ip, port, out, copies, copy_mode);
+
+    // Stop spinner
+    atomic_store(&printing_stop, true);
+    pthread_join(raw_spinner_tid, NULL);
+
+    if (rc == 0) {
+        clear_line();
+        printf("✓ Raw print job sent successfully!\n");
+    } else {
+        clear_line();
+        printf("✗ Raw print failed\n");
+    }
+
+    return rc;
+}
+
+/* Ghostscript can render it: PostScript or PDF */
+static int renderable(const char *path) {
+    enum doc_format f = sniff_file(path);
+    return f == DOC_PS || f == DOC_PDF;
+}
+
+/* Ctrl-C or SIGTERM while printing. Converters run in their own process
+ * groups, out of the terminal's reach: stop them here and let main unwind
+ * as for a failed job, which unlinks the temp output. With only the send
+ * left, end as the signal would, minus the temp file */
+static volatile sig_atomic_t cli_stop;
+static struct prep_job *volatile cli_prep;
+static struct raster_job *volatile cli_raster;
+
+static void on_cli_stop(int sig) {
+    struct prep_job *j = cli_prep;
+    struct raster_job *r = cli_raster;
+    if (!r && (!j || (!j->running && !j->pid && !j->generating))) {
+        if (j && j->out && j->owns_out) unlink(j->out);
+        raise(sig);         /* SA_RESETHAND: the default action, once we return */
+        return;
+    }
+    cli_stop = sig;
+    if (j) {
+        atomic_store(&j->cancel, 1);
+        if (j->pid > 0) kill(-j->pid, SIGTERM);
+    }
+    if (r) {
+        atomic_store(&r->cancel, 1);
+        if (r->pid > 0) kill(-r->pid, SIGTERM);
+    }
+}
+
+/* Render pages to PWG raster or PCL and stream that to the raw printer.
+ * Copies: PCL gets the usual PJL count, PWG carries it in each page
+ * header. Without Ghostscript the PostScript goes as before */
+static int print_raster(const char *ip, int port, const char *out, int in_fd, int copies,
+                        int color_mode, enum raw_copy_mode copy_mode,
+                        const struct raster_opts *ro) {
+    int from_stdin = in_fd < 0 && strcmp(out, "-") == 0;
+    if (in_fd < 0 && !from_stdin && !renderable(out)) {
+        fprintf(stderr, "Not PostScript or PDF; sending the file as is\n");
+        return print_to_raw(ip, port, out, in_fd, copies, copy_mode);
+    }
+
+    struct raster_opts o = *ro;
+    o.color_mode = color_mode;
+    o.copies = copies;
+    struct raster_job r;
+    if (raster_start(&r, out, from_stdin ? STDIN_FILENO : in_fd, &o) != 0) {
+        fprintf(stderr, "Cannot run gs to render %s; sending PostScript\n", raster_pdl_name(o.pdl));
+        return print_to_raw(ip, port, out, in_fd, copies, copy_mode);
+    }
+    printf("Rendering pages to %s at %d dpi\n", o.pdl == RASTER_PWG ? "PWG raster" : "PCL",
+           r.o.dpi);
+    cli_raster = &r;
+
+    int rc = print_to_raw(ip, port, NULL, r.fd, o.pdl == RASTER_PWG ? 1 : copies, copy_mode);
+    int sent = rc == 0 && !cli_stop;
+    if (raster_finish(&r, sent) != 0 && sent) {
+        fprintf(stderr, "Rendering failed; the printer got a partial job\n");
+        rc = 22;
+    }
+    cli_raster = NULL;
+    return rc;
+}
+
+static int send_document(const char *printer_name, const char *ip, int port, const char *out,
+                         int in_fd, int copies, int color_mode, enum raw_copy_mode copy_mode,
+                         const struct raster_opts *ro) {
+    if (printer_name) return print_to_cups(printer_name, out, in_fd, copies, color_mode);
+    if (ro->pdl != RASTER_PS) {
+        return print_raster(ip, port, out, in_fd, copies, color_mode, copy_mode, ro);
+    }
+    return print_to_raw(ip, port, out, in_fd, copies, copy_mode);
+}
+
+/* Start converting the document; discovery runs alongside it */
+static void start_prep(struct prep_job *prep, enum prep_kind kind, const char *src,
+                       int color_mode, int use_cache, int stream,
+                       const struct page_ranges *pages) {
+    prep_init(prep, kind, src, color_mode);
+    prep->use_cache = use_cache;
+    prep->stream = stream;
+    if (pages->n && (prep->route == PREP_PDF || prep->format == DOC_PS)) prep->pages = pages;
+    prep_start(prep);
+}
+
+/* Fit the job to its printer. What the printer takes is cached per
+ * printer, else asked while the conversion runs: a PDF may go as it is,
+ * and a raw printer without PostScript gets pages rendered here */
+static void fit_to_printer(struct prep_job *prep, const char *printer_name, const char *ip,
+                           int port, const char *pdl_hint, int use_cache, int pdl_auto,
+                           int verbose, struct raster_opts *raster) {
+    struct caps caps = { 0 };
+    int have_caps = 0;
+    if (prep_native_candidate(prep, printer_name != NULL) || (pdl_auto && !printer_name)) {
+        have_caps = caps_get(printer_name != NULL, printer_name ? printer_name : ip, port,
+                             pdl_hint, use_cache, &caps) == 0;
+        if (verbose) {
+            printf("Printer formats: %s (via %s%s)\n", have_caps ? caps.pdl : "unknown",
+                   caps_source_name(caps.source), caps.cached ? ", cached" : "");
+        }
+    }
+
+    if (pdl_auto && !printer_name) {
+        raster->pdl = have_caps ? raster_pick_pdl(caps.pdl) : RASTER_PS;
+        if (raster->pdl != RASTER_PS) {
+            printf("Printer takes no PostScript; sending %s\n",
+                   raster->pdl == RASTER_PWG ? "PWG raster" : "PCL");
+        }
+    }
+
+    /* Don't wait for the document if it can go out in its own format: the
+     * printer takes PDF, or Ghostscript renders the raster from it anyway */
+    if (have_caps && prep_native_ok(prep, caps.pdl, printer_name != NULL)) {
+        prep_cancel(prep);
+        prep_use_original(prep);
+        printf("Printer accepts PDF natively; skipping conversion.\n");
+    } else if (raster->pdl != RASTER_PS && prep_native_candidate(prep, 1)) {
+        prep_cancel(prep);
+        prep_use_original(prep);
+    }
+}
+
+/* Point the job at a discovered printer */
+static void use_discovered(const struct disc_printer *p, const char **printer_name,
+                           const char **ip, int *port) {
+    if (p->is_cups) {
+        *printer_name = p->name;
+        *ip = NULL;
+    } else {
+        *printer_name = NULL;
+        *ip = p->name;
+        if (p->port) *port = p->port;
+    }
+}
+
+static int parse_copy_mode(const char *m, enum raw_copy_mode *mode) {
+    if (strcmp(m, "auto") == 0) *mode = RAW_COPIES_AUTO;
+    else if (strcmp(m, "pjl") == 0) *mode = RAW_COPIES_PJL;
+    else if (strcmp(m, "ps") == 0) *mode = RAW_COPIES_PS;
+    else if (strcmp(m, "resend") == 0) *mode = RAW_COPIES_RESEND;
+    else {
+        fprintf(stderr, "Error: --copy-mode must be auto, pjl, ps or resend\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* lprun --batch <manifest|-> [--printer Q | --ip A] [--port P] [--workers N]
+ *                            [--copy-mode M] [--no-cache] */
+static int run_batch(int argc, char **argv) {
+    struct batch_opts bo = { .port = 9100, .use_cache = 1 };
+    const char *manifest = NULL;
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--printer") == 0 && i+1 < argc) bo.printer = argv[++i];
+        else if (strcmp(argv[i], "--ip") == 0 && i+1 < argc) bo.ip = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i+1 < argc) bo.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i+1 < argc) bo.workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-cache") == 0) bo.use_cache = 0;
+        else if (strcmp(argv[i], "--copy-mode") == 0 && i+1 < argc) {
+            if (parse_copy_mode(argv[++i], &bo.copy_mode) != 0) return 1;
+        }
+        else if (!manifest && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)) manifest = argv[i];
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!manifest) {
+        fprintf(stderr, "Usage: lprun --batch <manifest|-> [--printer Q | --ip A] [--workers N]\n");
+        return 1;
+    }
+
+    struct batch_job *jobs;
+    int n = batch_read(manifest, &bo, &jobs);
+    if (n < 0) return 1;
+    if (n == 0) {
+        printf("Manifest has no jobs.\n");
+        free(jobs);
+        return 0;
+    }
+
+    /* lines without a printer go to the discovered one, looked up once */
+    int need = 0;
+    for (int i = 0; i < n; i++) need |= !jobs[i].printer[0] && !jobs[i].ip[0];
+    if (need) {
+        struct disc_printer found;
+        printf("Discovering CUPS/network printers...\n");
+        if (discover_printer(&found, NULL) != 0) {
+            fprintf(stderr, "No printer discovered. Use --printer or --ip.\n");
+            free(jobs);
+            return 3;
+        }
+        printf("Using %s printer: %s\n", found.is_cups ? "CUPS" : "network", found.name);
+        for (int i = 0; i < n; i++) {
+            if (jobs[i].printer[0] || jobs[i].ip[0]) continue;
+            if (found.is_cups) snprintf(jobs[i].printer, sizeof(jobs[i].printer), "%s", found.name);
+            else {
+                snprintf(jobs[i].ip, sizeof(jobs[i].ip), "%.63s", found.name);
+                if (found.port) jobs[i].port = found.port;
+            }
+        }
+    }
+
+    printf("Printing %d jobs...\n", n);
+    double t0 = net_now_ms();
+    int failed = batch_run(jobs, n, &bo);
+    batch_print_summary(jobs, n, (net_now_ms() - t0) / 1000.0);
+    free(jobs);
+    return failed ? 22 : 0;
+}
+
+/* lprun --daemon [--socket P] [--printer Q | --ip A] [--port P] [--workers N]
+ *               [--copy-mode M] [--no-cache] */
+static volatile sig_atomic_t daemon_stop;
+
+static void on_daemon_stop(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static int run_daemon(int argc, char **argv) {
+    struct spool_opts so = { .jobs = { .port = 9100, .use_cache = 1 }, .stop = &daemon_stop };
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) so.socket_path = argv[++i];
+        else if (strcmp(argv[i], "--printer") == 0 && i+1 < argc) so.jobs.printer = argv[++i];
+        else if (strcmp(argv[i], "--ip") == 0 && i+1 < argc) so.jobs.ip = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i+1 < argc) so.jobs.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i+1 < argc) so.jobs.workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-cache") == 0) so.jobs.use_cache = 0;
+        else if (strcmp(argv[i], "--copy-mode") == 0 && i+1 < argc) {
+            if (parse_copy_mode(argv[++i], &so.jobs.copy_mode) != 0) return 1;
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    struct sigaction sa = { .sa_handler = on_daemon_stop };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    return spool_serve(&so) == 0 ? 0 : 1;
+}
+
+/* Thin client: lprun --submit <file> [--printer Q | --ip A[:port]] [--copies N]
+ *                                   [--color | --grayscale] [--socket P]
+ *              lprun --job-status <id> [--socket P] */
+static int run_client(int argc, char **argv) {
+    const char *socket_path = NULL, *printer = NULL, *addr = NULL;
+    int copies = 1, color_mode = 0;
+
+    for (int i = 3; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) socket_path = argv[++i];
+        else if (strcmp(argv[i], "--printer") == 0 && i+1 < argc) printer = argv[++i];
+        else if (strcmp(argv[i], "--ip") == 0 && i+1 < argc) addr = argv[++i];
+        else if (strcmp(argv[i], "--copies") == 0 && i+1 < argc) copies = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--color") == 0) color_mode = 1;
+        else if (strcmp(argv[i], "--grayscale") == 0) color_mode = 2;
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    char req[2048], reply[256];
+    if (strcmp(argv[1], "--job-status") == 0) {
+        snprintf(req, sizeof(req), "STATUS %s", argv[2]);
+    } else {
+        /* the daemon has its own working directory */
+        char *abs = realpath(argv[2], NULL);
+        if (!abs) {
+            perror(argv[2]);
+            return 1;
+        }
+        /* the path goes in quotes on one request line, with no escapes */
+        if (strpbrk(abs, "\"\n")) {
+            fprintf(stderr, "Cannot submit %s: the path contains a quote or a newline\n", abs);
+            free(abs);
+            return 1;
+        }
+        int n = snprintf(req, sizeof(req), "SUBMIT \"%s\" copies=%d%s", abs, copies,
+                         color_mode == 1 ? " color" : color_mode == 2 ? " gray" : "");
+        if (printer) n += snprintf(req + n, sizeof(req) - n, " printer=%s", printer);
+        else if (addr) snprintf(req + n, sizeof(req) - n, " ip=%s", addr);
+        free(abs);
+    }
+
+    int rc = spool_request(socket_path, req, reply, sizeof(reply));
+    if (rc < 0) {
+        fprintf(stderr, "lprun daemon not running (start it with lprun --daemon)\n");
+        return 3;
+    }
+    if (rc > 0) {
+        fprintf(stderr, "%s\n", reply + (strncmp(reply, "ERR ", 4) == 0 ? 4 : 0));
+        return 1;
+    }
+    if (strcmp(argv[1], "--submit") == 0) printf("Job %s queued\n", reply + 3);
+    else printf("Job %s\n", reply + 3);
+    return 0;
+}
+
+/* Background refresh of a stale printer cache entry */
+static void *revalidate_thread(void *arg) {
+    (void)arg;
+    struct disc_printer p;
+    if (discover_printer(&p, NULL) == 0) pcache_put(&p);
+    return NULL;
+}
+
 int main(int argc, char **argv) {
     const char *printer_name = NULL;
     const char *ip = NULL;
+    const char *ip_file = NULL;
+    int max_parallel = 8;
+    int use_cache = 1;
+    int verbose = 0;
     int port = 9100;
     const char *text = NULL;
     const char *image = NULL;
     const char *file = NULL;
     int copies = 1;
+    struct page_ranges pages = { 0 };
+    enum raw_copy_mode copy_mode = RAW_COPIES_AUTO;
+    struct raster_opts raster = { .pdl = RASTER_PS };
+    int pdl_auto = 1;
     int color_mode = 0; // 0 = auto/default, 1 = color, 2 = grayscale
     char out_dir[512] = {0};
 
@@ -195,6 +630,76 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    /* Spool daemon and its clients */
+    if (strcmp(argv[1], "--daemon") == 0) {
+        return run_daemon(argc, argv);
+    }
+    if ((strcmp(argv[1], "--submit") == 0 || strcmp(argv[1], "--job-status") == 0) && argc > 2) {
+        return run_client(argc, argv);
+    }
+
+    /* Many documents from a manifest */
+    if (strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc, argv);
+    }
+
+    /* Conversion cache counters */
+    if (strcmp(argv[1], "--cache-stats") == 0) {
+        struct conv_stats cs;
+        if (conv_cache_stats(&cs) != 0) {
+            fprintf(stderr, "No cache directory\n");
+            return 1;
+        }
+        long long lookups = cs.hits + cs.misses;
+        printf("Conversion cache: %d entries, %.1f MB (limit %lld MB)\n",
+               cs.entries, cs.bytes / 1e6, CONV_CACHE_MAX_BYTES / (1024 * 1024));
+        printf("  hits %lld, misses %lld (%.0f%% hit rate)\n", cs.hits, cs.misses,
+               lookups ? 100.0 * cs.hits / lookups : 0.0);
+        return 0;
+    }
+
+    /* --- Network discovery: list every responding printer port --- */
+    if (strcmp(argv[1], "--discover") == 0) {
+        const char *subnet_arg = NULL;
+        struct portscan_opts so = { 0 };
+
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "--scan-timeout") == 0 && i+1 < argc) {
+                so.timeout_ms = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--scan-window") == 0 && i+1 < argc) {
+                so.concurrency = atoi(argv[++i]);
+            } else if (argv[i][0] != '-' && !subnet_arg) {
+                subnet_arg = argv[i];
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+
+        struct portscan_hit *hits;
+        int n;
+        if (subnet_arg) {
+            printf("Scanning %s...\n", subnet_arg);
+            n = portscan_cidr(subnet_arg, &so, &hits);
+        } else {
+            printf("Scanning local networks...\n");
+            n = discovery_scan_lan(&so, &hits);
+            if (n < 0) {
+                fprintf(stderr, "No IPv4 network found. Pass a subnet, e.g. 192.168.1.0/24\n");
+            }
+        }
+        if (n < 0) return 3;
+        if (n == 0) {
+            printf("No printers found.\n");
+            return 3;
+        }
+        for (int i = 0; i < n; i++) {
+            printf("  %-15s  port %-5d  %6.1f ms\n", hits[i].ip, hits[i].port, hits[i].rtt_ms);
+        }
+        free(hits);
+        return 0;
+    }
+
     /* --- Scanner Commands --- */
     if (strcmp(argv[1], "scanner") == 0) {
         if (argc < 4) {
@@ -232,6 +737,19 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "--ip") == 0 && i+1 < argc) {
             ip = argv[++i];
         }
+        else if (strcmp(argv[i], "--ip-file") == 0 && i+1 < argc) {
+            ip_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--parallel") == 0 && i+1 < argc) {
+            max_parallel = atoi(argv[++i]);
+            if (max_parallel < 1) max_parallel = 1;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = 0;
+        }
         else if (strcmp(argv[i], "--port") == 0 && i+1 < argc) {
             port = atoi(argv[++i]);
         }
@@ -248,6 +766,27 @@ int main(int argc, char **argv) {
             copies = atoi(argv[++i]);
             if (copies < 1) copies = 1;
         }
+        else if (strcmp(argv[i], "--pages") == 0 && i+1 < argc) {
+            if (pages_parse(argv[++i], &pages) != 0) return 1;
+        }
+        else if (strcmp(argv[i], "--copy-mode") == 0 && i+1 < argc) {
+            if (parse_copy_mode(argv[++i], &copy_mode) != 0) return 1;
+        }
+        else if (strcmp(argv[i], "--pdl") == 0 && i+1 < argc) {
+            const char *l = argv[++i];
+            pdl_auto = strcmp(l, "auto") == 0;
+            if (!pdl_auto && raster_parse_pdl(l, &raster.pdl) != 0) {
+                fprintf(stderr, "Unknown printer language: %s (auto, ps, pwg or pcl)\n", l);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--dpi") == 0 && i+1 < argc) {
+            raster.dpi = atoi(argv[++i]);
+            if (raster.dpi < 75 || raster.dpi > 1200) {
+                fprintf(stderr, "--dpi must be between 75 and 1200\n");
+                return 1;
+            }
+        }
         else if (strcmp(argv[i], "--color") == 0) {
             if (color_mode == 2) {
                 fprintf(stderr, "Error: Cannot use both --color and --grayscale\n");
@@ -291,37 +830,85 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* If printer name not provided, try to find one via CUPS or network discovery */
-    if (!printer_name && !ip) {
-        printf("Discovering CUPS/network printers...\n");
-
-        //print_progress_bar(10); TODO: FIX THIS FUNCTION
-        fflush(stdout);
+    /* Several raw printers: --ip a,b,c or --ip-file */
+    struct fanout_target *targets = NULL;
+    int ntargets = 0;
+    if (ip_file || (ip && strchr(ip, ','))) {
+        ntargets = ip_file ? fanout_read_targets(ip_file, port, &targets)
+                           : fanout_parse_targets(ip, port, &targets);
+        if (ntargets <= 0) {
+            fprintf(stderr, "Error: no valid printer addresses given\n");
+            return 1;
+        }
+    }
 
-        /* prefer CUPS printers */
-        char *cups_printer = discover_cups_printer();
-        clear_line();
+    /* Start converting the document now; discovery below runs alongside it.
+     * A known printer can take the converter's output as it is produced */
+    enum prep_kind kind = text ? PREP_TEXT : image ? PREP_IMAGE : PREP_FILE;
+    const char *src = text ? text : image ? image : file;
+    struct prep_job prep;
+    struct sigaction sa = { .sa_handler = on_cli_stop, .sa_flags = SA_RESETHAND };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    start_prep(&prep, kind, src, color_mode, use_cache, (ip || printer_name) && !targets, &pages);
+    cli_prep = &prep;
+    if (pages.n && !prep.pages) {
+        fprintf(stderr, "--pages applies to PDF and PostScript; printing the whole %s\n",
+                sniff_name(prep.format));
+    }
+    if (verbose && !text) {
+        printf("Document: %s%s\n", sniff_name(prep.format),
+               prep.route == PREP_AS_IS ? ", sent as is" : "");
+    }
 
-        if (cups_printer) {
-            printf("\rFound CUPS printer: %s\n", cups_printer);
-            printer_name = cups_printer;
+    /* If printer name not provided, use the cached one or run discovery */
+    struct disc_printer found;
+    int discovered = 0, from_cache = 0, revalidating = 0;
+    pthread_t revalidate_tid;
+
+    if (!printer_name && !ip && !targets) {
+        struct pcache_entry ce;
+
+        if (use_cache && pcache_get(&ce) == 0 && pcache_alive(&ce.p, 300)) {
+            found = ce.p;
+            from_cache = 1;
+            printf("Using cached %s printer: %s\n", found.is_cups ? "CUPS" : "network", found.name);
+            if (!pcache_fresh(&ce)) {
+                /* still answers, but refresh the cache while we print */
+                revalidating = pthread_create(&revalidate_tid, NULL, revalidate_thread, NULL) == 0;
+            }
         } else {
-            /* discover IP via avahi/nmap */
-            char *found_ip = discover_printer_ip();
+            printf("Discovering CUPS/network printers...\n");
+            fflush(stdout);
 
-            if (found_ip) {
-                printf("\rFound printer IP: %s\n", found_ip);
-                ip = found_ip;
-            } else {
+            struct disc_opts dopts = { .verbose = verbose };
+            if (discover_printer(&found, &dopts) != 0) {
                 fprintf(stderr, "\nNo printer discovered. Use --printer or --ip.\n");
+                prep_cancel(&prep);
+                prep_release(&prep);
                 return 3;
             }
+            clear_line();
+            if (found.is_cups) {
+                char st[64];
+                printf("\rFound CUPS printer: %s", found.name);
+                if (found.state) printf(" [%s]", disc_queue_status(&found, st, sizeof(st)));
+            } else {
+                printf("\rFound printer IP: %s", found.name);
+            }
+            printf(" (via %s)\n", disc_source_name(found.source));
+            if (use_cache) pcache_put(&found);
         }
+        discovered = 1;
+        use_discovered(&found, &printer_name, &ip, &port);
     }
 
-    /* Prepare an output file to send */
-    char *out = NULL;
-    int owns_out = 0;
+    /* Fan-out targets are left alone */
+    if (!targets) {
+        fit_to_printer(&prep, printer_name, ip, port, discovered ? found.pdl : NULL, use_cache,
+                       pdl_auto, verbose, &raster);
+    }
 
     printf("Preparing document...\n");
 
@@ -330,140 +917,105 @@ int main(int argc, char **argv) {
     atomic_store(&printing_stop, false);
     pthread_create(&prep_spinner_tid, NULL, printing_spinner_func, NULL);
 
-    if (text) {
-        out = create_temp_ps_from_text(text, color_mode);
-        if (!out) {
-            atomic_store(&printing_stop, true);
-            pthread_join(prep_spinner_tid, NULL);
-            fprintf(stderr, "Failed to create PS from text\n");
-            return 4;
-        }
-        owns_out = 1;
-    } else if (image) {
-        out = convert_image_to_ps(image, color_mode);
-        if (!out) {
-            atomic_store(&printing_stop, true);
-            pthread_join(prep_spinner_tid, NULL);
-            fprintf(stderr, "Failed to convert image\n");
-            return 5;
-        }
-        owns_out = 1;
-    } else {
-        if (ends_with_ci(file, ".pdf")) {
-            out = convert_pdf_to_ps(file, color_mode);
-            if (!out) {
-                atomic_store(&printing_stop, true);
-                pthread_join(prep_spinner_tid, NULL);
-                fprintf(stderr, "Failed to convert PDF\n");
-                return 6;
-            }
-            owns_out = 1;
-        } else {
-            out = strdup(file);
-            owns_out = 0;
-        }
-    }
+    int prep_rc = prep_wait(&prep);
 
-    // Stop spinner and show success
+    // Stop spinner
     atomic_store(&printing_stop, true);
     pthread_join(prep_spinner_tid, NULL);
-    printf("\rDocument prepared successfully.          \n");
-    int rc = 0;
-    if (printer_name) {
-        /* Use CUPS */
-        printf("Sending to CUPS printer: %s (copies=%d)\n", printer_name, copies);
-
-        // Start printing spinner
-        pthread_t print_spinner_tid;
-        atomic_store(&printing_stop, false);
-        pthread_create(&print_spinner_tid, NULL, printing_spinner_func, NULL);
-
-        int successful_copies = 0;
-        for (int i = 0; i < copies; ++i) {
-            cups_option_t *options = NULL;
-            int num_options = 0;
-
-            // Show copy progress
-            printf("\rCopy %d/%d ", i + 1, copies);
-            fflush(stdout);
 
-            // Set color mode if specified
-            if (color_mode == 1) {
-                num_options = cupsAddOption("ColorModel", "RGB", num_options, &options);
-                num_options = cupsAddOption("ColorSpace", "sRGB", num_options, &options);
-            } else if (color_mode == 2) {
-                num_options = cupsAddOption("ColorModel", "Gray", num_options, &options);
-                num_options = cupsAddOption("ColorSpace", "Gray", num_options, &options);
-            }
-            // For auto mode, don't set any color options - let printer decide
-
-            int job = cupsPrintFile(printer_name, out, "lprun-job", num_options, options);
-
-            cupsFreeOptions(num_options, options);
-            if (job <= 0) {
-                clear_line();
-                fprintf(stderr, "CUPS print failed: %s\n", cupsLastErrorString());
-                rc = 20;
-                break;
-            }
-
-            successful_copies++;
-            clear_line();
-            printf("Copy %d/%d submitted (job id: %d)\n", successful_copies, copies, job);
+    if (cli_stop) {
+        prep_release(&prep);
+        if (revalidating) pthread_join(revalidate_tid, NULL);
+        return 128 + cli_stop;
+    }
+    if (prep_rc != 0) {
+        fprintf(stderr, "%s\n", prep_rc == 4 ? "Failed to create PS from text" :
+                                prep_rc == 5 ? "Failed to convert image" :
+                                prep.format == DOC_PS ? "Failed to select pages" : "Failed to convert PDF");
+        if (revalidating) pthread_join(revalidate_tid, NULL);
+        return prep_rc;
+    }
+    const char *out = prep.out;
+    if (prep.fd >= 0) printf("\rStreaming conversion to the printer.          \n");
+    else printf("\rDocument prepared successfully%s.          \n",
+                prep.cached ? " (cached conversion)" : "");
 
-            // Small delay between copies for better progress visibility
-            if (i < copies - 1) {
-                usleep(200000);
+    int rc = 0;
+    if (targets) {
+        /* Fan-out to several raw printers from one event loop */
+        printf("Sending to %d raw printers (copies=%d, parallel=%d)\n",
+               ntargets, copies, max_parallel);
+
+        struct fanout_opts fo = {
+            .max_parallel = max_parallel,
+            .connect_timeout_ms = 5000,
+            .idle_timeout_ms = 60000,
+            .copies = copies,
+            .copy_mode = copy_mode,
+        };
+        int failed = fanout_send_file(targets, ntargets, out, &fo);
+        if (failed) {
+            printf("✗ %d of %d printers failed:\n", failed, ntargets);
+            for (int i = 0; i < ntargets; i++) {
+                if (targets[i].status != 0) {
+                    printf("    %s:%d  %s\n", targets[i].ip, targets[i].port, targets[i].error);
+                }
             }
+            rc = 21;
+        } else {
+            printf("✓ Raw print job sent to all %d printers!\n", ntargets);
         }
-
-        // Stop spinner
-        atomic_store(&printing_stop, true);
-        pthread_join(print_spinner_tid, NULL);
-
-        if (successful_copies > 0) {
-            printf("✓ %d copy(ies) submitted successfully!\n", successful_copies);
-        }
+        free(targets);
 
     } else {
-        /* IP path - raw printing */
-        printf("Sending to raw printer %s:%d (copies=%d)\n", ip, port, copies);
-
-        // Start spinner for raw printing
-        pthread_t raw_spinner_tid;
-        atomic_store(&printing_stop, false);
-        pthread_create(&raw_spinner_tid, NULL, printing_spinner_func, NULL);
-
-        rc = send_file_raw(ip, port, out, copies);
-
-        // Stop spinner
-        atomic_store(&printing_stop, true);
-        pthread_join(raw_spinner_tid, NULL);
+        int send_rc = send_document(printer_name, ip, port, out, prep.fd, copies, color_mode,
+                                    copy_mode, &raster);
+        rc = send_rc;
+        /* a converter dying mid-stream is the document's fault, not the
+         * printer's: report it, but don't forget the printer or reprint */
+        int sent = send_rc == 0 && !cli_stop;
+        if (prep.fd >= 0 && prep_finish(&prep, sent) != 0 && sent) {
+            fprintf(stderr, "Conversion failed while streaming; the printer got a partial job\n");
+            rc = prep.status;
+        }
 
-        if (rc == 0) {
-            clear_line();
-            printf("✓ Raw print job sent successfully!\n");
-        } else {
-            clear_line();
-            printf("✗ Raw print failed\n");
+        if (cli_stop) {
+            /* interrupted: the printer isn't to blame */
+        } else if (discovered && use_cache && send_rc == 0) {
+            pcache_touch(&found);
+        } else if (discovered && use_cache) {
+            /* the printer we found is gone: forget it and look again */
+            pcache_invalidate(&found);
+            if (from_cache) {
+                printf("Cached printer %s failed; rediscovering...\n", found.name);
+                struct disc_opts dopts = { .verbose = verbose };
+                if (discover_printer(&found, &dopts) == 0) {
+                    pcache_put(&found);
+                    use_discovered(&found, &printer_name, &ip, &port);
+                    /* what suited the old printer may not suit this one:
+                     * prepare the document again (the conversion cache
+                     * usually has it) */
+                    prep_release(&prep);
+                    start_prep(&prep, kind, src, color_mode, use_cache, 0, &pages);
+                    fit_to_printer(&prep, printer_name, ip, port, found.pdl, use_cache,
+                                   pdl_auto, verbose, &raster);
+                    rc = prep_wait(&prep);
+                    if (rc == 0) {
+                        rc = send_document(printer_name, ip, port, prep.out, -1, copies,
+                                           color_mode, copy_mode, &raster);
+                    } else if (!cli_stop) {
+                        fprintf(stderr, "Failed to prepare the document for %s\n", found.name);
+                    }
+                    if (rc == 0) pcache_touch(&found);
+                }
+            }
         }
     }
 
     /* Cleanup */
-    if (owns_out) {
-        unlink(out);
-        free(out);
-    }
-
-    /* Free dynamically allocated printer name if it came from discovery */
-    if (printer_name && printer_name != argv[2]) { // Not from command line
-        free((void*)printer_name);
-    }
+    prep_release(&prep);
 
-    /* Free dynamically allocated IP if it came from discovery */
-    if (ip && ip != argv[2]) { // Not from command line
-        free((void*)ip);
-    }
+    if (revalidating) pthread_join(revalidate_tid, NULL);
 
-    return rc;
+    return cli_stop ? 128 + cli_stop : rc;
 }
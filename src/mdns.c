@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include "mdns.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define DNS_TYPE_A      1
+#define DNS_TYPE_PTR    12
+#define DNS_TYPE_TXT    16
+#define DNS_TYPE_SRV    33
+#define DNS_CLASS_IN    1
+
+#define MDNS_MAX_ENTRIES 64
+#define MDNS_NAME_MAX    256
+
+static const char *const services[] = {
+    "_ipp._tcp.local", "_ipps._tcp.local", "_pdl-datastream._tcp.local"
+};
+#define NSERVICES (int)(sizeof(services) / sizeof(services[0]))
+
+/* what we know so far about one service instance */
+struct entry {
+    char fqdn[MDNS_NAME_MAX];   /* "Office Laser._ipp._tcp.local" */
+    int service;                /* index into services[] */
+    char target[MDNS_NAME_MAX];
+    int port;
+    char pdl[256];
+    int color, duplex;
+    int have_srv, have_txt;
+    int asked;                  /* follow-up query sent */
+};
+
+/* A records seen, by host name */
+struct host {
+    char name[MDNS_NAME_MAX];
+    uint32_t addr;
+};
+
+struct browse {
+    struct entry e[MDNS_MAX_ENTRIES];
+    int ne;
+    struct host h[MDNS_MAX_ENTRIES];
+    int nh;
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* ---- wire format ---- */
+
+static size_t put_name(unsigned char *p, size_t cap, const char *name) {
+    size_t off = 0;
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t l = dot ? (size_t)(dot - name) : strlen(name);
+        if (l > 63 || off + l + 2 > cap) return 0;
+        p[off++] = (unsigned char)l;
+        memcpy(p + off, name, l);
+        off += l;
+        name += l;
+        if (*name == '.') name++;
+    }
+    p[off++] = 0;
+    return off;
+}
+
+/* decode a possibly compressed name at *off into out; advances *off */
+static int get_name(const unsigned char *pkt, size_t len, size_t *off, char *out, size_t outlen) {
+    size_t pos = *off, o = 0;
+    int jumped = 0, hops = 0;
+
+    for (;;) {
+        if (pos >= len) return -1;
+        unsigned c = pkt[pos];
+        if (c == 0) {
+            pos++;
+            break;
+        }
+        if ((c & 0xc0) == 0xc0) {
+            if (pos + 1 >= len || ++hops > 16) return -1;
+            if (!jumped) *off = pos + 2;
+            jumped = 1;
+            pos = ((c & 0x3f) << 8) | pkt[pos + 1];
+            continue;
+        }
+        if (pos + 1 + c > len || o + c + 2 > outlen) return -1;
+        if (o) out[o++] = '.';
+        memcpy(out + o, pkt + pos + 1, c);
+        o += c;
+        pos += 1 + c;
+    }
+    out[o] = '\0';
+    if (!jumped) *off = pos;
+    return 0;
+}
+
+static unsigned rd16(const unsigned char *p) { return (unsigned)p[0] << 8 | p[1]; }
+
+/* question section entry with the unicast-response bit set */
+static size_t put_question(unsigned char *p, size_t cap, const char *name, unsigned type) {
+    size_t n = put_name(p, cap, name);
+    if (!n || n + 4 > cap) return 0;
+    p[n] = (unsigned char)(type >> 8);
+    p[n + 1] = (unsigned char)type;
+    p[n + 2] = 0x80;
+    p[n + 3] = DNS_CLASS_IN;
+    return n + 4;
+}
+
+static int send_query(int fd, const struct sockaddr_in *dst,
+                      const char *const *names, const unsigned *types, int nq) {
+    unsigned char pkt[1500] = { 0 };
+    size_t off = 12;
+    int q = 0;
+    for (int i = 0; i < nq; i++) {
+        size_t n = put_question(pkt + off, sizeof(pkt) - off, names[i], types[i]);
+        if (!n) break;
+        off += n;
+        q++;
+    }
+    pkt[4] = (unsigned char)(q >> 8);
+    pkt[5] = (unsigned char)q;
+    return sendto(fd, pkt, off, 0, (const struct sockaddr *)dst, sizeof(*dst)) < 0 ? -1 : 0;
+}
+
+/* ---- answer bookkeeping ---- */
+
+static struct entry *find_entry(struct browse *b, const char *fqdn, int create) {
+    for (int i = 0; i < b->ne; i++) {
+        if (strcasecmp(b->e[i].fqdn, fqdn) == 0) return &b->e[i];
+    }
+    if (!create || b->ne == MDNS_MAX_ENTRIES) return NULL;
+
+    /* instance names end with one of our service types */
+    size_t fl = strlen(fqdn);
+    for (int s = 0; s < NSERVICES; s++) {
+        size_t sl = strlen(services[s]);
+        if (fl > sl + 1 && fqdn[fl - sl - 1] == '.' && strcasecmp(fqdn + fl - sl, services[s]) == 0) {
+            struct entry *e = &b->e[b->ne++];
+            memset(e, 0, sizeof(*e));
+            snprintf(e->fqdn, sizeof(e->fqdn), "%s", fqdn);
+            e->service = s;
+            e->color = e->duplex = -1;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t host_addr(const struct browse *b, const char *name) {
+    for (int i = 0; i < b->nh; i++) {
+        if (strcasecmp(b->h[i].name, name) == 0) return b->h[i].addr;
+    }
+    return 0;
+}
+
+static int tf(const char *v, size_t n) {
+    return n > 0 && (v[0] == 'T' || v[0] == 't');
+}
+
+static void parse_txt(struct entry *e, const unsigned char *p, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        size_t l = p[i++];
+        if (i + l > len) break;
+        const char *kv = (const char *)p + i;
+        const char *eq = memchr(kv, '=', l);
+        if (eq) {
+            size_t kl = (size_t)(eq - kv), vl = l - kl - 1;
+            if (kl == 3 && strncasecmp(kv, "pdl", 3) == 0) {
+                snprintf(e->pdl, sizeof(e->pdl), "%.*s", (int)vl, eq + 1);
+            } else if (kl == 5 && strncasecmp(kv, "Color", 5) == 0) {
+                e->color = tf(eq + 1, vl);
+            } else if (kl == 6 && strncasecmp(kv, "Duplex", 6) == 0) {
+                e->duplex = tf(eq + 1, vl);
+            }
+        }
+        i += l;
+    }
+    e->have_txt = 1;
+}
+
+static void parse_packet(struct browse *b, const unsigned char *pkt, size_t len) {
+    if (len < 12 || !(pkt[2] & 0x80)) return;   /* responses only */
+    unsigned qd = rd16(pkt + 4);
+    unsigned rr = rd16(pkt + 6) + rd16(pkt + 8) + rd16(pkt + 10);
+    size_t off = 12;
+    char name[MDNS_NAME_MAX], data[MDNS_NAME_MAX];
+
+    for (unsigned i = 0; i < qd; i++) {
+        if (get_name(pkt, len, &off, name, sizeof(name)) != 0 || off + 4 > len) return;
+        off += 4;
+    }
+    for (unsigned i = 0; i < rr; i++) {
+        if (get_name(pkt, len, &off, name, sizeof(name)) != 0 || off + 10 > len) return;
+        unsigned type = rd16(pkt + off);
+        size_t rdlen = rd16(pkt + off + 8);
+        size_t rd = off + 10;
+        off = rd + rdlen;
+        if (off > len) return;
+
+        if (type == DNS_TYPE_PTR) {
+            size_t p = rd;
+            if (get_name(pkt, len, &p, data, sizeof(data)) == 0) find_entry(b, data, 1);
+        } else if (type == DNS_TYPE_SRV && rdlen > 6) {
+            struct entry *e = find_entry(b, name, 1);
+            size_t p = rd + 6;
+            if (e && get_name(pkt, len, &p, e->target, sizeof(e->target)) == 0) {
+                e->port = (int)rd16(pkt + rd + 4);
+                e->have_srv = 1;
+            }
+        } else if (type == DNS_TYPE_TXT) {
+            struct entry *e = find_entry(b, name, 1);
+            if (e) parse_txt(e, pkt + rd, rdlen);
+        } else if (type == DNS_TYPE_A && rdlen == 4 && b->nh < MDNS_MAX_ENTRIES) {
+            if (!host_addr(b, name)) {
+                snprintf(b->h[b->nh].name, sizeof(b->h[b->nh].name), "%s", name);
+                memcpy(&b->h[b->nh].addr, pkt + rd, 4);
+                b->nh++;
+            }
+        }
+    }
+}
+
+static int resolved(const struct browse *b, const struct entry *e) {
+    return e->have_srv && host_addr(b, e->target) != 0;
+}
+
+/* ask again for whatever the first answers left out */
+static void follow_up(int fd, const struct sockaddr_in *dst, struct browse *b) {
+    for (int i = 0; i < b->ne; i++) {
+        struct entry *e = &b->e[i];
+        if (e->asked || resolved(b, e)) continue;
+        const char *names[3];
+        unsigned types[3];
+        int n = 0;
+        if (!e->have_srv) { names[n] = e->fqdn; types[n++] = DNS_TYPE_SRV; }
+        if (!e->have_txt) { names[n] = e->fqdn; types[n++] = DNS_TYPE_TXT; }
+        if (e->have_srv) { names[n] = e->target; types[n++] = DNS_TYPE_A; }
+        send_query(fd, dst, names, types, n);
+        e->asked = 1;
+    }
+}
+
+static int collect(const struct browse *b, struct mdns_printer **out) {
+    int n = 0;
+    *out = calloc(b->ne > 0 ? b->ne : 1, sizeof(**out));
+    if (!*out) return -1;
+
+    for (int i = 0; i < b->ne; i++) {
+        const struct entry *e = &b->e[i];
+        if (!resolved(b, e)) continue;
+        struct mdns_printer *p = &(*out)[n++];
+        const char *svc = services[e->service];
+        size_t inst = strlen(e->fqdn) - strlen(svc) - 1;
+        snprintf(p->name, sizeof(p->name), "%.*s", (int)inst, e->fqdn);
+        snprintf(p->service, sizeof(p->service), "%.*s",
+                 (int)(strlen(svc) - strlen(".local")), svc);
+        snprintf(p->host, sizeof(p->host), "%s", e->target);
+        struct in_addr a = { .s_addr = host_addr(b, e->target) };
+        inet_ntop(AF_INET, &a, p->ip, sizeof(p->ip));
+        p->port = e->port;
+        snprintf(p->pdl, sizeof(p->pdl), "%s", e->pdl);
+        p->color = e->color;
+        p->duplex = e->duplex;
+    }
+    return n;
+}
+
+/* mdns_browse:
+ *  one-shot multicast DNS-SD browse from an ephemeral port (so responders
+ *  answer us directly), collecting PTR/SRV/TXT/A records until the
+ *  deadline, or until the first resolved service if o->first_only.
+ */
+int mdns_browse(const struct mdns_opts *opts, struct mdns_printer **out) {
+    struct mdns_opts o = opts ? *opts : (struct mdns_opts){ 0 };
+    if (o.timeout_ms <= 0) o.timeout_ms = 1500;
+    if (!o.group) o.group = "224.0.0.251";
+    if (o.port <= 0) o.port = 5353;
+    *out = NULL;
+
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(o.port);
+    if (inet_pton(AF_INET, o.group, &dst.sin_addr) != 1) return -1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unsigned char ttl = 255, loop = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (o.iface_addr) {
+        struct in_addr ifa;
+        if (inet_pton(AF_INET, o.iface_addr, &ifa) == 1) {
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &ifa, sizeof(ifa));
+        }
+    }
+
+    struct browse *b = calloc(1, sizeof(*b));
+    if (!b) { close(fd); return -1; }
+
+    const unsigned ptr[NSERVICES] = { DNS_TYPE_PTR, DNS_TYPE_PTR, DNS_TYPE_PTR };
+    double start = now_ms(), deadline = start + o.timeout_ms;
+    double resend = start + o.timeout_ms / 3.0;
+    if (send_query(fd, &dst, services, ptr, NSERVICES) != 0) {
+        free(b);
+        close(fd);
+        return -1;
+    }
+
+    for (;;) {
+        double now = now_ms();
+        if (now >= deadline) break;
+        if (resend && now >= resend) {
+            /* one retransmission for responders that missed the first query */
+            send_query(fd, &dst, services, ptr, NSERVICES);
+            resend = 0;
+        }
+        double until = resend ? resend : deadline;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int r = poll(&pfd, 1, (int)(until - now) + 1);
+        if (r < 0 && errno != EINTR) break;
+        if (r <= 0) continue;
+
+        unsigned char pkt[9000];
+        ssize_t n = recv(fd, pkt, sizeof(pkt), 0);
+        if (n <= 0) continue;
+        parse_packet(b, pkt, (size_t)n);
+
+        if (o.first_only) {
+            int done = 0;
+            for (int i = 0; i < b->ne && !done; i++) done = resolved(b, &b->e[i]);
+            if (done) break;
+        }
+        follow_up(fd, &dst, b);
+    }
+    close(fd);
+
+    int n = collect(b, out);
+    free(b);
+    return n;
+}
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include "netif.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/* container, VM and VPN plumbing never has printers on it */
+static const char *const virtual_prefixes[] = {
+    "docker", "veth", "br-", "virbr", "vmnet", "vboxnet", "lxc", "lxd",
+    "cni", "flannel", "cali", "tun", "tap", "wg", "zt", "tailscale", NULL
+};
+
+static int is_virtual_name(const char *name) {
+    for (int i = 0; virtual_prefixes[i]; i++) {
+        if (strncmp(name, virtual_prefixes[i], strlen(virtual_prefixes[i])) == 0) return 1;
+    }
+    return 0;
+}
+
+static int sysfs_has(const char *name, const char *leaf) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/%s", name, leaf);
+    return access(path, F_OK) == 0;
+}
+
+static int mask_prefix(uint32_t mask_be) {
+    uint32_t m = ntohl(mask_be);
+    int n = 0;
+    while (m & 0x80000000u) {
+        n++;
+        m <<= 1;
+    }
+    return n;
+}
+
+/* rank: physical NICs first, wired over wireless, private LAN ranges
+ * over public/link-local ones */
+static int score_netif(const char *name, uint32_t addr_be) {
+    uint32_t a = ntohl(addr_be);
+    int score = 0;
+
+    if (sysfs_has(name, "device")) score += 100;
+    if (sysfs_has(name, "wireless") || strncmp(name, "wl", 2) == 0) score += 10;
+    else if (strncmp(name, "en", 2) == 0 || strncmp(name, "eth", 3) == 0) score += 20;
+
+    if ((a >> 24) == 10 || (a >> 20) == (172u << 4 | 1) || (a >> 16) == (192u << 8 | 168)) {
+        score += 5;
+    } else if ((a >> 16) == (169u << 8 | 254)) {
+        score -= 50;
+    }
+    return score;
+}
+
+static int by_score(const void *x, const void *y) {
+    const struct netif *a = x, *b = y;
+    return b->score - a->score;
+}
+
+int netif_list(struct netif **out) {
+    struct ifaddrs *ifaddr, *ifa;
+    *out = NULL;
+    if (getifaddrs(&ifaddr) == -1) return -1;
+
+    int n = 0, cap = 0;
+    struct netif *arr = NULL;
+    for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET || !ifa->ifa_netmask) continue;
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & (IFF_LOOPBACK | IFF_POINTOPOINT))) continue;
+        if (is_virtual_name(ifa->ifa_name)) continue;
+
+        if (n == cap) {
+            int ncap = cap ? cap * 2 : 8;
+            struct netif *tmp = realloc(arr, ncap * sizeof(*arr));
+            if (!tmp) break;
+            arr = tmp;
+            cap = ncap;
+        }
+        struct netif *nif = &arr[n++];
+        memset(nif, 0, sizeof(*nif));
+        snprintf(nif->name, sizeof(nif->name), "%s", ifa->ifa_name);
+        nif->addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr;
+        nif->prefix = mask_prefix(((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr);
+        nif->score = score_netif(nif->name, nif->addr);
+    }
+    freeifaddrs(ifaddr);
+
+    if (n > 1) qsort(arr, n, sizeof(*arr), by_score);
+    *out = arr;
+    return n;
+}
+
+void netif_cidr(const struct netif *nif, char *buf, int len) {
+    uint32_t mask = nif->prefix ? 0xffffffffu << (32 - nif->prefix) : 0;
+    struct in_addr net = { .s_addr = htonl(ntohl(nif->addr) & mask) };
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &net, ip, sizeof(ip));
+    snprintf(buf, len, "%s/%d", ip, nif->prefix);
+}
+
+/* every interface is guaranteed a window this big before the bigger
+ * subnets share out the rest of the budget */
+#define NETIF_MIN_WINDOW 256u
+
+int netif_scan_ranges(const struct netif *ifs, int n, unsigned max_hosts,
+                      struct portscan_range **out) {
+    struct portscan_range *r = calloc(n > 0 ? n : 1, sizeof(*r));
+    unsigned *want = calloc(n > 0 ? n : 1, sizeof(*want));
+    unsigned *take = calloc(n > 0 ? n : 1, sizeof(*take));
+    uint32_t *self = calloc(n > 0 ? n : 1, sizeof(*self));
+    int nr = 0;
+    *out = r;
+    if (!r || !want || !take || !self) {
+        free(want);
+        free(take);
+        free(self);
+        return -1;
+    }
+
+    /* full subnet of each distinct LAN */
+    for (int i = 0; i < n; i++) {
+        uint32_t mask = ifs[i].prefix ? 0xffffffffu << (32 - ifs[i].prefix) : 0;
+        uint32_t me = ntohl(ifs[i].addr);
+        uint32_t first = me & mask, last = first | ~mask;
+        if (ifs[i].prefix < 31) {
+            first++;
+            last--;
+        }
+
+        /* two interfaces on the same LAN: scan it once */
+        int dup = 0;
+        for (int k = 0; k < nr; k++) {
+            if (me >= r[k].first && me <= r[k].last) dup = 1;
+        }
+        if (dup) continue;
+
+        r[nr] = (struct portscan_range){ first, last };
+        self[nr] = me;
+        unsigned long long size = (unsigned long long)(last - first) + 1;
+        want[nr] = size > max_hosts ? max_hosts : (unsigned)size;
+        nr++;
+    }
+
+    /* share the budget: a small window each, then the rest by rank */
+    unsigned left = max_hosts;
+    for (int k = 0; k < nr && left > 0; k++) {
+        take[k] = want[k] < NETIF_MIN_WINDOW ? want[k] : NETIF_MIN_WINDOW;
+        if (take[k] > left) take[k] = left;
+        left -= take[k];
+    }
+    for (int k = 0; k < nr && left > 0; k++) {
+        unsigned more = want[k] - take[k];
+        if (more > left) more = left;
+        take[k] += more;
+        left -= more;
+    }
+
+    /* narrow oversized subnets to a window around our own address */
+    int out_n = 0;
+    for (int k = 0; k < nr; k++) {
+        if (take[k] == 0) continue;
+        uint32_t first = r[k].first, last = r[k].last;
+        if ((unsigned long long)(last - first) + 1 > take[k]) {
+            uint32_t half = take[k] / 2;
+            uint32_t lo = self[k] - first < half ? first : self[k] - half;
+            if (lo + (take[k] - 1) > last) lo = last - (take[k] - 1);
+            first = lo;
+            last = lo + (take[k] - 1);
+        }
+        r[out_n++] = (struct portscan_range){ first, last };
+    }
+
+    free(want);
+    free(take);
+    free(self);
+    return out_n;
+}
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include "pages.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PAGES_IO_BYTES 65536
+/* DSC lines are at most 255 bytes; keep the whole comment in view */
+#define DSC_LINE_MAX 256
+
+static int by_first(const void *a, const void *b) {
+    const int *x = a, *y = b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+int pages_parse(const char *spec, struct page_ranges *pr) {
+    memset(pr, 0, sizeof(*pr));
+    const char *p = spec;
+    int bad = 0;
+    while (*p && !bad) {
+        while (*p == ' ') p++;
+        if (pr->n == PAGES_MAX_RANGES) {
+            fprintf(stderr, "--pages: at most %d ranges\n", PAGES_MAX_RANGES);
+            return -1;
+        }
+        char *end;
+        long first = 1, last;
+        int open_start = *p == '-';
+        if (!open_start) {
+            first = strtol(p, &end, 10);
+            if (end == p || first < 1) {
+                bad = 1;
+                break;
+            }
+            p = end;
+        }
+        if (*p == '-') {
+            p++;
+            last = isdigit((unsigned char)*p) ? strtol(p, &end, 10) : 0;
+            if (last) p = end;
+            bad = open_start && !last;          /* a bare "-" */
+        } else {
+            last = first;
+        }
+        if (bad || (last && last < first) || first > 1000000 || last > 1000000) {
+            bad = 1;
+            break;
+        }
+        pr->r[pr->n].first = (int)first;
+        pr->r[pr->n].last = (int)last;
+        pr->n++;
+
+        while (*p == ' ') p++;
+        if (*p == ',' && p[1]) p++;
+        else if (*p) bad = 1;
+    }
+    if (bad || pr->n == 0) {
+        fprintf(stderr, "--pages: bad page range '%s' (e.g. 3-5,10,20-)\n", spec);
+        pr->n = 0;
+        return -1;
+    }
+
+    /* document order, overlaps and neighbours merged: "5-6,1-3,4" is 1-6 */
+    qsort(pr->r, pr->n, sizeof(pr->r[0]), by_first);
+    int out = 0;
+    for (int i = 1; i < pr->n; i++) {
+        int *l = &pr->r[out].last;
+        if (*l == 0) break;
+        if (pr->r[i].first <= *l + 1) {
+            if (pr->r[i].last == 0 || pr->r[i].last > *l) *l = pr->r[i].last;
+        } else {
+            pr->r[++out] = pr->r[i];
+        }
+    }
+    pr->n = out + 1;
+    return 0;
+}
+
+void pages_format(const struct page_ranges *pr, char *buf, size_t len) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < pr->n && used < len; i++) {
+        int f = pr->r[i].first, l = pr->r[i].last;
+        const char *sep = i ? "," : "";
+        int w = l == f ? snprintf(buf + used, len - used, "%s%d", sep, f)
+              : l == 0 ? snprintf(buf + used, len - used, "%s%d-", sep, f)
+                       : snprintf(buf + used, len - used, "%s%d-%d", sep, f, l);
+        if (w < 0) break;
+        used += (size_t)w;
+    }
+}
+
+int pages_selected(const struct page_ranges *pr, int page) {
+    if (pr->n == 0) return 1;
+    for (int i = 0; i < pr->n; i++) {
+        if (page >= pr->r[i].first && (pr->r[i].last == 0 || page <= pr->r[i].last)) return 1;
+    }
+    return 0;
+}
+
+int pages_count(const struct page_ranges *pr, int total) {
+    int n = 0;
+    for (int p = 1; p <= total; p++) n += pages_selected(pr, p);
+    return n;
+}
+
+void pages_span(const struct page_ranges *pr, int *first, int *last) {
+    *first = pr->n ? pr->r[0].first : 1;
+    *last = pr->n ? pr->r[pr->n - 1].last : 0;
+}
+
+int pages_contiguous(const struct page_ranges *pr) {
+    return pr->n <= 1;
+}
+
+/* ---- DSC page extraction ---- */
+
+struct psin {
+    int fd;
+    int eof;
+    size_t pos, len;
+    char buf[PAGES_IO_BYTES];
+};
+
+struct psout {
+    int fd;
+    int err;
+    size_t len;
+    char buf[PAGES_IO_BYTES];
+};
+
+static void out_flush(struct psout *o) {
+    size_t off = 0;
+    while (!o->err && off < o->len) {
+        ssize_t w = write(o->fd, o->buf + off, o->len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) o->err = w < 0 ? errno : EIO;
+        else off += (size_t)w;
+    }
+    o->len = 0;
+}
+
+static void out_put(struct psout *o, const char *p, size_t n) {
+    while (!o->err && n > 0) {
+        if (o->len == sizeof(o->buf)) out_flush(o);
+        size_t k = sizeof(o->buf) - o->len < n ? sizeof(o->buf) - o->len : n;
+        memcpy(o->buf + o->len, p, k);
+        o->len += k;
+        p += k;
+        n -= k;
+    }
+}
+
+/* the next piece of input: a whole line (CR, LF or CRLF ends it) or, for
+ * lines longer than the buffer, as much as fits. *ended is 0 for a piece
+ * that doesn't end its line. Returns the length, 0 at EOF, -1 on errors */
+static ssize_t next_piece(struct psin *in, const char **piece, int *ended) {
+    for (;;) {
+        char *s = in->buf + in->pos;
+        size_t avail = in->len - in->pos;
+        char *nl = NULL;
+        for (size_t i = 0; i < avail; i++) {
+            if (s[i] == '\n' || s[i] == '\r') {
+                /* a CR at the end of the buffer may be half a CRLF */
+                if (s[i] == '\r' && i + 1 == avail && !in->eof) break;
+                nl = s + i + (s[i] == '\r' && i + 1 < avail && s[i + 1] == '\n');
+                break;
+            }
+        }
+        if (nl || in->eof || (in->pos == 0 && in->len == sizeof(in->buf))) {
+            size_t n = nl ? (size_t)(nl + 1 - s) : avail;
+            *piece = s;
+            *ended = nl != NULL || in->eof;
+            in->pos += n;
+            return (ssize_t)n;
+        }
+        /* move the partial line down and read more */
+        memmove(in->buf, s, avail);
+        in->pos = 0;
+        in->len = avail;
+        ssize_t r;
+        do r = read(in->fd, in->buf + in->len, sizeof(in->buf) - in->len);
+        while (r < 0 && errno == EINTR);
+        if (r < 0) return -1;
+        if (r == 0) in->eof = 1;
+        in->len += (size_t)r;
+    }
+}
+
+static int is_comment(const char *s, size_t n, const char *kw) {
+    size_t k = strlen(kw);
+    return n >= k && memcmp(s, kw, k) == 0;
+}
+
+/* pages_extract_ps:
+ *  one pass, line by line. Everything before the first %%Page is prolog
+ *  and kept, as is everything from %%Trailer on; a page's lines are kept
+ *  if it is selected. Pages of embedded documents (%%BeginDocument) are
+ *  part of the page around them. %%Pages and each kept %%Page ordinal are
+ *  rewritten so the output is itself valid DSC.
+ */
+int pages_extract_ps(int in_fd, int out_fd, const struct page_ranges *pr,
+                     const atomic_int *cancel) {
+    struct psin *in = malloc(sizeof(*in));
+    struct psout *o = malloc(sizeof(*o));
+    if (!in || !o) {
+        free(in);
+        free(o);
+        return -1;
+    }
+    in->fd = in_fd;
+    in->eof = 0;
+    in->pos = in->len = 0;
+    o->fd = out_fd;
+    o->err = 0;
+    o->len = 0;
+
+    int page = 0, kept = 0, keep = 1, nested = 0, trailer = 0, bol = 1, rc = 0;
+    const char *s;
+    int ended;
+    ssize_t n;
+    while ((n = next_piece(in, &s, &ended)) > 0 && !o->err) {
+        if (cancel && atomic_load(cancel)) {
+            rc = -1;
+            break;
+        }
+        if (bol && n >= 2 && s[0] == '%' && s[1] == '%') {
+            char line[DSC_LINE_MAX];
+            if (is_comment(s, n, "%%BeginDocument")) {
+                nested++;
+            } else if (is_comment(s, n, "%%EndDocument")) {
+                if (nested > 0) nested--;
+            } else if (nested) {
+                /* not ours */
+            } else if (!trailer && is_comment(s, n, "%%Page:")) {
+                keep = pages_selected(pr, ++page);
+                if (keep) {
+                    /* keep the label, renumber the ordinal */
+                    const char *label = s + 7;
+                    size_t ll = 0;
+                    while (label < s + n && *label == ' ') label++;
+                    while (label + ll < s + n && !isspace((unsigned char)label[ll])) ll++;
+                    int w = snprintf(line, sizeof(line), "%%%%Page: %.*s %d\n",
+                                     ll ? (int)(ll > 64 ? 64 : ll) : 1, ll ? label : "?", ++kept);
+                    out_put(o, line, (size_t)w);
+                    bol = ended;
+                    continue;
+                }
+            } else if (!trailer && is_comment(s, n, "%%Trailer")) {
+                trailer = 1;
+                keep = 1;
+            } else if ((page == 0 || trailer) && is_comment(s, n, "%%Pages:")) {
+                char *end;
+                long total = strtol(s + 8, &end, 10);
+                if (end != s + 8 && total > 0) {
+                    int w = snprintf(line, sizeof(line), "%%%%Pages: %d\n",
+                                     pages_count(pr, (int)total));
+                    out_put(o, line, (size_t)w);
+                    bol = ended;
+                    continue;
+                }
+            }
+        }
+        if (keep) out_put(o, s, (size_t)n);
+        bol = ended;
+    }
+    if (n < 0 || o->err) rc = -1;
+    out_flush(o);
+    if (o->err) rc = -1;
+    free(in);
+    free(o);
+    if (rc != 0) return -1;
+    if (page == 0) fprintf(stderr, "PostScript has no page structure (DSC); printing every page\n");
+    else if (kept == 0) fprintf(stderr, "No selected page in a %d-page document\n", page);
+    return page;
+}
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "pixel.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIX_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PIX_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define LUMA_R 77
+#define LUMA_G 151
+#define LUMA_B 28
+
+static const uint8_t bayer8[8][8] = {
+    { 0, 32, 8, 40, 2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44, 4, 36, 14, 46, 6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    { 3, 35, 11, 43, 1, 33, 9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47, 7, 39, 13, 45, 5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/* threshold for a Bayer cell: black below it, 2..254 */
+static inline uint8_t bayer_threshold(unsigned x, unsigned y) {
+    return (uint8_t)(bayer8[y & 7][x & 7] * 4 + 2);
+}
+
+/* exact x / 255 for x <= 65535 */
+static inline unsigned div255(unsigned x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/* ---- scalar ---- */
+
+static void rgb_to_gray_scalar(const uint8_t *rgb, uint8_t *gray, size_t n) {
+    for (size_t i = 0; i < n; i++, rgb += 3) {
+        gray[i] = (uint8_t)((LUMA_R * rgb[0] + LUMA_G * rgb[1] + LUMA_B * rgb[2]) >> 8);
+    }
+}
+
+static void rgba_to_gray_scalar(const uint8_t *rgba, uint8_t *gray, size_t n) {
+    for (size_t i = 0; i < n; i++, rgba += 4) {
+        unsigned y = (LUMA_R * rgba[0] + LUMA_G * rgba[1] + LUMA_B * rgba[2]) >> 8;
+        unsigned a = rgba[3];
+        gray[i] = (uint8_t)div255(y * a + 255 * (255 - a));
+    }
+}
+
+/* pixels [from, n) of an ordered-dithered row; from is a multiple of 8 */
+static void dither_ordered_tail(const uint8_t *gray, uint8_t *bits, size_t from, size_t n,
+                                unsigned y) {
+    const uint8_t *t = bayer8[y & 7];
+    size_t x = from;
+    for (; x + 8 <= n; x += 8) {
+        const uint8_t *g = gray + x;
+        unsigned b = 0;
+        for (int k = 0; k < 8; k++) b = b << 1 | (g[k] < t[k] * 4 + 2);
+        bits[x / 8] = (uint8_t)b;
+    }
+    if (x < n) {
+        unsigned b = 0;
+        for (size_t k = 0; k < 8; k++) b = b << 1 | (x + k < n && gray[x + k] < t[k] * 4 + 2);
+        bits[x / 8] = (uint8_t)b;
+    }
+}
+
+static void dither_ordered_scalar(const uint8_t *gray, uint8_t *bits, size_t n, unsigned y) {
+    dither_ordered_tail(gray, bits, 0, n, y);
+}
+
+/* ---- x86 ---- */
+
+#ifdef PIX_X86
+/* gather R, G and B of 16 packed RGB pixels into three byte vectors */
+__attribute__((target("sse4.1")))
+static inline void rgb_planes16(const uint8_t *p, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i a0 = _mm_loadu_si128((const __m128i *)p);
+    const __m128i a1 = _mm_loadu_si128((const __m128i *)(p + 16));
+    const __m128i a2 = _mm_loadu_si128((const __m128i *)(p + 32));
+    const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    *r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a0, r0), _mm_shuffle_epi8(a1, r1)),
+                      _mm_shuffle_epi8(a2, r2));
+    *g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a0, g0), _mm_shuffle_epi8(a1, g1)),
+                      _mm_shuffle_epi8(a2, g2));
+    *b = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a0, b0), _mm_shuffle_epi8(a1, b1)),
+                      _mm_shuffle_epi8(a2, b2));
+}
+
+/* luma of 8 pixels widened to 16 bits; the sum stays below 65536 */
+__attribute__((target("sse4.1")))
+static inline __m128i luma8(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_mullo_epi16(_mm_cvtepu8_epi16(r), _mm_set1_epi16(LUMA_R));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(_mm_cvtepu8_epi16(g), _mm_set1_epi16(LUMA_G)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(_mm_cvtepu8_epi16(b), _mm_set1_epi16(LUMA_B)));
+    return _mm_srli_epi16(y, 8);
+}
+
+__attribute__((target("sse4.1")))
+static void rgb_to_gray_sse41(const uint8_t *rgb, uint8_t *gray, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i r, g, b;
+        rgb_planes16(rgb + 3 * i, &r, &g, &b);
+        __m128i lo = luma8(r, g, b);
+        __m128i hi = luma8(_mm_srli_si128(r, 8), _mm_srli_si128(g, 8), _mm_srli_si128(b, 8));
+        _mm_storeu_si128((__m128i *)(gray + i), _mm_packus_epi16(lo, hi));
+    }
+    rgb_to_gray_scalar(rgb + 3 * i, gray + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void rgb_to_gray_avx2(const uint8_t *rgb, uint8_t *gray, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i r, g, b;
+        rgb_planes16(rgb + 3 * i, &r, &g, &b);
+        __m256i y = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(r), _mm256_set1_epi16(LUMA_R));
+        y = _mm256_add_epi16(y, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(g), _mm256_set1_epi16(LUMA_G)));
+        y = _mm256_add_epi16(y, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(b), _mm256_set1_epi16(LUMA_B)));
+        y = _mm256_srli_epi16(y, 8);
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(y), _mm256_extracti128_si256(y, 1));
+        _mm_storeu_si128((__m128i *)(gray + i), packed);
+    }
+    rgb_to_gray_scalar(rgb + 3 * i, gray + i, n - i);
+}
+
+/* y * a + 255 * (255 - a), then / 255, on 8 lanes of 16 bits */
+__attribute__((target("sse4.1")))
+static inline __m128i over_white8(__m128i y, __m128i a) {
+    const __m128i c255 = _mm_set1_epi16(255);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(y, a), _mm_mullo_epi16(c255, _mm_sub_epi16(c255, a)));
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse4.1")))
+static void rgba_to_gray_sse41(const uint8_t *rgba, uint8_t *gray, size_t n) {
+    const __m128i lo_mask = _mm_set1_epi32(0xff);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(rgba + 4 * i));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(rgba + 4 * i + 16));
+        /* one channel per 32-bit lane, then down to 16 bits */
+        __m128i r = _mm_packus_epi32(_mm_and_si128(p0, lo_mask), _mm_and_si128(p1, lo_mask));
+        __m128i g = _mm_packus_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), lo_mask),
+                                     _mm_and_si128(_mm_srli_epi32(p1, 8), lo_mask));
+        __m128i b = _mm_packus_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), lo_mask),
+                                     _mm_and_si128(_mm_srli_epi32(p1, 16), lo_mask));
+        __m128i a = _mm_packus_epi32(_mm_srli_epi32(p0, 24), _mm_srli_epi32(p1, 24));
+        __m128i y = _mm_mullo_epi16(r, _mm_set1_epi16(LUMA_R));
+        y = _mm_add_epi16(y, _mm_mullo_epi16(g, _mm_set1_epi16(LUMA_G)));
+        y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(LUMA_B)));
+        y = over_white8(_mm_srli_epi16(y, 8), a);
+        _mm_storel_epi64((__m128i *)(gray + i), _mm_packus_epi16(y, y));
+    }
+    rgba_to_gray_scalar(rgba + 4 * i, gray + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void rgba_to_gray_avx2(const uint8_t *rgba, uint8_t *gray, size_t n) {
+    const __m256i lo_mask = _mm256_set1_epi32(0xff);
+    const __m256i c255 = _mm256_set1_epi16(255);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *)(rgba + 4 * i));
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)(rgba + 4 * i + 32));
+        /* packs work per 128-bit lane: pixels come out as 0-3 8-11 4-7 12-15 */
+        __m256i r = _mm256_packus_epi32(_mm256_and_si256(p0, lo_mask), _mm256_and_si256(p1, lo_mask));
+        __m256i g = _mm256_packus_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 8), lo_mask),
+                                        _mm256_and_si256(_mm256_srli_epi32(p1, 8), lo_mask));
+        __m256i b = _mm256_packus_epi32(_mm256_and_si256(_mm256_srli_epi32(p0, 16), lo_mask),
+                                        _mm256_and_si256(_mm256_srli_epi32(p1, 16), lo_mask));
+        __m256i a = _mm256_packus_epi32(_mm256_srli_epi32(p0, 24), _mm256_srli_epi32(p1, 24));
+        __m256i y = _mm256_mullo_epi16(r, _mm256_set1_epi16(LUMA_R));
+        y = _mm256_add_epi16(y, _mm256_mullo_epi16(g, _mm256_set1_epi16(LUMA_G)));
+        y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(LUMA_B)));
+        y = _mm256_srli_epi16(y, 8);
+        __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(y, a),
+                                     _mm256_mullo_epi16(c255, _mm256_sub_epi16(c255, a)));
+        x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+        x = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+        /* 0-3 8-11 | 4-7 12-15 packed per lane, then the 64-bit quarters reordered */
+        __m256i packed = _mm256_packus_epi16(x, x);
+        packed = _mm256_permute4x64_epi64(packed, 0xd8);
+        __m128i out = _mm256_castsi256_si128(packed);
+        out = _mm_shuffle_epi32(out, 0xd8);
+        _mm_storeu_si128((__m128i *)(gray + i), out);
+    }
+    rgba_to_gray_scalar(rgba + 4 * i, gray + i, n - i);
+}
+
+/* movemask puts pixel 0 in bit 0 and the raster wants it in bit 7, so
+ * each group of 8 is compared back to front: these are the thresholds of
+ * 16 pixels from a multiple of 8, reversed per 8 */
+static void bayer_reversed16(unsigned y, uint8_t t[16]) {
+    for (unsigned k = 0; k < 16; k++) t[k] = bayer_threshold(k ^ 7, y);
+}
+
+__attribute__((target("sse4.1")))
+static void dither_ordered_sse41(const uint8_t *gray, uint8_t *bits, size_t n, unsigned y) {
+    uint8_t t[16];
+    bayer_reversed16(y, t);
+    const __m128i thr = _mm_loadu_si128((const __m128i *)t);
+    const __m128i rev = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m128i g = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(gray + x)), rev);
+        /* g >= t where max(g, t) == g; black is the rest */
+        unsigned white = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(g, thr), g));
+        uint16_t black = (uint16_t)~white;
+        memcpy(bits + x / 8, &black, 2);
+    }
+    dither_ordered_tail(gray, bits, x, n, y);
+}
+
+__attribute__((target("avx2")))
+static void dither_ordered_avx2(const uint8_t *gray, uint8_t *bits, size_t n, unsigned y) {
+    uint8_t t[16];
+    bayer_reversed16(y, t);
+    const __m256i thr = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t));
+    const __m256i rev = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t x = 0;
+    for (; x + 32 <= n; x += 32) {
+        __m256i g = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(gray + x)), rev);
+        uint32_t black = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(g, thr), g));
+        memcpy(bits + x / 8, &black, 4);
+    }
+    dither_ordered_tail(gray, bits, x, n, y);
+}
+#endif
+
+/* ---- ARM ---- */
+
+#ifdef PIX_NEON
+static void rgb_to_gray_neon(const uint8_t *rgb, uint8_t *gray, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x3_t p = vld3_u8(rgb + 3 * i);
+        uint16x8_t y = vmull_u8(p.val[0], vdup_n_u8(LUMA_R));
+        y = vmlal_u8(y, p.val[1], vdup_n_u8(LUMA_G));
+        y = vmlal_u8(y, p.val[2], vdup_n_u8(LUMA_B));
+        vst1_u8(gray + i, vshrn_n_u16(y, 8));
+    }
+    rgb_to_gray_scalar(rgb + 3 * i, gray + i, n - i);
+}
+
+static void rgba_to_gray_neon(const uint8_t *rgba, uint8_t *gray, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t p = vld4_u8(rgba + 4 * i);
+        uint16x8_t y = vmull_u8(p.val[0], vdup_n_u8(LUMA_R));
+        y = vmlal_u8(y, p.val[1], vdup_n_u8(LUMA_G));
+        y = vmlal_u8(y, p.val[2], vdup_n_u8(LUMA_B));
+        uint8x8_t a = p.val[3];
+        uint16x8_t x = vmull_u8(vshrn_n_u16(y, 8), a);
+        x = vmlal_u8(x, vdup_n_u8(255), vsub_u8(vdup_n_u8(255), a));
+        x = vaddq_u16(x, vdupq_n_u16(128));
+        vst1_u8(gray + i, vshrn_n_u16(vaddq_u16(x, vshrq_n_u16(x, 8)), 8));
+    }
+    rgba_to_gray_scalar(rgba + 4 * i, gray + i, n - i);
+}
+#endif
+
+/* ---- dispatch ---- */
+
+struct pix_kernels {
+    const char *name;
+    void (*rgb_to_gray)(const uint8_t *, uint8_t *, size_t);
+    void (*rgba_to_gray)(const uint8_t *, uint8_t *, size_t);
+    void (*dither_ordered)(const uint8_t *, uint8_t *, size_t, unsigned);
+};
+
+static const struct pix_kernels variants[] = {
+#ifdef PIX_X86
+    { "avx2", rgb_to_gray_avx2, rgba_to_gray_avx2, dither_ordered_avx2 },
+    { "sse4.1", rgb_to_gray_sse41, rgba_to_gray_sse41, dither_ordered_sse41 },
+#endif
+#ifdef PIX_NEON
+    { "neon", rgb_to_gray_neon, rgba_to_gray_neon, dither_ordered_scalar },
+#endif
+    { "scalar", rgb_to_gray_scalar, rgba_to_gray_scalar, dither_ordered_scalar },
+};
+
+static const struct pix_kernels *kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static int cpu_has(const char *name) {
+#ifdef PIX_X86
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "sse4.1") == 0) return __builtin_cpu_supports("sse4.1");
+#endif
+    (void)name;
+    return 1;
+}
+
+static void pick_kernels(void) {
+#ifdef PIX_X86
+    __builtin_cpu_init();
+#endif
+    /* best first */
+    size_t i = 0;
+    while (!cpu_has(variants[i].name)) i++;
+    kernels = &variants[i];
+}
+
+static const struct pix_kernels *get_kernels(void) {
+    pthread_once(&kernels_once, pick_kernels);
+    return kernels;
+}
+
+void pix_rgb_to_gray(const uint8_t *rgb, uint8_t *gray, size_t n) {
+    get_kernels()->rgb_to_gray(rgb, gray, n);
+}
+
+void pix_rgba_to_gray(const uint8_t *rgba, uint8_t *gray, size_t n) {
+    get_kernels()->rgba_to_gray(rgba, gray, n);
+}
+
+void pix_dither_ordered(const uint8_t *gray, uint8_t *bits, size_t n, unsigned y) {
+    get_kernels()->dither_ordered(gray, bits, n, y);
+}
+
+const char *pix_kernel(void) {
+    return get_kernels()->name;
+}
+
+int pix_use(const char *name) {
+    get_kernels();
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+        if (strcmp(variants[i].name, name) == 0 && cpu_has(name)) {
+            kernels = &variants[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* ---- error diffusion ---- */
+
+int pix_fs_init(struct pix_fs *fs, size_t width) {
+    fs->width = width;
+    fs->cur = calloc(2 * (width + 2), sizeof(*fs->cur));
+    fs->next = fs->cur ? fs->cur + width + 2 : NULL;
+    return fs->cur ? 0 : -1;
+}
+
+/* 7/16 of each pixel's error goes right; 3/16, 5/16 and 1/16 go below */
+void pix_fs_row(struct pix_fs *fs, const uint8_t *gray, uint8_t *bits) {
+    int16_t *cur = fs->cur, *next = fs->next;
+    memset(bits, 0, (fs->width + 7) / 8);
+    memset(next, 0, (fs->width + 2) * sizeof(*next));
+
+    for (size_t x = 0; x < fs->width; x++) {
+        int v = gray[x] + cur[x + 1];
+        int err = v < 128 ? v : v - 255;
+        if (v < 128) bits[x / 8] |= (uint8_t)(0x80 >> (x & 7));
+        cur[x + 2] += (int16_t)(err * 7 / 16);
+        next[x] += (int16_t)(err * 3 / 16);
+        next[x + 1] += (int16_t)(err * 5 / 16);
+        next[x + 2] += (int16_t)(err / 16);
+    }
+    fs->cur = next;
+    fs->next = cur;
+}
+
+void pix_fs_free(struct pix_fs *fs) {
+    free(fs->cur < fs->next ? fs->cur : fs->next);
+    fs->cur = fs->next = NULL;
+}
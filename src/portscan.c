@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include "portscan.h"
+#include "net.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+static const int default_ports[] = { 9100, 631, 8611 };
+
+/* one outstanding connect() */
+struct probe {
+    int fd;
+    uint32_t addr;          /* network byte order */
+    int port;
+    double started;
+};
+
+void portscan_defaults(struct portscan_opts *o) {
+    if (!o->ports || o->nports <= 0) {
+        o->ports = default_ports;
+        o->nports = (int)(sizeof(default_ports) / sizeof(default_ports[0]));
+    }
+    if (o->concurrency <= 0) o->concurrency = 256;
+    if (o->timeout_ms <= 0) o->timeout_ms = 300;
+}
+
+static int by_rtt(const void *a, const void *b) {
+    const struct portscan_hit *x = a, *y = b;
+    return (x->rtt_ms > y->rtt_ms) - (x->rtt_ms < y->rtt_ms);
+}
+
+static int add_hit(struct portscan_hit **hits, int *n, int *cap,
+                   uint32_t addr, int port, double rtt) {
+    if (*n == *cap) {
+        int ncap = *cap ? *cap * 2 : 16;
+        struct portscan_hit *h = realloc(*hits, ncap * sizeof(**hits));
+        if (!h) return -1;
+        *hits = h;
+        *cap = ncap;
+    }
+    struct portscan_hit *h = &(*hits)[(*n)++];
+    struct in_addr a = { .s_addr = addr };
+    inet_ntop(AF_INET, &a, h->ip, sizeof(h->ip));
+    h->port = port;
+    h->rtt_ms = rtt;
+    return 0;
+}
+
+/* portscan_ranges:
+ *  nonblocking connect to every (host, port) pair of every range, keeping
+ *  at most o->concurrency probes in flight in one epoll set, so all
+ *  ranges are scanned in parallel. A probe that hasn't completed within
+ *  o->timeout_ms counts as closed. Once o->budget_ms has passed, probes
+ *  still out are dropped and the hits found so far returned.
+ */
+int portscan_ranges(const struct portscan_range *r, int nr, const struct portscan_opts *opts,
+                    struct portscan_hit **hits) {
+    struct portscan_opts o = opts ? *opts : (struct portscan_opts){ 0 };
+    portscan_defaults(&o);
+    *hits = NULL;
+
+    /* cursor over (range, host, port) */
+    int ri = 0, pi = 0;
+    uint32_t host = nr > 0 ? r[0].first : 0;
+    int nhits = 0, cap = 0, active = 0;
+    double deadline = o.budget_ms > 0 ? net_now_ms() + o.budget_ms : 0;
+
+    int ep = epoll_create1(0);
+    struct probe *pr = calloc(o.concurrency, sizeof(*pr));
+    if (ep < 0 || !pr) {
+        if (ep >= 0) close(ep);
+        free(pr);
+        return -1;
+    }
+    for (int i = 0; i < o.concurrency; i++) pr[i].fd = -1;
+
+    for (;;) {
+        if (deadline && net_now_ms() >= deadline) break;
+        /* refill the window; EMFILE just shrinks it until probes finish */
+        for (int i = 0; i < o.concurrency && ri < nr; i++) {
+            if (pr[i].fd >= 0) continue;
+            if (host < r[ri].first || host > r[ri].last) {
+                /* empty range */
+                if (++ri < nr) host = r[ri].first;
+                continue;
+            }
+            int port = o.ports[pi];
+            int fd = net_connect_nb(htonl(host), port);
+            if (fd < 0 && (errno == EMFILE || errno == ENFILE) && active > 0) break;
+            if (fd >= 0) {
+                struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = (uint32_t)i };
+                epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                pr[i] = (struct probe){ fd, htonl(host), port, net_now_ms() };
+                active++;
+            }
+            /* advance the cursor */
+            if (++pi == o.nports) {
+                pi = 0;
+                if (host == r[ri].last) {
+                    if (++ri < nr) host = r[ri].first;
+                } else {
+                    host++;
+                }
+            }
+        }
+        if (active == 0) {
+            if (ri >= nr) break;
+            continue;
+        }
+
+        double now = net_now_ms(), wait = o.timeout_ms;
+        for (int i = 0; i < o.concurrency; i++) {
+            if (pr[i].fd >= 0 && pr[i].started + o.timeout_ms - now < wait) {
+                wait = pr[i].started + o.timeout_ms - now;
+            }
+        }
+        if (deadline && deadline - now < wait) wait = deadline - now;
+        if (wait < 0) wait = 0;
+
+        struct epoll_event evs[128];
+        int ne = epoll_wait(ep, evs, 128, (int)wait + 1);
+        if (ne < 0 && errno != EINTR) break;
+
+        now = net_now_ms();
+        for (int k = 0; k < ne; k++) {
+            struct probe *p = &pr[evs[k].data.u32];
+            if (net_connect_result(p->fd) == 0) {
+                add_hit(hits, &nhits, &cap, p->addr, p->port, now - p->started);
+            }
+            close(p->fd);
+            p->fd = -1;
+            active--;
+        }
+        for (int i = 0; i < o.concurrency; i++) {
+            if (pr[i].fd >= 0 && now - pr[i].started >= o.timeout_ms) {
+                close(pr[i].fd);
+                pr[i].fd = -1;
+                active--;
+            }
+        }
+    }
+
+    for (int i = 0; i < o.concurrency; i++) {
+        if (pr[i].fd >= 0) close(pr[i].fd);
+    }
+    free(pr);
+    close(ep);
+    if (nhits > 1) qsort(*hits, nhits, sizeof(**hits), by_rtt);
+    return nhits;
+}
+
+int portscan_range(uint32_t first, uint32_t last, const struct portscan_opts *o,
+                   struct portscan_hit **hits) {
+    struct portscan_range r = { first, last };
+    return portscan_ranges(&r, 1, o, hits);
+}
+
+/* parse "a.b.c.d/n" into an inclusive host range (host byte order) */
+static int cidr_to_range(const char *cidr, uint32_t *first, uint32_t *last) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s", cidr);
+    char *slash = strchr(buf, '/');
+    int prefix = 32;
+    if (slash) {
+        *slash = '\0';
+        prefix = atoi(slash + 1);
+    }
+    uint32_t a;
+    if (prefix < 0 || prefix > 32 || net_parse_ipv4(buf, &a) != 0) return -1;
+
+    uint32_t mask = prefix ? 0xffffffffu << (32 - prefix) : 0;
+    uint32_t base = ntohl(a) & mask;
+    *first = base;
+    *last = base | ~mask;
+    if (prefix < 31) {
+        /* skip network and broadcast addresses */
+        (*first)++;
+        (*last)--;
+    }
+    return 0;
+}
+
+int portscan_cidr(const char *cidr, const struct portscan_opts *o,
+                  struct portscan_hit **hits) {
+    uint32_t first, last;
+    if (!cidr || cidr_to_range(cidr, &first, &last) != 0) {
+        fprintf(stderr, "Invalid subnet: %s\n", cidr ? cidr : "(null)");
+        return -1;
+    }
+    return portscan_range(first, last, o, hits);
+}
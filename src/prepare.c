@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include "prepare.h"
+#include "utils.h"
+#include "conv_cache.h"
+#include "imgps.h"
+#include "textps.h"
+#include "sniff.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the cheapest correct pipeline for each format: what the printer
+ * already speaks goes untouched (PREP_AS_IS is 0) */
+static const enum prep_route routes[DOC_NFORMATS] = {
+    [DOC_PDF] = PREP_PDF,
+    [DOC_JPEG] = PREP_ENCODE_IMAGE,
+    [DOC_PNG] = PREP_ENCODE_IMAGE,
+    [DOC_PNM] = PREP_ENCODE_IMAGE,
+    [DOC_WEBP] = PREP_ENCODE_IMAGE,
+    [DOC_GIF] = PREP_ENCODE_IMAGE,
+    [DOC_TIFF] = PREP_ENCODE_IMAGE,
+    [DOC_BMP] = PREP_ENCODE_IMAGE,
+    [DOC_TEXT] = PREP_TYPESET,
+};
+
+/* text with odd control characters still counts if it is named like text */
+static int is_text_name(const char *path) {
+    static const char *const ext[] = { ".txt", ".text", ".log", ".csv", ".md" };
+    for (size_t i = 0; i < sizeof(ext) / sizeof(ext[0]); i++) {
+        if (ends_with_ci(path, ext[i])) return 1;
+    }
+    return 0;
+}
+
+void prep_init(struct prep_job *j, enum prep_kind kind, const char *src, int color_mode) {
+    memset(j, 0, sizeof(*j));
+    j->kind = kind;
+    j->src = src;
+    j->color_mode = color_mode;
+    j->use_cache = 1;
+    j->fd = j->conv_fd = j->cache_fd = j->gen_in = j->gen_out = -1;
+    atomic_init(&j->cancel, 0);
+
+    if (kind == PREP_TEXT) {
+        j->format = DOC_TEXT;
+        j->route = PREP_TYPESET;
+        return;
+    }
+    j->format = sniff_file(src);
+    j->route = routes[j->format];
+    if (j->format == DOC_UNKNOWN && is_text_name(src)) j->route = PREP_TYPESET;
+    /* --image on something unrecognised (SVG is text): ImageMagick decides */
+    if (kind == PREP_IMAGE && (j->format == DOC_UNKNOWN || j->format == DOC_TEXT)) {
+        j->route = PREP_ENCODE_IMAGE;
+    }
+}
+
+/* conversion parameters that go into the cache key besides the input */
+static void cache_params(const struct prep_job *j, char *buf, size_t len) {
+    char tools[512];
+    int pdf = j->route == PREP_PDF;
+    conv_tool_ids(pdf ? "pdftops gs" : "magick convert", tools, sizeof(tools));
+    char pages[PAGES_MAX_RANGES * 24] = "";
+    if (j->pages) pages_format(j->pages, pages, sizeof(pages));
+    snprintf(buf, len, "%s:%d:%s:%s", pdf ? "pdf" : "img", j->color_mode, tools, pages);
+}
+
+/* PostScript cut down to the selected pages */
+static int ps_pages(const struct prep_job *j) {
+    return j->pages && j->pages->n && j->route == PREP_AS_IS && j->format == DOC_PS;
+}
+
+/* lprun's exit code when this job's conversion fails */
+static int fail_status(const struct prep_job *j) {
+    if (j->route == PREP_ENCODE_IMAGE) return 5;
+    return j->route == PREP_TYPESET ? 4 : 6;
+}
+
+/* copy the converter's output into the cache while passing it on:
+ * tee(2) duplicates the pipe contents into the sender's pipe, then
+ * splice(2) moves the same bytes into the cache file */
+static void *relay_thread(void *arg) {
+    struct prep_job *j = arg;
+    int out = j->relay_out;
+    int caching = 1;
+
+    /* a sender that gave up must show up as EPIPE here, not kill us */
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+    j->relay_ok = 0;
+    for (;;) {
+        ssize_t n = caching ? tee(j->conv_fd, out, CONV_PIPE_BYTES, 0)
+                            : splice(j->conv_fd, NULL, out, NULL, CONV_PIPE_BYTES, SPLICE_F_MOVE);
+        if (n == 0) {
+            j->relay_ok = caching;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (!caching) continue;
+
+        /* the teed bytes are still in the converter pipe: file them */
+        while (n > 0) {
+            ssize_t w = splice(j->conv_fd, NULL, j->cache_fd, NULL, n, SPLICE_F_MOVE);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                /* cache disk trouble: keep printing, stop caching */
+                char sink[65536];
+                ssize_t r = read(j->conv_fd, sink, n < (ssize_t)sizeof(sink) ? n : (ssize_t)sizeof(sink));
+                if (r <= 0) break;
+                n -= r;
+                caching = 0;
+                continue;
+            }
+            n -= w;
+        }
+    }
+    close(out);
+    return NULL;
+}
+
+/* typeset a text file, encode an image or cut PostScript down to the
+ * selected pages, into the pipe the sender reads */
+static void *gen_thread(void *arg) {
+    struct prep_job *j = arg;
+
+    /* a sender that gave up shows up as EPIPE */
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+    if (j->route == PREP_ENCODE_IMAGE) {
+        j->gen_ok = imgps_convert_fd(j->gen_in, j->gen_out, j->color_mode, &j->cancel) == 0;
+    } else if (ps_pages(j)) {
+        j->gen_ok = pages_extract_ps(j->gen_in, j->gen_out, j->pages, &j->cancel) >= 0;
+    } else {
+        const char *base = strrchr(j->src, '/');
+        struct textps_opts o = { .title = base ? base + 1 : j->src };
+        j->gen_ok = textps_convert_fd(j->gen_in, j->gen_out, &o, &j->cancel) == 0;
+    }
+    close(j->gen_out);
+    close(j->gen_in);
+    j->gen_out = j->gen_in = -1;
+    return NULL;
+}
+
+static int prep_stream_gen(struct prep_job *j) {
+    int fail = fail_status(j);
+    int p[2];
+    j->gen_in = open(j->src, O_RDONLY | O_CLOEXEC);
+    if (j->gen_in < 0 || pipe2(p, O_CLOEXEC) != 0) {
+        if (j->gen_in >= 0) close(j->gen_in);
+        j->gen_in = -1;
+        j->status = fail;
+        return j->status;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(p[1], F_SETPIPE_SZ, CONV_PIPE_BYTES);
+#endif
+    j->gen_out = p[1];
+    if (pthread_create(&j->gen, NULL, gen_thread, j) != 0) {
+        close(p[0]);
+        close(p[1]);
+        close(j->gen_in);
+        j->gen_in = j->gen_out = -1;
+        j->status = fail;
+        return j->status;
+    }
+    j->generating = 1;
+    j->fd = p[0];
+    return 0;
+}
+
+/* start a streaming conversion: j->fd is a pipe the sender reads while the
+ * converter is still running. With the cache on, a relay thread also
+ * files the output under j->key */
+static int prep_stream(struct prep_job *j, int cacheable) {
+    int fail = fail_status(j);
+    j->conv_fd = j->route == PREP_ENCODE_IMAGE ? stream_image_to_ps(j->src, j->color_mode, &j->pid)
+                                               : stream_pdf_to_ps(j->src, j->color_mode, j->pages,
+                                                                  &j->pid);
+    if (j->conv_fd < 0) {
+        j->status = fail;
+        return j->status;
+    }
+
+    int p[2];
+    if (cacheable && (j->cache_fd = conv_cache_begin(&j->cache_tmp)) >= 0 &&
+        pipe2(p, O_CLOEXEC) == 0) {
+#ifdef F_SETPIPE_SZ
+        fcntl(p[1], F_SETPIPE_SZ, CONV_PIPE_BYTES);
+#endif
+        j->relay_out = p[1];
+        if (pthread_create(&j->relay, NULL, relay_thread, j) == 0) {
+            j->relaying = 1;
+            j->fd = p[0];
+            return 0;
+        }
+        close(p[0]);
+        close(p[1]);
+    }
+
+    /* no cache copy: the sender reads the converter directly */
+    j->fd = j->conv_fd;
+    j->conv_fd = -1;
+    return 0;
+}
+
+int prep_finish(struct prep_job *j, int sent_ok) {
+    if (j->fd < 0 && !j->pid && !j->generating) return j->status;
+
+    /* an abandoned stream: kill the converter so the relay sees EOF */
+    int ok = 0;
+    if (!sent_ok && j->pid) {
+        atomic_store(&j->cancel, 1);
+        wait_converter(j->pid, &j->cancel);
+        j->pid = 0;
+    }
+    if (!sent_ok) atomic_store(&j->cancel, 1);
+    if (j->fd >= 0) close(j->fd);
+    j->fd = -1;
+    if (j->generating) {
+        /* the closed pipe stops the typesetter if it was still writing */
+        pthread_join(j->gen, NULL);
+        j->generating = 0;
+        if (!j->gen_ok && sent_ok) j->status = fail_status(j);
+        return j->status;
+    }
+    if (j->relaying) {
+        pthread_join(j->relay, NULL);
+        j->relaying = 0;
+    }
+    if (j->conv_fd >= 0) close(j->conv_fd);
+    j->conv_fd = -1;
+
+    if (j->pid) ok = wait_converter(j->pid, &j->cancel);
+    j->pid = 0;
+    if (j->cache_fd >= 0) {
+        close(j->cache_fd);
+        j->cache_fd = -1;
+        conv_cache_commit(j->key, j->cache_tmp, ok && j->relay_ok);
+        j->cache_tmp = NULL;
+    }
+    if (!ok && sent_ok) j->status = fail_status(j);
+    return j->status;
+}
+
+int prep_run(struct prep_job *j) {
+    j->out = NULL;
+    j->owns_out = 1;
+    j->cached = 0;
+    j->status = 0;
+
+    /* images and PDFs: reuse an earlier conversion of the same content */
+    /* images encoded in process take about as long as copying the
+     * cached result would */
+    char key[17];
+    int native_image = j->route == PREP_ENCODE_IMAGE && imgps_supported(j->src);
+    int cacheable = j->use_cache && ((j->route == PREP_ENCODE_IMAGE && !native_image) ||
+                                     j->route == PREP_PDF);
+    if (cacheable) {
+        char params[1400];
+        cache_params(j, params, sizeof(params));
+        cacheable = conv_cache_key(j->src, params, key) == 0;
+    }
+    if (cacheable) {
+        j->out = conv_cache_lookup(key);
+        conv_cache_count(j->out != NULL);
+        if (j->out) {
+            j->owns_out = 0;
+            j->cached = 1;
+            return 0;
+        }
+    }
+
+    int text_file = j->kind != PREP_TEXT && j->route == PREP_TYPESET;
+    if (j->stream && (text_file || native_image || ps_pages(j))) return prep_stream_gen(j);
+    if (j->stream && (j->route == PREP_ENCODE_IMAGE ||
+                      (j->route == PREP_PDF && pdf_streams(j->color_mode, j->pages)))) {
+        if (cacheable) memcpy(j->key, key, sizeof(j->key));
+        return prep_stream(j, cacheable);
+    }
+
+    if (j->kind == PREP_TEXT) {
+        j->out = create_temp_ps_from_text(j->src, j->color_mode, &j->cancel);
+        if (!j->out) j->status = 4;
+    } else if (j->route == PREP_ENCODE_IMAGE) {
+        j->out = convert_image_to_ps(j->src, j->color_mode, &j->cancel);
+        if (!j->out) j->status = 5;
+    } else if (text_file) {
+        j->out = convert_text_to_ps(j->src, &j->cancel);
+        if (!j->out) j->status = 4;
+    } else if (j->route == PREP_PDF) {
+        j->out = convert_pdf_to_ps(j->src, j->color_mode, j->pages, &j->cancel);
+        if (!j->out) j->status = 6;
+    } else if (ps_pages(j)) {
+        j->out = convert_ps_pages(j->src, j->pages, &j->cancel);
+        if (!j->out) j->status = 6;
+    } else {
+        j->out = strdup(j->src);
+        j->owns_out = 0;
+    }
+
+    if (cacheable && j->status == 0 && !atomic_load(&j->cancel)) conv_cache_store(key, j->out);
+
+    /* cancelled while finishing: nobody wants the result */
+    if (atomic_load(&j->cancel)) prep_release(j);
+    return j->status;
+}
+
+static void *prep_thread(void *arg) {
+    prep_run(arg);
+    return NULL;
+}
+
+int prep_start(struct prep_job *j) {
+    if (pthread_create(&j->tid, NULL, prep_thread, j) != 0) {
+        /* no thread: do it now */
+        return prep_run(j);
+    }
+    j->running = 1;
+    return 0;
+}
+
+int prep_wait(struct prep_job *j) {
+    if (j->running) {
+        pthread_join(j->tid, NULL);
+        j->running = 0;
+    }
+    return j->status;
+}
+
+void prep_cancel(struct prep_job *j) {
+    atomic_store(&j->cancel, 1);
+    prep_wait(j);
+}
+
+/* only a whole PDF is worth sending untouched; a raw printer can't be
+ * asked for grayscale, so that still needs the converter (CUPS applies it
+ * itself) */
+int prep_native_candidate(const struct prep_job *j, int is_cups) {
+    return j->route == PREP_PDF && (is_cups || j->color_mode != 2) &&
+           (!j->pages || j->pages->n == 0);
+}
+
+int prep_native_ok(const struct prep_job *j, const char *pdl, int is_cups) {
+    return prep_native_candidate(j, is_cups) && pdl && strcasestr(pdl, "application/pdf") != NULL;
+}
+
+void prep_use_original(struct prep_job *j) {
+    prep_release(j);
+    j->out = strdup(j->src);
+    j->owns_out = 0;
+    j->status = j->out ? 0 : 6;
+}
+
+void prep_release(struct prep_job *j) {
+    if (j->fd >= 0 || j->pid || j->generating) prep_finish(j, 0);
+    if (j->out && j->owns_out) unlink(j->out);
+    free(j->out);
+    j->out = NULL;
+    j->owns_out = 0;
+}
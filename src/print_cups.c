@@ -1,12 +1,104 @@
 #define _POSIX_C_SOURCE 200809L
 #include "print_cups.h"
 #include <cups/cups.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* document bytes per IPP write */
+#define CUPS_WRITE_CHUNK 65536
+
+/* job options for the copy count and color mode; returns the option count */
+static int job_options(const struct cups_job_opts *o, cups_option_t **options) {
+    int n = 0;
+    *options = NULL;
+
+    if (o->copies > 1) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", o->copies);
+        n = cupsAddOption(CUPS_COPIES, buf, n, options);
+    }
+    if (o->color_mode == 1) {
+        n = cupsAddOption("ColorModel", "RGB", n, options);
+        n = cupsAddOption("ColorSpace", "sRGB", n, options);
+    } else if (o->color_mode == 2) {
+        n = cupsAddOption("ColorModel", "Gray", n, options);
+        n = cupsAddOption("ColorSpace", "Gray", n, options);
+    }
+    /* auto mode: no color options, let the printer decide */
+    return n;
+}
+
+/* cups_submit_fd:
+ *  one job carrying the copy count, with the document streamed from fd
+ *  through cupsStartDocument/cupsWriteRequestData as it is read. Works for
+ *  pipes, so a converter's output never needs a temp file, and the server
+ *  spools the document once however many copies are printed.
+ *  returns the job id (>0), or <=0 on failure (job cancelled)
+ */
+int cups_submit_fd(const char *printer_name, int fd, const struct cups_job_opts *opts) {
+    struct cups_job_opts o = opts ? *opts : (struct cups_job_opts){ .copies = 1 };
+    const char *title = o.title ? o.title : "lprun-job";
+    if (!printer_name || fd < 0) return -1;
+
+    cups_option_t *options;
+    int num_options = job_options(&o, &options);
+    int job = cupsCreateJob(CUPS_HTTP_DEFAULT, printer_name, title, num_options, options);
+    cupsFreeOptions(num_options, options);
+    if (job <= 0) {
+        fprintf(stderr, "CUPS job creation failed: %s\n", cupsLastErrorString());
+        return -1;
+    }
+
+    /* CUPS_FORMAT_AUTO: the scheduler types the data itself */
+    if (cupsStartDocument(CUPS_HTTP_DEFAULT, printer_name, job, title,
+                          CUPS_FORMAT_AUTO, 1) != HTTP_STATUS_CONTINUE) {
+        fprintf(stderr, "CUPS document start failed: %s\n", cupsLastErrorString());
+        cupsCancelJob2(CUPS_HTTP_DEFAULT, printer_name, job, 0);
+        return -2;
+    }
+
+    char *buf = malloc(CUPS_WRITE_CHUNK);
+    int rc = buf ? 0 : -3;
+    while (rc == 0) {
+        ssize_t n = read(fd, buf, CUPS_WRITE_CHUNK);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            rc = -3;
+        } else if (cupsWriteRequestData(CUPS_HTTP_DEFAULT, buf, (size_t)n) != HTTP_STATUS_CONTINUE) {
+            fprintf(stderr, "CUPS write failed: %s\n", cupsLastErrorString());
+            rc = -4;
+        }
+    }
+    free(buf);
+
+    /* always close the request so the connection is reusable */
+    if (cupsFinishDocument(CUPS_HTTP_DEFAULT, printer_name) != IPP_STATUS_OK && rc == 0) {
+        fprintf(stderr, "CUPS submission failed: %s\n", cupsLastErrorString());
+        rc = -5;
+    }
+    if (rc != 0) {
+        cupsCancelJob2(CUPS_HTTP_DEFAULT, printer_name, job, 0);
+        return rc;
+    }
+    return job;
+}
 
 /* Submit a file to CUPS; returns job id (>0) or <=0 on failure */
-int cups_print_file(const char *printer_name, const char *filename) {
+int cups_print_file(const char *printer_name, const char *filename,
+                    const struct cups_job_opts *opts) {
     if (!printer_name || !filename) return -1;
-    int job_id = cupsPrintFile(printer_name, filename, "myprinter-job", 0, NULL);
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    int job_id = cups_submit_fd(printer_name, fd, opts);
+    close(fd);
     return job_id;
 }
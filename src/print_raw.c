@@ -1,13 +1,22 @@
+#define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include "print_raw.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+/* bytes handed to the kernel per sendfile/splice call; also the progress granularity */
+#define XMIT_CHUNK (1 << 20)
 
 /* progress bar helper */
 static void progress_bar(double progress) {
@@ -24,64 +33,382 @@ static void progress_bar(double progress) {
     fflush(stdout);
 }
 
-int send_file_raw(const char *ip, int port, const char *filename, int copies) {
-    if (!ip || !filename) return -1;
+static void xfer_progress(const struct raw_xfer *x) {
+    if (x->quiet) return;
+    if (x->total > 0) {
+        progress_bar((double)x->sent / (double)x->total);
+    } else {
+        printf("\r%lld bytes sent", x->sent);
+        fflush(stdout);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    for (int c = 0; c < copies; ++c) {
+/* errors meaning "this fd pair can't use that syscall", not a real I/O failure */
+static int unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
 
-        int sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (sock < 0) { perror("socket"); return -2; }
+/* classic read()+send() loop; works for every kind of fd */
+static int xmit_buffered(int sock, int fd, struct raw_xfer *x) {
+    char buf[65536];
+    ssize_t n;
 
-        struct sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(port);
-        if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0) {
-            fprintf(stderr, "Invalid IP: %s\n", ip);
-            close(sock);
-            return -3;
+    x->method = "buffered";
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            return -1;
         }
+        ssize_t off = 0;
+        while (off < n) {
+            ssize_t s = send(sock, buf + off, n - off, MSG_NOSIGNAL);
+            if (s < 0) {
+                if (errno == EINTR) continue;
+                perror("send");
+                return -1;
+            }
+            off += s;
+            x->sent += s;
+        }
+        xfer_progress(x);
+    }
+    return 0;
+}
 
-        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            perror("connect");
-            close(sock);
-            return -4;
+#ifdef __linux__
+/* regular files: the kernel copies page cache straight into the socket.
+ * returns 1 if sendfile isn't usable here and nothing was sent yet */
+static int xmit_sendfile(int sock, int fd, struct raw_xfer *x) {
+    x->method = "sendfile";
+    for (;;) {
+        ssize_t s = sendfile(sock, fd, NULL, XMIT_CHUNK);
+        if (s == 0) return 0;
+        if (s < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            if (x->sent == 0 && unsupported(errno)) return 1;
+            perror("sendfile");
+            return -1;
         }
+        x->sent += s;
+        xfer_progress(x);
+    }
+}
 
-        FILE *f = fopen(filename, "rb");
-        if (!f) { perror("fopen"); close(sock); return -5; }
+/* pipes (and stdin): move pages between pipe buffers and the socket.
+ * A pipe source is spliced directly; anything else goes through a
+ * private pipe. returns 1 if splice isn't usable and nothing was sent */
+static int xmit_splice(int sock, int fd, int fd_is_pipe, struct raw_xfer *x) {
+    int p[2] = { -1, -1 };
+    int rc = 0;
 
-        /* get file size */
-        fseek(f, 0, SEEK_END);
-        long total = ftell(f);
-        fseek(f, 0, SEEK_SET);
+    x->method = "splice";
+    if (!fd_is_pipe && pipe2(p, O_CLOEXEC) != 0) return 1;
 
-        long sent_total = 0;
-        char buf[8192];
-        size_t n;
+    for (;;) {
+        ssize_t in;
+        if (fd_is_pipe) {
+            in = splice(fd, NULL, sock, NULL, XMIT_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else {
+            in = splice(fd, NULL, p[1], NULL, XMIT_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        }
+        if (in == 0) break;
+        if (in < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            rc = (x->sent == 0 && unsupported(errno)) ? 1 : -1;
+            if (rc < 0) perror("splice");
+            break;
+        }
+        if (!fd_is_pipe) {
+            /* drain what we just moved into the pipe */
+            ssize_t left = in;
+            while (left > 0) {
+                ssize_t out = splice(p[0], NULL, sock, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (out < 0) {
+                    if (errno == EINTR || errno == EAGAIN) continue;
+                    perror("splice");
+                    rc = -1;
+                    goto done;
+                }
+                left -= out;
+            }
+        }
+        x->sent += in;
+        xfer_progress(x);
+    }
+done:
+    if (p[0] >= 0) { close(p[0]); close(p[1]); }
+    return rc;
+}
+#endif
 
-        printf("Sending copy %d/%d...\n", c+1, copies);
+/* raw_transmit_fd:
+ *  send everything readable from fd to sock, picking the cheapest path:
+ *  sendfile for regular files, splice for pipes/stdin, buffered otherwise.
+ *  x->total should be the expected size (or -1); x->sent, x->seconds and
+ *  x->method are filled in. returns 0 on success, -1 on I/O error.
+ */
+int raw_transmit_fd(int sock, int fd, struct raw_xfer *x) {
+    double t0 = now_sec();
+    int rc = 1;
 
-        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
-            ssize_t sent = 0;
-            while (sent < (ssize_t)n) {
-                ssize_t s = send(sock, buf + sent, n - sent, 0);
-                if (s < 0) { perror("send"); fclose(f); close(sock); return -6; }
-                sent += s;
-                sent_total += s;
+    x->sent = 0;
+#ifdef __linux__
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        if (S_ISREG(st.st_mode)) {
+            rc = xmit_sendfile(sock, fd, x);
+        }
+        if (rc == 1) {
+            rc = xmit_splice(sock, fd, S_ISFIFO(st.st_mode), x);
+        }
+    }
+#endif
+    if (rc == 1) rc = xmit_buffered(sock, fd, x);
 
-                /* Update progress bar */
-                progress_bar((double)sent_total / (double)total);
-            }
+    x->seconds = now_sec() - t0;
+    return rc;
+}
+
+void raw_print_summary(const struct raw_xfer *x) {
+    double mbps = x->seconds > 0 ? (x->sent / 1e6) / x->seconds : 0.0;
+    printf("Sent %lld bytes in %.3f s (%.2f MB/s, %s)\n",
+           x->sent, x->seconds, mbps, x->method ? x->method : "none");
+}
+
+/* open the document; "-" means stdin. *total is -1 when the size is unknown */
+static int open_source(const char *filename, long long *total) {
+    int fd;
+    struct stat st;
+
+    if (strcmp(filename, "-") == 0) fd = STDIN_FILENO;
+    else fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { perror("open"); return -1; }
+
+    *total = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? (long long)st.st_size : -1;
+    return fd;
+}
+
+/* read up to len leading bytes; for pipes this consumes them, so they
+ * must be sent ahead of whatever raw_transmit_fd moves afterwards */
+static ssize_t read_head(int fd, char *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        got += n;
+    }
+    return (ssize_t)got;
+}
+
+static int send_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t s = send(sock, buf, len, MSG_NOSIGNAL);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            perror("send");
+            return -1;
+        }
+        buf += s;
+        len -= s;
+    }
+    return 0;
+}
+
+#define PJL_UEL "\033%-12345X"
+
+/* raw_frame_build:
+ *  work out how to make the printer produce `copies` collated copies from
+ *  a single transmission of the document whose first bytes are `head`.
+ *  PostScript gets a setpagedevice prolog after its DSC header, everything
+ *  else a PJL QTY header. Only one of the two is used so the counts never
+ *  multiply. Sets f->resend when the document can't carry a copy count
+ *  (it already is a PJL job, or mode is RAW_COPIES_RESEND).
+ */
+void raw_frame_build(struct raw_frame *f, const char *head, size_t head_len,
+                     int copies, enum raw_copy_mode mode) {
+    int is_ps = head_len >= 2 && memcmp(head, "%!", 2) == 0;
+    int is_pcl = head_len >= 2 && memcmp(head, "\033E", 2) == 0;
+    int is_pjl = head_len >= 9 && memcmp(head, PJL_UEL, 9) == 0;
+
+    memset(f, 0, sizeof(*f));
+    if (copies <= 1) return;
+
+    if (mode == RAW_COPIES_AUTO) {
+        if (is_pjl) mode = RAW_COPIES_RESEND;
+        else mode = is_ps ? RAW_COPIES_PS : RAW_COPIES_PJL;
+    }
+    if (mode == RAW_COPIES_PS && !is_ps) {
+        fprintf(stderr, "Document is not PostScript; using PJL copy count\n");
+        mode = RAW_COPIES_PJL;
+    }
+
+    if (mode == RAW_COPIES_RESEND) {
+        f->resend = 1;
+    } else if (mode == RAW_COPIES_PS) {
+        /* insert after the DSC header, as the gray prolog is, so the
+         * comments stay together and %! stays first; without one (or
+         * past the sniffed head) after the first line */
+        const char *end = memmem(head, head_len, "%%EndComments", 13);
+        const char *nl = end ? memchr(end, '\n', head_len - (size_t)(end - head)) : NULL;
+        if (!nl) nl = memchr(head, '\n', head_len);
+        f->split = nl ? (size_t)(nl - head) + 1 : 0;
+        if (!nl) {
+            /* header line longer than the sniffed head: prolog goes first */
+            f->prolog_len = (size_t)snprintf(f->prolog, sizeof(f->prolog), "%%!PS\n");
         }
+        f->prolog_len += (size_t)snprintf(f->prolog + f->prolog_len,
+                                          sizeof(f->prolog) - f->prolog_len,
+                                          "{ << /NumCopies %d /Collate true >> setpagedevice } stopped pop\n",
+                                          copies);
+    } else {
+        f->pjl_len = (size_t)snprintf(f->pjl, sizeof(f->pjl),
+                                      "%s@PJL JOB NAME=\"lprun\"\r\n"
+                                      "@PJL SET QTY=%d\r\n"
+                                      "%s",
+                                      PJL_UEL, copies,
+                                      is_ps ? "@PJL ENTER LANGUAGE=POSTSCRIPT\r\n" :
+                                      is_pcl ? "@PJL ENTER LANGUAGE=PCL\r\n" : "");
+        f->post_len = (size_t)snprintf(f->post, sizeof(f->post),
+                                       "%s@PJL EOJ NAME=\"lprun\"\r\n%s", PJL_UEL, PJL_UEL);
+    }
+}
 
-        printf("\nCopy %d complete\n", c + 1);
+static int connect_printer(const struct sockaddr_in *addr) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) { perror("socket"); return -2; }
 
-        fclose(f);
+    if (connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        perror("connect");
         close(sock);
+        return -4;
+    }
+    return sock;
+}
+
+/* one connection: frame + head + rest of fd + trailer; accumulates into *x */
+static int send_framed(const struct sockaddr_in *addr, int fd, long long total,
+                       const char *head, size_t head_len, const struct raw_frame *f,
+                       struct raw_xfer *x) {
+    int sock = connect_printer(addr);
+    if (sock < 0) return sock;
+
+    struct raw_xfer cx = { .total = total > 0 ? total - (long long)head_len : -1, .quiet = x->quiet };
+    int rc = -6;
+
+    if (send_all(sock, f->pjl, f->pjl_len) != 0) goto out;
+    if (send_all(sock, head, f->split) != 0) goto out;
+    if (send_all(sock, f->prolog, f->prolog_len) != 0) goto out;
+    if (send_all(sock, head + f->split, head_len - f->split) != 0) goto out;
 
-        struct timespec ts = {0, 200000000};
-        nanosleep(&ts, NULL);
+    if (raw_transmit_fd(sock, fd, &cx) != 0) goto out;
+    cx.sent += head_len;
+    if (send_all(sock, f->post, f->post_len) != 0) goto out;
+
+    if (!x->quiet) {
+        printf("\n");
+        raw_print_summary(&cx);
     }
+    rc = 0;
+out:
+    x->sent += cx.sent;
+    x->seconds += cx.seconds;
+    x->method = cx.method;
+    close(sock);
+    return rc;
+}
 
-    return 0;
+/* raw_send_fd:
+ *  send the document open on fd (e.g. a converter's output pipe) as one
+ *  job, or one per copy when the printer can't be told the count. total
+ *  is its size, or -1 if unknown; an unknown size can't be resent, so
+ *  copies then go through PJL. Fills *x (set x->quiet to print nothing
+ *  but errors).
+ */
+int raw_send_fd(const char *ip, int port, int fd, long long total, int copies,
+                enum raw_copy_mode mode, struct raw_xfer *x) {
+    if (!ip || fd < 0) return -1;
+    x->sent = 0;
+    x->seconds = 0;
+    x->total = total;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid IP: %s\n", ip);
+        return -3;
+    }
+
+    char head[4096];
+    ssize_t head_len = read_head(fd, head, sizeof(head));
+    if (head_len < 0) {
+        perror("read");
+        return -5;
+    }
+
+    struct raw_frame f;
+    raw_frame_build(&f, head, (size_t)head_len, copies, mode);
+    if (f.resend && total < 0 && copies > 1) {
+        /* a pipe can only be read once: let the printer do the copies */
+        fprintf(stderr, "Input is not seekable; using PJL copy count instead of resending\n");
+        raw_frame_build(&f, head, (size_t)head_len, copies, RAW_COPIES_PJL);
+    }
+
+    int rc = 0;
+    if (!f.resend) {
+        if (!x->quiet) printf("Sending %d cop%s in one job...\n", copies, copies == 1 ? "y" : "ies");
+        rc = send_framed(&addr, fd, total, head, (size_t)head_len, &f, x);
+    } else {
+        /* fallback for printers that ignore copy commands: one connection per copy */
+        for (int c = 0; c < copies; ++c) {
+            if (c > 0 && lseek(fd, head_len, SEEK_SET) < 0) {
+                perror("lseek");
+                rc = -5;
+                break;
+            }
+
+            if (!x->quiet) printf("Sending copy %d/%d...\n", c+1, copies);
+            rc = send_framed(&addr, fd, total, head, (size_t)head_len, &f, x);
+            if (rc != 0) break;
+            if (!x->quiet) printf("Copy %d complete\n", c + 1);
+
+            if (c < copies - 1) {
+                struct timespec ts = {0, 200000000};
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    return rc;
+}
+
+int send_fd_raw(const char *ip, int port, int fd, long long total, int copies,
+                enum raw_copy_mode mode) {
+    struct raw_xfer x = { 0 };
+    return raw_send_fd(ip, port, fd, total, copies, mode, &x);
+}
+
+int send_file_raw(const char *ip, int port, const char *filename, int copies,
+                  enum raw_copy_mode mode) {
+    if (!ip || !filename) return -1;
+
+    long long total;
+    int fd = open_source(filename, &total);
+    if (fd < 0) return -5;
+
+    int rc = send_fd_raw(ip, port, fd, total, copies, mode);
+
+    if (fd != STDIN_FILENO) close(fd);
+    return rc;
 }
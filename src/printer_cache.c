@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include "printer_cache.h"
+#include "net.h"
+#include "utils.h"
+#include <cups/cups.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/* a handful of printers is plenty; the front entry is the one we use */
+#define PCACHE_MAX 16
+
+/* on-disk format, one printer per line, tab separated:
+ *   kind  name  port  found_at  used_at  color  duplex  pdl
+ * kind is "cups" or "ip"; the file is rewritten atomically on change,
+ * with writers serialised on an flock of "printers.lock" */
+
+static char *cache_path(const char *name) {
+    char *dir = get_cache_dir();
+    if (!dir) return NULL;
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s", dir, name);
+    free(dir);
+    return path;
+}
+
+static char *cache_file(void) {
+    return cache_path("printers");
+}
+
+/* held from load_all to save_all, so concurrent runs don't each rewrite
+ * the file from a copy the other is replacing. The data file is renamed
+ * over, so the lock lives in a file of its own. -1: go on unlocked */
+static int lock_cache(void) {
+    char *path = cache_path("printers.lock");
+    if (!path) return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd >= 0) flock(fd, LOCK_EX);
+    return fd;
+}
+
+static void unlock_cache(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static int load_all(struct pcache_entry *e, int max) {
+    char *path = cache_file();
+    if (!path) return 0;
+    FILE *f = fopen(path, "re");
+    free(path);
+    if (!f) return 0;
+
+    int n = 0;
+    char line[1024];
+    while (n < max && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *save = line;
+        char *fld[8] = { 0 };
+        for (int i = 0; i < 8; i++) fld[i] = strsep(&save, "\t");
+        if (!fld[6]) continue;      /* malformed */
+
+        struct pcache_entry *c = &e[n];
+        memset(c, 0, sizeof(*c));
+        c->p.is_cups = strcmp(fld[0], "cups") == 0;
+        snprintf(c->p.name, sizeof(c->p.name), "%s", fld[1]);
+        c->p.port = atoi(fld[2]);
+        c->found_at = atoll(fld[3]);
+        c->used_at = atoll(fld[4]);
+        c->p.color = atoi(fld[5]);
+        c->p.duplex = atoi(fld[6]);
+        snprintf(c->p.pdl, sizeof(c->p.pdl), "%s", fld[7] ? fld[7] : "");
+        if (c->p.name[0]) n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int save_all(const struct pcache_entry *e, int n) {
+    char *path = cache_file();
+    if (!path) return -1;
+    size_t len = strlen(path) + 8;
+    char *tmp = malloc(len);
+    if (!tmp) { free(path); return -1; }
+    snprintf(tmp, len, "%s.XXXXXX", path);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        free(tmp);
+        free(path);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%s\t%s\t%d\t%lld\t%lld\t%d\t%d\t%s\n",
+                e[i].p.is_cups ? "cups" : "ip", e[i].p.name, e[i].p.port,
+                e[i].found_at, e[i].used_at, e[i].p.color, e[i].p.duplex, e[i].p.pdl);
+    }
+    int rc = fclose(f) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    free(path);
+    return rc;
+}
+
+static int same(const struct disc_printer *a, const struct disc_printer *b) {
+    return a->is_cups == b->is_cups && strcmp(a->name, b->name) == 0;
+}
+
+int pcache_get(struct pcache_entry *e) {
+    struct pcache_entry all[PCACHE_MAX];
+    if (load_all(all, PCACHE_MAX) == 0) return -1;
+    *e = all[0];
+    return 0;
+}
+
+int pcache_put(const struct disc_printer *p) {
+    struct pcache_entry all[PCACHE_MAX + 1];
+    int lock = lock_cache();
+    int n = load_all(all + 1, PCACHE_MAX);
+
+    long long now = (long long)time(NULL);
+    all[0].p = *p;
+    all[0].found_at = now;
+    all[0].used_at = 0;
+
+    /* drop the old copy of this printer, keep the rest in order */
+    int out = 1;
+    for (int i = 1; i <= n; i++) {
+        if (same(&all[i].p, p)) {
+            all[0].used_at = all[i].used_at;
+            continue;
+        }
+        all[out++] = all[i];
+    }
+    int rc = save_all(all, out > PCACHE_MAX ? PCACHE_MAX : out);
+    unlock_cache(lock);
+    return rc;
+}
+
+void pcache_touch(const struct disc_printer *p) {
+    struct pcache_entry all[PCACHE_MAX];
+    int lock = lock_cache();
+    int n = load_all(all, PCACHE_MAX);
+    for (int i = 0; i < n; i++) {
+        if (!same(&all[i].p, p)) continue;
+        struct pcache_entry hit = all[i];
+        hit.used_at = (long long)time(NULL);
+        memmove(all + 1, all, i * sizeof(*all));
+        all[0] = hit;
+        save_all(all, n);
+        break;
+    }
+    unlock_cache(lock);
+}
+
+void pcache_invalidate(const struct disc_printer *p) {
+    struct pcache_entry all[PCACHE_MAX];
+    int lock = lock_cache();
+    int n = load_all(all, PCACHE_MAX), out = 0;
+    for (int i = 0; i < n; i++) {
+        if (!same(&all[i].p, p)) all[out++] = all[i];
+    }
+    if (out != n) save_all(all, out);
+    unlock_cache(lock);
+}
+
+int pcache_fresh(const struct pcache_entry *e) {
+    return (long long)time(NULL) - e->found_at < PCACHE_TTL;
+}
+
+int pcache_alive(const struct disc_printer *p, int timeout_ms) {
+    if (p->is_cups) {
+        cups_dest_t *d = cupsGetNamedDest(CUPS_HTTP_DEFAULT, p->name, NULL);
+        if (!d) return 0;
+        cupsFreeDests(1, d);
+        return 1;
+    }
+
+    uint32_t addr;
+    if (net_parse_ipv4(p->name, &addr) != 0) return 0;
+    int fd = net_connect_nb(addr, p->port ? p->port : 9100);
+    if (fd < 0) return 0;
+
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    int alive = poll(&pfd, 1, timeout_ms) == 1 && net_connect_result(fd) == 0;
+    close(fd);
+    return alive;
+}
@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include "raster.h"
+#include "exec.h"
+#include "pixel.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define RASTER_IO_BYTES 65536
+#define PWG_HEADER_BYTES 1796
+#define PWG_CSPACE_SGRAY 18
+#define PWG_CSPACE_SRGB 19
+
+/* ---- PackBits ---- */
+
+size_t raster_packbits(const uint8_t *in, size_t n, uint8_t *out) {
+    size_t i = 0, k = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 128 && in[i + run] == in[i]) run++;
+        if (run >= 2) {
+            out[k++] = (uint8_t)(257 - run);
+            out[k++] = in[i];
+            i += run;
+            continue;
+        }
+        /* literal up to the next run of three */
+        size_t start = i, len = 0;
+        while (i < n && len < 128) {
+            if (i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i++;
+            len++;
+        }
+        out[k++] = (uint8_t)(len - 1);
+        memcpy(out + k, in + start, len);
+        k += len;
+    }
+    return k;
+}
+
+/* ---- names ---- */
+
+static const char *const pdl_names[] = { "ps", "pwg", "pcl" };
+
+int raster_parse_pdl(const char *name, enum raster_pdl *pdl) {
+    for (int i = 0; i < 3; i++) {
+        if (strcasecmp(name, pdl_names[i]) == 0) {
+            *pdl = (enum raster_pdl)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *raster_pdl_name(enum raster_pdl pdl) {
+    return pdl_names[pdl];
+}
+
+enum raster_pdl raster_pick_pdl(const char *pdl) {
+    if (!pdl || !pdl[0] || strcasestr(pdl, "postscript") || strcasestr(pdl, "pdf")) {
+        return RASTER_PS;
+    }
+    if (strcasestr(pdl, "pwg-raster")) return RASTER_PWG;
+    if (strcasestr(pdl, "pcl")) return RASTER_PCL;
+    return RASTER_PS;
+}
+
+/* ---- buffered I/O ---- */
+
+struct rin {
+    int fd;
+    size_t pos, len;
+    uint8_t buf[RASTER_IO_BYTES];
+};
+
+struct rout {
+    int fd;
+    int err;
+    size_t len;
+    uint8_t buf[RASTER_IO_BYTES];
+};
+
+/* next byte, -1 at EOF or on errors */
+static int rin_byte(struct rin *r) {
+    if (r->pos == r->len) {
+        ssize_t n;
+        do n = read(r->fd, r->buf, sizeof(r->buf)); while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        r->pos = 0;
+        r->len = (size_t)n;
+    }
+    return r->buf[r->pos++];
+}
+
+static int rin_read(struct rin *r, uint8_t *dst, size_t n) {
+    while (n > 0) {
+        if (r->pos == r->len) {
+            int c = rin_byte(r);
+            if (c < 0) return -1;
+            *dst++ = (uint8_t)c;
+            n--;
+            continue;
+        }
+        size_t k = r->len - r->pos < n ? r->len - r->pos : n;
+        memcpy(dst, r->buf + r->pos, k);
+        r->pos += k;
+        dst += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static void rout_flush(struct rout *o) {
+    size_t off = 0;
+    while (!o->err && off < o->len) {
+        ssize_t w = write(o->fd, o->buf + off, o->len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) o->err = w < 0 ? errno : EIO;
+        else off += w;
+    }
+    o->len = 0;
+}
+
+static void rout_put(struct rout *o, const void *p, size_t n) {
+    if (o->len + n > sizeof(o->buf)) rout_flush(o);
+    if (n > sizeof(o->buf)) {
+        const uint8_t *s = p;
+        while (!o->err && n > 0) {
+            ssize_t w = write(o->fd, s, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) o->err = w < 0 ? errno : EIO;
+            else { s += w; n -= w; }
+        }
+        return;
+    }
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+}
+
+static void rout_printf(struct rout *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void rout_printf(struct rout *o, const char *fmt, ...) {
+    char s[64];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(s, sizeof(s), fmt, ap);
+    va_end(ap);
+    if (n > 0) rout_put(o, s, (size_t)n < sizeof(s) ? (size_t)n : sizeof(s) - 1);
+}
+
+/* ---- PNM pages ---- */
+
+struct page {
+    int width, height, comps;
+};
+
+/* a header field, skipping whitespace and # comments; -1 at EOF */
+static long pnm_field(struct rin *r) {
+    int c = rin_byte(r);
+    for (;;) {
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = rin_byte(r);
+        if (c != '#') break;
+        while (c >= 0 && c != '\n') c = rin_byte(r);
+    }
+    if (c < '0' || c > '9') return -1;
+    long v = 0;
+    while (c >= '0' && c <= '9' && v < 1000000) {
+        v = v * 10 + (c - '0');
+        c = rin_byte(r);
+    }
+    return v;       /* the whitespace after it is consumed */
+}
+
+/* 1 = a page header was read, 0 = clean end of input, -1 = bad input */
+static int next_page(struct rin *r, struct page *p) {
+    int c = rin_byte(r);
+    while (c == '\n' || c == '\r' || c == ' ') c = rin_byte(r);
+    if (c < 0) return 0;
+    int k = rin_byte(r);
+    if (c != 'P' || (k != '5' && k != '6')) return -1;
+    p->comps = k == '6' ? 3 : 1;
+    p->width = (int)pnm_field(r);
+    p->height = (int)pnm_field(r);
+    long maxval = pnm_field(r);
+    if (p->width <= 0 || p->height <= 0 || maxval != 255) return -1;
+    return 1;
+}
+
+/* ---- PWG Raster ---- */
+
+static void put_be32(uint8_t *h, size_t off, uint32_t v) {
+    h[off] = (uint8_t)(v >> 24);
+    h[off + 1] = (uint8_t)(v >> 16);
+    h[off + 2] = (uint8_t)(v >> 8);
+    h[off + 3] = (uint8_t)v;
+}
+
+/* PWG media name when the page is a common size */
+static const char *pwg_media_name(double w_pt, double h_pt) {
+    if (w_pt > 590 && w_pt < 600 && h_pt > 837 && h_pt < 847) return "iso_a4_210x297mm";
+    if (w_pt > 607 && w_pt < 617 && h_pt > 787 && h_pt < 797) return "na_letter_8.5x11in";
+    if (w_pt > 607 && w_pt < 617 && h_pt > 1003 && h_pt < 1013) return "na_legal_8.5x14in";
+    if (w_pt > 837 && w_pt < 847 && h_pt > 1186 && h_pt < 1196) return "iso_a3_297x420mm";
+    return "";
+}
+
+/* the 1796-byte page header (PWG 5102.4), big-endian */
+static void pwg_header(struct rout *o, const struct page *p, const struct raster_opts *ro) {
+    uint8_t h[PWG_HEADER_BYTES];
+    memset(h, 0, sizeof(h));
+    double w_pt = p->width * 72.0 / ro->dpi, h_pt = p->height * 72.0 / ro->dpi;
+
+    memcpy(h, "PwgRaster", 9);
+    put_be32(h, 276, (uint32_t)ro->dpi);                    /* HWResolution */
+    put_be32(h, 280, (uint32_t)ro->dpi);
+    put_be32(h, 340, (uint32_t)(ro->copies > 1 ? ro->copies : 1)); /* NumCopies */
+    put_be32(h, 352, (uint32_t)(w_pt + 0.5));               /* PageSize */
+    put_be32(h, 356, (uint32_t)(h_pt + 0.5));
+    put_be32(h, 372, (uint32_t)p->width);                   /* Width */
+    put_be32(h, 376, (uint32_t)p->height);                  /* Height */
+    put_be32(h, 384, 8);                                    /* BitsPerColor */
+    put_be32(h, 388, (uint32_t)(8 * p->comps));             /* BitsPerPixel */
+    put_be32(h, 392, (uint32_t)(p->width * p->comps));      /* BytesPerLine */
+    put_be32(h, 400, p->comps == 3 ? PWG_CSPACE_SRGB : PWG_CSPACE_SGRAY);
+    put_be32(h, 420, (uint32_t)p->comps);                   /* NumColors */
+    put_be32(h, 456, 1);                                    /* CrossFeedTransform */
+    put_be32(h, 460, 1);                                    /* FeedTransform */
+    put_be32(h, 472, (uint32_t)p->width);                   /* ImageBoxRight */
+    put_be32(h, 476, (uint32_t)p->height);                  /* ImageBoxBottom */
+    snprintf((char *)h + 1732, 64, "%s", pwg_media_name(w_pt, h_pt));
+    rout_put(o, h, sizeof(h));
+}
+
+/* one line in PWG's PackBits, counted in pixels of bpp bytes:
+ * 0..127 repeat the next pixel 1..128 times, 129..255 copy 128..2 */
+static size_t pwg_encode_row(const uint8_t *row, size_t w, size_t bpp, uint8_t *out) {
+    size_t i = 0, k = 0;
+    while (i < w) {
+        const uint8_t *px = row + i * bpp;
+        size_t run = 1;
+        while (i + run < w && run < 128 && memcmp(px, row + (i + run) * bpp, bpp) == 0) run++;
+        if (run > 1 || i + 1 == w) {
+            out[k++] = (uint8_t)(run - 1);
+            memcpy(out + k, px, bpp);
+            k += bpp;
+            i += run;
+            continue;
+        }
+        size_t start = i, len = 0;
+        while (i < w && len < 128) {
+            if (i + 1 < w && memcmp(row + i * bpp, row + (i + 1) * bpp, bpp) == 0) break;
+            i++;
+            len++;
+        }
+        out[k++] = len == 1 ? 0 : (uint8_t)(257 - len);
+        memcpy(out + k, row + start * bpp, len * bpp);
+        k += len * bpp;
+    }
+    return k;
+}
+
+static int pwg_page(struct rin *in, struct rout *o, const struct page *p,
+                    const struct raster_opts *ro, const atomic_int *cancel) {
+    size_t bpl = (size_t)p->width * p->comps;
+    uint8_t *cur = malloc(bpl), *prev = malloc(bpl);
+    uint8_t *enc = malloc(bpl + (size_t)p->width + 16);
+    int rc = cur && prev && enc ? 0 : -1;
+    int repeat = -1;            /* extra copies of prev waiting, -1 = none */
+
+    if (rc == 0) pwg_header(o, p, ro);
+    for (int y = 0; y < p->height && rc == 0; y++) {
+        if ((cancel && atomic_load(cancel)) || rin_read(in, cur, bpl) != 0) {
+            rc = -1;
+            break;
+        }
+        if (repeat >= 0 && repeat < 255 && memcmp(cur, prev, bpl) == 0) {
+            repeat++;
+            continue;
+        }
+        if (repeat >= 0) {
+            uint8_t r = (uint8_t)repeat;
+            rout_put(o, &r, 1);
+            rout_put(o, enc, pwg_encode_row(prev, p->width, p->comps, enc));
+        }
+        uint8_t *t = prev;
+        prev = cur;
+        cur = t;
+        repeat = 0;
+    }
+    if (rc == 0 && repeat >= 0) {
+        uint8_t r = (uint8_t)repeat;
+        rout_put(o, &r, 1);
+        rout_put(o, enc, pwg_encode_row(prev, p->width, p->comps, enc));
+    }
+    free(cur);
+    free(prev);
+    free(enc);
+    return rc == 0 && !o->err ? 0 : -1;
+}
+
+/* ---- PCL ---- */
+
+/* PCL page size code and the logical page's left offset (in 1/300 in,
+ * portrait), so the raster lands where it was rendered */
+static int pcl_page_size(double w_pt, double h_pt, int *left_300) {
+    *left_300 = 75;
+    if (w_pt > 590 && w_pt < 600 && h_pt > 837 && h_pt < 847) {
+        *left_300 = 71;
+        return 26;              /* A4 */
+    }
+    if (w_pt > 837 && w_pt < 847 && h_pt > 1186 && h_pt < 1196) {
+        *left_300 = 71;
+        return 27;              /* A3 */
+    }
+    if (h_pt > 1003 && h_pt < 1013) return 3;   /* Legal */
+    return 2;                   /* Letter */
+}
+
+static int pcl_page(struct rin *in, struct rout *o, const struct page *p,
+                    const struct raster_opts *ro, unsigned *row_no, const atomic_int *cancel) {
+    size_t bpl = (size_t)p->width * p->comps;
+    int left_300;
+    int size = pcl_page_size(p->width * 72.0 / ro->dpi, p->height * 72.0 / ro->dpi, &left_300);
+    size_t left = (size_t)left_300 * ro->dpi / 300;
+    if (left >= (size_t)p->width) left = 0;
+    size_t w = (size_t)p->width - left;
+    size_t bytes = (w + 7) / 8;
+
+    uint8_t *row = malloc(bpl), *bits = malloc(bytes), *enc = malloc(bytes + bytes / 128 + 2);
+    int rc = row && bits && enc ? 0 : -1;
+    long skip = 0;              /* blank rows not yet sent */
+
+    if (rc == 0) {
+        rout_printf(o, "\033&l%dA\033&l0O\033&l0E\033&l0L", size);
+        rout_printf(o, "\033*t%dR\033*r%zuS\033*p0x0Y\033*r1A\033*b2M", ro->dpi, w);
+    }
+    for (int y = 0; y < p->height && rc == 0; y++) {
+        if ((cancel && atomic_load(cancel)) || rin_read(in, row, bpl) != 0) {
+            rc = -1;
+            break;
+        }
+        if (p->comps == 3) pix_rgb_to_gray(row, row, p->width);
+        pix_dither_ordered(row + left, bits, w, (*row_no)++);
+
+        size_t n = bytes;
+        while (n > 0 && bits[n - 1] == 0) n--;      /* trailing white */
+        if (n == 0) {
+            skip++;
+            continue;
+        }
+        if (skip) {
+            rout_printf(o, "\033*b%ldY", skip);
+            skip = 0;
+        }
+        size_t k = raster_packbits(bits, n, enc);
+        rout_printf(o, "\033*b%zuW", k);
+        rout_put(o, enc, k);
+    }
+    if (rc == 0) rout_put(o, "\033*rC\f", 5);
+    free(row);
+    free(bits);
+    free(enc);
+    return rc == 0 && !o->err ? 0 : -1;
+}
+
+/* ---- driver ---- */
+
+/* raster_encode_fd:
+ *  one page at a time, a row at a time: memory is a few rows however
+ *  large the pages are.
+ */
+int raster_encode_fd(int in_fd, int out_fd, const struct raster_opts *ro,
+                     const atomic_int *cancel) {
+    struct rin *in = malloc(sizeof(*in));
+    struct rout *o = malloc(sizeof(*o));
+    struct raster_opts d = *ro;
+    int pages = -1;
+
+    if (d.dpi <= 0) d.dpi = RASTER_DEFAULT_DPI;
+    if (in && o) {
+        memset(in, 0, offsetof(struct rin, buf));
+        memset(o, 0, offsetof(struct rout, buf));
+        in->fd = in_fd;
+        o->fd = out_fd;
+        unsigned row_no = 0;
+        int rc = 0;
+
+        if (d.pdl == RASTER_PWG) rout_put(o, "RaS2", 4);
+        else rout_put(o, "\033E", 2);
+        for (pages = 0;; pages++) {
+            struct page p;
+            int r = next_page(in, &p);
+            if (r <= 0) {
+                rc = r;
+                break;
+            }
+            rc = d.pdl == RASTER_PWG ? pwg_page(in, o, &p, &d, cancel)
+                                     : pcl_page(in, o, &p, &d, &row_no, cancel);
+            if (rc != 0) break;
+        }
+        if (d.pdl == RASTER_PCL) rout_put(o, "\033E", 2);
+        rout_flush(o);
+        if (rc != 0 || o->err || pages == 0) pages = -1;
+    }
+    free(in);
+    free(o);
+    return pages;
+}
+
+static void *encode_thread(void *arg) {
+    struct raster_job *r = arg;
+
+    /* a sender that gave up shows up as EPIPE */
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+    r->pages = raster_encode_fd(r->gs_out, r->enc_out, &r->o, &r->cancel);
+    r->ok = r->pages > 0;
+    close(r->enc_out);
+    close(r->gs_out);       /* gs sees EPIPE if we stopped early */
+    r->enc_out = r->gs_out = -1;
+    return NULL;
+}
+
+/* raster_start:
+ *  gs renders into a pipe (gray unless PWG is to be in color), the
+ *  encoder thread turns that into r->fd. Input on a pipe must be
+ *  PostScript; PDF needs a path.
+ */
+int raster_start(struct raster_job *r, const char *path, int in_fd, const struct raster_opts *o) {
+    memset(r, 0, sizeof(*r));
+    r->o = *o;
+    if (r->o.dpi <= 0) r->o.dpi = RASTER_DEFAULT_DPI;
+    r->fd = r->gs_out = r->enc_out = -1;
+    atomic_init(&r->cancel, 0);
+
+    char res[32], paper[32];
+    double pw, ph;
+    default_paper_size(&pw, &ph);
+    snprintf(res, sizeof(res), "-r%d", r->o.dpi);
+    snprintf(paper, sizeof(paper), "-sPAPERSIZE=%s", pw < 600 ? "a4" : "letter");
+    int color = r->o.pdl == RASTER_PWG && r->o.color_mode != 2;
+
+    const char *av[] = {
+        "gs", "-q", "-dSAFER", "-dBATCH", "-dNOPAUSE", "-sstdout=%stderr",
+        color ? "-sDEVICE=ppmraw" : "-sDEVICE=pgmraw", res, paper,
+        "-sOutputFile=-", in_fd >= 0 ? "-" : path, NULL
+    };
+    r->gs_out = exec_spawn(av, in_fd >= 0 ? in_fd : EXEC_NULL, EXEC_PIPE, EXEC_INHERIT, &r->pid);
+    if (r->gs_out < 0) {
+        r->gs_out = -1;
+        return -1;
+    }
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) != 0) goto fail;
+#ifdef F_SETPIPE_SZ
+    fcntl(p[1], F_SETPIPE_SZ, CONV_PIPE_BYTES);
+#endif
+    r->enc_out = p[1];
+    if (pthread_create(&r->tid, NULL, encode_thread, r) != 0) {
+        close(p[0]);
+        close(p[1]);
+        r->enc_out = -1;
+        goto fail;
+    }
+    r->fd = p[0];
+    return 0;
+
+fail:
+    atomic_store(&r->cancel, 1);
+    close(r->gs_out);
+    r->gs_out = -1;
+    exec_wait(r->pid, 0, &r->cancel);
+    return -1;
+}
+
+int raster_finish(struct raster_job *r, int sent_ok) {
+    if (r->fd < 0) return -1;
+    if (!sent_ok) atomic_store(&r->cancel, 1);
+    /* a sender that stopped early leaves the encoder blocked on the pipe */
+    close(r->fd);
+    r->fd = -1;
+    pthread_join(r->tid, NULL);
+    int code = exec_wait(r->pid, 0, &r->cancel);
+    if (code != 0 && sent_ok) fprintf(stderr, "gs failed while rendering (status %d)\n", code);
+    return r->ok && code == 0 ? 0 : -1;
+}
@@ -9,7 +9,9 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>  // ADD THIS LINE
+#include <fcntl.h>
 #include "scanner.h"
+#include "exec.h"
 
 /* Create directory if missing */
 static int ensure_dir(const char *path)
@@ -27,15 +29,6 @@ static int ensure_dir(const char *path)
     return 0;
 }
 
-/* Execute command and show error if fails */
-static int run_cmd(const char *cmd)
-{
-    int rc = system(cmd);
-    if (rc != 0)
-        fprintf(stderr, "Scanner command failed: %s\n", cmd);
-    return rc;
-}
-
 /* Generates a timestamp file path */
 static void build_output_path(char *dest, size_t size,
                               const char *out_dir,
@@ -56,20 +49,17 @@ static void build_output_path(char *dest, size_t size,
              ext);
 }
 
-/* Atomic flag for stopping spinner */
-static atomic_bool scanning_stop = false;
-
-/* Spinner thread function */
+/* Spinner thread function; arg is the caller's stop flag */
 static void* spinner_thread_func(void* arg) 
 {
-    (void)arg;  // Mark parameter as unused to avoid warning
+    atomic_bool *scanning_stop = arg;
     const char spin_chars[] = "|/-\\";
     int spin_index = 0;
     
     printf("Scanning... ");
     fflush(stdout);
     
-    while (!atomic_load(&scanning_stop)) {
+    while (!atomic_load(scanning_stop)) {
         printf("\b%c", spin_chars[spin_index]);
         fflush(stdout);
         spin_index = (spin_index + 1) % 4;
@@ -109,15 +99,21 @@ int scanner_scan_pdf(const char *out_dir, const char *filename)
 
     // Start spinner thread
     pthread_t spinner_tid;
-    atomic_store(&scanning_stop, false);  // Reset flag
-    pthread_create(&spinner_tid, NULL, spinner_thread_func, NULL);
+    atomic_bool scanning_stop = false;
+    pthread_create(&spinner_tid, NULL, spinner_thread_func, &scanning_stop);
     
-    // Run scan command
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd),
-             "scanimage --format=pnm 2>/dev/null | convert - \"%s\" 2>/dev/null", file);
-    
-    int rc = system(cmd);
+    // Run scan command: scanimage piped straight into convert
+    const char *scan[] = { "scanimage", "--format=pnm", NULL };
+    const char *conv[] = { "convert", "-", file, NULL };
+    pid_t scan_pid;
+    int rc = -1;
+    int fd = exec_spawn(scan, EXEC_NULL, EXEC_PIPE, EXEC_NULL, &scan_pid);
+    if (fd >= 0) {
+        rc = exec_run(conv, fd, EXEC_NULL, EXEC_SCAN_TIMEOUT_MS, NULL);
+        close(fd);
+        int scan_rc = exec_wait(scan_pid, EXEC_SCAN_TIMEOUT_MS, NULL);
+        if (rc == 0) rc = scan_rc;
+    }
     
     // Stop spinner thread
     atomic_store(&scanning_stop, true);
@@ -163,15 +159,17 @@ int scanner_scan_img(const char *out_dir, const char *filename)
 
     // Start spinner thread
     pthread_t spinner_tid;
-    atomic_store(&scanning_stop, false);  // Reset flag
-    pthread_create(&spinner_tid, NULL, spinner_thread_func, NULL);
+    atomic_bool scanning_stop = false;
+    pthread_create(&spinner_tid, NULL, spinner_thread_func, &scanning_stop);
     
     // Run scan command
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd),
-             "scanimage --format=png > \"%s\" 2>/dev/null", file);
-    
-    int rc = system(cmd);
+    const char *scan[] = { "scanimage", "--format=png", NULL };
+    int rc = -1;
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        rc = exec_run(scan, EXEC_NULL, fd, EXEC_SCAN_TIMEOUT_MS, NULL);
+        close(fd);
+    }
     
     // Stop spinner thread
     atomic_store(&scanning_stop, true);
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "sniff.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* a PDF reader accepts the header anywhere in the first kilobyte */
+#define PDF_HEADER_WINDOW 1024
+
+static const char *const names[DOC_NFORMATS] = {
+    [DOC_UNKNOWN] = "unknown",
+    [DOC_PDF] = "PDF",
+    [DOC_PS] = "PostScript",
+    [DOC_PJL] = "PJL job",
+    [DOC_PCL] = "PCL",
+    [DOC_PCLXL] = "PCL XL",
+    [DOC_PWG] = "PWG raster",
+    [DOC_URF] = "Apple raster",
+    [DOC_JPEG] = "JPEG image",
+    [DOC_PNG] = "PNG image",
+    [DOC_PNM] = "PNM image",
+    [DOC_WEBP] = "WebP image",
+    [DOC_GIF] = "GIF image",
+    [DOC_TIFF] = "TIFF image",
+    [DOC_BMP] = "BMP image",
+    [DOC_TEXT] = "text",
+};
+
+const char *sniff_name(enum doc_format f) {
+    return f >= 0 && f < DOC_NFORMATS ? names[f] : names[DOC_UNKNOWN];
+}
+
+static int starts(const uint8_t *p, size_t n, const char *magic, size_t len) {
+    return n >= len && memcmp(p, magic, len) == 0;
+}
+
+/* no NULs and (almost) no control characters besides the usual layout
+ * ones; any 8-bit encoding passes */
+static int looks_like_text(const uint8_t *p, size_t n) {
+    size_t ctl = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t c = p[i];
+        if (c == 0) return 0;
+        if ((c < 0x20 && !strchr("\t\n\r\f\b\033", c)) || c == 0x7f) ctl++;
+    }
+    return n > 0 && ctl * 100 <= n;
+}
+
+enum doc_format sniff_buf(const void *buf, size_t n) {
+    const uint8_t *p = buf;
+
+    /* printer job languages: fixed prefixes */
+    if (starts(p, n, "\033%-12345X", 9) || starts(p, n, "@PJL", 4)) return DOC_PJL;
+    if (starts(p, n, ") HP-PCL XL;", 12)) return DOC_PCLXL;
+    if (n >= 2 && p[0] == 0x1b && memchr("E&*()", p[1], 5)) return DOC_PCL;
+    if (starts(p, n, "%!", 2) || starts(p, n, "\004%!", 3)) return DOC_PS;
+    if (starts(p, n, "RaS2", 4)) return DOC_PWG;
+    if (starts(p, n, "UNIRAST", 8)) return DOC_URF;
+
+    /* images */
+    if (starts(p, n, "\xff\xd8\xff", 3)) return DOC_JPEG;
+    if (starts(p, n, "\x89PNG\r\n\032\n", 8)) return DOC_PNG;
+    if (starts(p, n, "RIFF", 4) && n >= 12 && memcmp(p + 8, "WEBP", 4) == 0) return DOC_WEBP;
+    if (starts(p, n, "GIF87a", 6) || starts(p, n, "GIF89a", 6)) return DOC_GIF;
+    if (starts(p, n, "II*\0", 4) || starts(p, n, "MM\0*", 4)) return DOC_TIFF;
+    if (starts(p, n, "BM", 2) && n >= 14 && memcmp(p + 6, "\0\0\0\0", 4) == 0) return DOC_BMP;
+    if (n >= 3 && p[0] == 'P' && p[1] >= '1' && p[1] <= '6' && strchr(" \t\r\n", p[2]) && p[2]) {
+        return DOC_PNM;
+    }
+
+    /* the header starts a line; text that merely mentions it stays text */
+    size_t win = n < PDF_HEADER_WINDOW ? n : PDF_HEADER_WINDOW;
+    for (const uint8_t *h = p; win >= 5 && (h = memmem(h, win - (h - p), "%PDF-", 5)) != NULL;
+         h++) {
+        if (h == p || h[-1] == '\n' || h[-1] == '\r') return DOC_PDF;
+    }
+
+    return looks_like_text(p, n) ? DOC_TEXT : DOC_UNKNOWN;
+}
+
+enum doc_format sniff_file(const char *path) {
+    if (strcmp(path, "-") == 0) return DOC_UNKNOWN;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return DOC_UNKNOWN;
+
+    uint8_t buf[SNIFF_BYTES];
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+        ssize_t r = read(fd, buf + got, sizeof(buf) - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    close(fd);
+    return sniff_buf(buf, got);
+}
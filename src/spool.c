@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include "spool.h"
+#include "lprun.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* a job id the daemon handed out; ids index slots[] modulo SPOOL_MAX_JOBS */
+struct spool_slot {
+    int id;
+    int reserved;           /* id handed out, submit still under way */
+    lprun_job *job;
+};
+
+struct client;
+
+struct spool {
+    pthread_mutex_t lock;
+    struct spool_slot slots[SPOOL_MAX_JOBS];
+    int next_id;
+    struct batch_opts o;
+    lprun_ctx *ctx;
+    struct client *clients;         /* connected, each on its own thread */
+    pthread_cond_t gone;            /* a client disconnected */
+};
+
+char *spool_socket_path(void) {
+    const char *run = getenv("XDG_RUNTIME_DIR");
+    char *dir = run && run[0] == '/' ? strdup(run) : get_cache_dir();
+    if (!dir) return NULL;
+    size_t len = strlen(dir) + sizeof("/lprun.sock");
+    char *path = malloc(len);
+    if (path) snprintf(path, len, "%s/lprun.sock", dir);
+    free(dir);
+    return path;
+}
+
+static int socket_addr(const char *path, struct sockaddr_un *a) {
+    memset(a, 0, sizeof(*a));
+    a->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(a->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(a->sun_path, path);
+    return 0;
+}
+
+/* log each finished job; runs on the printer's sender thread */
+static void job_done(lprun_job *job, void *user) {
+    int id = (int)(intptr_t)user;
+    struct lprun_job_info ji;
+    lprun_job_info(job, &ji);
+    struct lprun_job_info *j = &ji;
+    if (j->status == 0) {
+        printf("job %d: %s -> %s: ok (convert %.0f ms, send %.0f ms)\n", id, j->file,
+               j->printer, j->conv_ms, j->send_ms);
+    } else {
+        printf("job %d: %s -> %s: %s\n", id, j->file, j->printer, j->error);
+    }
+    fflush(stdout);
+}
+
+static int slot_busy(const struct spool_slot *slot) {
+    if (slot->reserved) return 1;
+    if (!slot->job) return 0;
+    struct lprun_job_info ji;
+    lprun_job_info(slot->job, &ji);
+    return ji.state != LPRUN_DONE && ji.state != LPRUN_FAILED;
+}
+
+static void submit(struct spool *s, const char *line, char *reply, size_t len) {
+    struct batch_job j;
+    int r = batch_parse_line(line, 0, &s->o, &j);
+    if (r <= 0) {
+        snprintf(reply, len, "ERR %s", r < 0 ? j.error : "empty job");
+        return;
+    }
+    if (j.file[0] != '/') {
+        snprintf(reply, len, "ERR file path must be absolute");
+        return;
+    }
+    struct lprun_job_spec spec = {
+        .file = j.file,
+        .printer = j.printer[0] ? j.printer : NULL,
+        .ip = j.ip[0] ? j.ip : NULL,
+        .port = j.port,
+        .copies = j.copies,
+        .color_mode = j.color_mode,
+    };
+
+    /* take an id and its slot under the lock, then submit without it:
+     * resolving a printer can take seconds and mustn't stall other
+     * clients' STATUS and SUBMIT requests */
+    pthread_mutex_lock(&s->lock);
+    int id = s->next_id + 1;
+    struct spool_slot *slot = &s->slots[id % SPOOL_MAX_JOBS];
+    if (slot_busy(slot)) {
+        pthread_mutex_unlock(&s->lock);
+        snprintf(reply, len, "ERR queue full");
+        return;
+    }
+    lprun_job_release(slot->job);
+    slot->job = NULL;
+    slot->id = id;
+    slot->reserved = 1;
+    s->next_id = id;
+    pthread_mutex_unlock(&s->lock);
+
+    lprun_job *job = NULL;
+    int rc = lprun_submit(s->ctx, &spec, job_done, (void *)(intptr_t)id, &job);
+
+    pthread_mutex_lock(&s->lock);
+    slot->reserved = 0;
+    if (rc >= 0) slot->job = job;
+    pthread_mutex_unlock(&s->lock);
+    if (rc < 0) snprintf(reply, len, "ERR %s", lprun_strerror(rc));
+    else snprintf(reply, len, "OK %d", id);
+}
+
+static void status(struct spool *s, const char *arg, char *reply, size_t len) {
+    int id = atoi(arg);
+    pthread_mutex_lock(&s->lock);
+    struct spool_slot *slot = id > 0 ? &s->slots[id % SPOOL_MAX_JOBS] : NULL;
+    if (!slot || !slot->job || slot->id != id) {
+        snprintf(reply, len, "ERR unknown job %d", id);
+    } else {
+        struct lprun_job_info ji;
+        lprun_job_info(slot->job, &ji);
+        if (ji.state == LPRUN_FAILED) {
+            snprintf(reply, len, "OK %d %s %s", id, lprun_state_name(ji.state), ji.error);
+        } else {
+            snprintf(reply, len, "OK %d %s", id, lprun_state_name(ji.state));
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void handle(struct spool *s, char *line, char *reply, size_t len) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "SUBMIT ", 7) == 0) {
+        submit(s, line + 7, reply, len);
+    } else if (strncmp(line, "STATUS ", 7) == 0) {
+        status(s, line + 7, reply, len);
+    } else if (strcmp(line, "STATS") == 0) {
+        struct lprun_stats st;
+        lprun_ctx_stats(s->ctx, &st);
+        snprintf(reply, len, "OK submitted %lld done %lld failed %lld active %d",
+                 st.submitted, st.done, st.failed, st.active);
+    } else {
+        snprintf(reply, len, "ERR unknown request");
+    }
+}
+
+struct client {
+    struct spool *s;
+    int fd;
+    struct client *next;
+};
+
+/* one thread per connection; a client may send any number of requests */
+static void *client_thread(void *arg) {
+    struct client *c = arg;
+    struct spool *s = c->s;
+
+    FILE *in = fdopen(fcntl(c->fd, F_DUPFD_CLOEXEC, 0), "r");
+    char line[2048], reply[256];
+    while (in && fgets(line, sizeof(line), in)) {
+        handle(s, line, reply, sizeof(reply));
+        size_t n = strlen(reply);
+        reply[n++] = '\n';
+        if (send(c->fd, reply, n, MSG_NOSIGNAL) != (ssize_t)n) break;
+    }
+    if (in) fclose(in);
+
+    pthread_mutex_lock(&s->lock);
+    struct client **pp = &s->clients;
+    while (*pp != c) pp = &(*pp)->next;
+    *pp = c->next;
+    close(c->fd);
+    free(c);
+    pthread_cond_broadcast(&s->gone);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/* spool_serve:
+ *  bind the socket (refusing if another daemon answers on it), start the
+ *  converter pool, then accept clients until asked to stop. Queued jobs
+ *  are finished before returning.
+ */
+int spool_serve(const struct spool_opts *o) {
+    char *path = o->socket_path ? strdup(o->socket_path) : spool_socket_path();
+    struct sockaddr_un addr;
+    if (!path || socket_addr(path, &addr) != 0) {
+        free(path);
+        return -1;
+    }
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        perror("socket");
+        free(path);
+        return -1;
+    }
+    if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "lprun daemon already running on %s\n", path);
+        close(lfd);
+        free(path);
+        return -2;
+    }
+    unlink(path);   /* stale socket from a daemon that died */
+
+    mode_t old = umask(077);
+    int rc = bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old);
+    if (rc != 0 || listen(lfd, 64) != 0) {
+        perror("bind");
+        close(lfd);
+        free(path);
+        return -1;
+    }
+
+    int nworkers = o->jobs.workers > 0 ? o->jobs.workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1) nworkers = 1;
+    struct spool *s = calloc(1, sizeof(*s));
+    struct lprun_ctx_opts co = {
+        .printer = o->jobs.printer,
+        .ip = o->jobs.ip,
+        .port = o->jobs.port,
+        .workers = nworkers,
+        .no_cache = !o->jobs.use_cache,
+        .copy_mode = o->jobs.copy_mode,
+    };
+    if (!s || !(s->ctx = lprun_ctx_new(&co))) {
+        fprintf(stderr, "Cannot start the job queue\n");
+        free(s);
+        close(lfd);
+        unlink(path);
+        free(path);
+        return -1;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->gone, NULL);
+    s->o = o->jobs;
+
+    /* warm up: resolve the default printer before the first job needs it */
+    char def[256];
+    if (!s->o.printer && !s->o.ip && lprun_default_printer(s->ctx, def, sizeof(def)) == 0) {
+        printf("Default printer: %s\n", def);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("lprun daemon listening on %s (%d converter threads)\n", path, nworkers);
+    fflush(stdout);
+
+    while (!o->stop || !*o->stop) {
+        struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+        int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd < 0) continue;
+
+        struct client *c = malloc(sizeof(*c));
+        pthread_t tid;
+        if (c) {
+            *c = (struct client){ s, cfd, NULL };
+            pthread_mutex_lock(&s->lock);
+            c->next = s->clients;
+            s->clients = c;
+            if (pthread_create(&tid, NULL, client_thread, c) == 0) {
+                pthread_detach(tid);
+                pthread_mutex_unlock(&s->lock);
+                continue;
+            }
+            s->clients = c->next;
+            pthread_mutex_unlock(&s->lock);
+            free(c);
+        }
+        close(cfd);
+    }
+
+    close(lfd);
+    unlink(path);
+    free(path);
+
+    /* hang up on clients; their threads must be gone before the queue is */
+    pthread_mutex_lock(&s->lock);
+    for (struct client *c = s->clients; c; c = c->next) shutdown(c->fd, SHUT_RDWR);
+    while (s->clients) pthread_cond_wait(&s->gone, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+
+    struct lprun_stats st;
+    lprun_ctx_stats(s->ctx, &st);
+    if (st.active) printf("Finishing %d queued job(s)...\n", st.active);
+    /* every unfinished job still owns its slot */
+    for (int i = 0; i < SPOOL_MAX_JOBS; i++) {
+        if (s->slots[i].job) lprun_job_wait(s->slots[i].job);
+        lprun_job_release(s->slots[i].job);
+    }
+    lprun_ctx_stats(s->ctx, &st);
+    lprun_ctx_free(s->ctx);
+    printf("lprun daemon stopped: %lld submitted, %lld done, %lld failed\n",
+           st.submitted, st.done, st.failed);
+    pthread_cond_destroy(&s->gone);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return 0;
+}
+
+int spool_request(const char *socket_path, const char *request, char *reply, size_t len) {
+    char *path = socket_path ? strdup(socket_path) : spool_socket_path();
+    struct sockaddr_un addr;
+    reply[0] = '\0';
+    if (!path || socket_addr(path, &addr) != 0) {
+        free(path);
+        return -1;
+    }
+    free(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct timeval tv = { .tv_sec = 10 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t rl = strlen(request);
+    int rc = -1;
+    if (send(fd, request, rl, MSG_NOSIGNAL) == (ssize_t)rl && send(fd, "\n", 1, MSG_NOSIGNAL) == 1) {
+        size_t got = 0;
+        while (got + 1 < len) {
+            ssize_t n = recv(fd, reply + got, len - 1 - got, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+            if (memchr(reply + got - n, '\n', n)) break;
+        }
+        reply[got] = '\0';
+        reply[strcspn(reply, "\n")] = '\0';
+        if (got) rc = strncmp(reply, "OK", 2) == 0 ? 0 : 1;
+    }
+    close(fd);
+    return rc;
+}
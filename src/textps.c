@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "textps.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Courier advance width, in em */
+#define COURIER_WIDTH 0.6
+
+static const char prolog[] =
+    "%%BeginProlog\n"
+    "/Courier-Latin1 /Courier findfont dup length dict begin\n"
+    "  { 1 index /FID ne { def } { pop pop } ifelse } forall\n"
+    "  /Encoding ISOLatin1Encoding def currentdict end definefont pop\n"
+    "/F { /Courier-Latin1 findfont exch scalefont setfont } bind def\n"
+    "/L { LM exch moveto show } bind def\n"
+    "/R { 1 index stringwidth pop RM exch sub exch moveto show } bind def\n"
+    "/C { 1 index stringwidth pop LM RM add exch sub 2 div exch moveto show } bind def\n"
+    "%%EndProlog\n";
+
+/* ---- output ---- */
+
+static void flush_out(struct textps *t) {
+    size_t off = 0;
+    while (!t->err && off < t->olen) {
+        ssize_t w = write(t->out, t->obuf + off, t->olen - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) t->err = w < 0 ? errno : EIO;
+        else off += w;
+    }
+    t->olen = 0;
+}
+
+static void emit(struct textps *t, const char *fmt, ...) {
+    if (t->olen > sizeof(t->obuf) - 4096) flush_out(t);
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(t->obuf + t->olen, sizeof(t->obuf) - t->olen, fmt, ap);
+    va_end(ap);
+    if (n > 0) t->olen += (size_t)n < sizeof(t->obuf) - t->olen ? (size_t)n : 0;
+}
+
+/* one Latin-1 character as it goes inside a PostScript string */
+static size_t escape_char(unsigned c, char *dst) {
+    if (c == '(' || c == ')' || c == '\\') {
+        dst[0] = '\\';
+        dst[1] = (char)c;
+        return 2;
+    }
+    if (c < 0x20 || c >= 0x7f) return (size_t)sprintf(dst, "\\%03o", c & 0xff);
+    dst[0] = (char)c;
+    return 1;
+}
+
+static void escape_str(const char *s, char *dst, size_t len) {
+    size_t n = 0;
+    for (; *s && n + 5 < len; s++) n += escape_char((unsigned char)*s, dst + n);
+    dst[n] = '\0';
+}
+
+/* ---- pages ---- */
+
+static void begin_page(struct textps *t) {
+    t->pages++;
+    t->in_page = 1;
+    t->row = 0;
+    emit(t, "%%%%Page: %d %d\nsave\n%.2f F\n", t->pages, t->pages, t->size);
+    if (t->title[0]) {
+        double y = t->page_h - t->lm - t->size;
+        emit(t, "(%s) %.2f L (%s) %.2f R\n", t->title, y, t->date, y);
+        emit(t, "0.5 setlinewidth LM %.2f moveto RM %.2f lineto stroke\n",
+             y - t->size * 0.4, y - t->size * 0.4);
+        emit(t, "(Page %d) %.2f C\n", t->pages, t->lm);
+    }
+}
+
+static void end_page(struct textps *t) {
+    if (!t->in_page) return;
+    emit(t, "restore showpage\n");
+    t->in_page = 0;
+}
+
+static void put_line(struct textps *t) {
+    if (!t->in_page || t->row >= t->rows) {
+        end_page(t);
+        begin_page(t);
+    }
+    if (t->llen) {
+        t->line[t->llen] = '\0';
+        emit(t, "(%s) %.2f L\n", t->line, t->top - t->row * t->leading);
+    }
+    t->row++;
+    t->llen = 0;
+    t->col = 0;
+}
+
+static void put_char(struct textps *t, unsigned c) {
+    if (t->col >= t->cols) put_line(t);     /* wrap */
+    t->llen += escape_char(c, t->line + t->llen);
+    t->col++;
+}
+
+/* one decoded character */
+static void typeset(struct textps *t, unsigned c) {
+    switch (c) {
+    case '\n':
+        put_line(t);
+        break;
+    case '\r':
+        break;
+    case '\f':
+        if (t->llen || t->col) put_line(t);
+        if (!t->in_page) begin_page(t);
+        end_page(t);
+        break;
+    case '\t':
+        do put_char(t, ' '); while (t->col % t->tab && t->col < t->cols);
+        break;
+    default:
+        if (c < 0x20 || (c >= 0x7f && c < 0xa0)) break;     /* controls */
+        put_char(t, c < 0x100 ? c : '?');                   /* beyond Latin-1 */
+    }
+}
+
+/* ---- API ---- */
+
+/* textps_begin:
+ *  work out the grid (columns from Courier's fixed advance, rows from the
+ *  leading) and write the DSC header and prolog.
+ */
+int textps_begin(struct textps *t, int out_fd, const struct textps_opts *o) {
+    struct textps_opts d = { 0 };
+    if (!o) o = &d;
+    memset(t, 0, sizeof(*t));
+    t->out = out_fd;
+
+    t->size = o->font_size > 0 ? o->font_size : 10;
+    t->leading = t->size * 1.15;
+    t->tab = o->tab_width > 0 ? o->tab_width : 8;
+    t->page_w = o->page_w;
+    t->page_h = o->page_h;
+    if (t->page_w <= 0 || t->page_h <= 0) default_paper_size(&t->page_w, &t->page_h);
+    t->lm = o->margin > 0 ? o->margin : 36;
+    t->rm = t->page_w - t->lm;
+
+    double bottom = t->lm;
+    t->top = t->page_h - t->lm - t->size;
+    if (o->title) {
+        escape_str(o->title, t->title, sizeof(t->title));
+        time_t now = time(NULL);
+        struct tm tm;
+        strftime(t->date, sizeof(t->date), "%Y-%m-%d %H:%M", localtime_r(&now, &tm));
+        t->top -= t->size * 1.5;
+        bottom += t->size * 2;
+    }
+    t->cols = (int)((t->rm - t->lm) / (t->size * COURIER_WIDTH));
+    if (t->cols > TEXTPS_MAX_COLS) t->cols = TEXTPS_MAX_COLS;
+    if (t->cols < 1) t->cols = 1;
+    t->rows = (int)((t->top - bottom) / t->leading) + 1;
+    if (t->rows < 1) t->rows = 1;
+
+    emit(t, "%%!PS-Adobe-3.0\n%%%%Creator: lprun\n");
+    if (t->title[0]) emit(t, "%%%%Title: (%s)\n", t->title);
+    emit(t, "%%%%BoundingBox: 0 0 %.0f %.0f\n%%%%Pages: (atend)\n"
+            "%%%%DocumentNeededResources: font Courier\n%%%%EndComments\n",
+         t->page_w, t->page_h);
+    emit(t, "%s", prolog);
+    emit(t, "%%%%BeginSetup\n/LM %.2f def /RM %.2f def\n%%%%EndSetup\n", t->lm, t->rm);
+    return t->err ? -1 : 0;
+}
+
+/* a sequence cut short wasn't UTF-8 after all: the bytes read so far are
+ * Latin-1, like any other stray high byte */
+static void flush_seq(struct textps *t) {
+    for (int k = 0; k < t->nseq; k++) typeset(t, t->seq[k]);
+    t->need = 0;
+    t->nseq = 0;
+}
+
+int textps_feed(struct textps *t, const char *buf, size_t n) {
+    for (size_t i = 0; i < n && !t->err; i++) {
+        unsigned char b = (unsigned char)buf[i];
+        if (t->need) {
+            if ((b & 0xc0) == 0x80) {
+                t->cp = (t->cp << 6) | (b & 0x3f);
+                t->seq[t->nseq++] = b;
+                if (--t->need == 0) {
+                    t->nseq = 0;
+                    typeset(t, t->cp);
+                }
+                continue;
+            }
+            flush_seq(t);           /* then b starts afresh */
+        }
+        if (b < 0x80) typeset(t, b);
+        else if ((b & 0xe0) == 0xc0) { t->cp = b & 0x1f; t->need = 1; }
+        else if ((b & 0xf0) == 0xe0) { t->cp = b & 0x0f; t->need = 2; }
+        else if ((b & 0xf8) == 0xf0) { t->cp = b & 0x07; t->need = 3; }
+        else typeset(t, b);         /* not UTF-8: take it as Latin-1 */
+        if (t->need) {
+            t->seq[0] = b;
+            t->nseq = 1;
+        }
+    }
+    return t->err ? -1 : 0;
+}
+
+int textps_end(struct textps *t) {
+    if (t->need) flush_seq(t);
+    if (t->llen || t->col) put_line(t);
+    if (!t->pages) begin_page(t);           /* empty input: one blank page */
+    end_page(t);
+    emit(t, "%%%%Trailer\n%%%%Pages: %d\n%%%%EOF\n", t->pages);
+    flush_out(t);
+    return t->err ? -1 : 0;
+}
+
+int textps_convert_fd(int in_fd, int out_fd, const struct textps_opts *o,
+                      const atomic_int *cancel) {
+    struct textps *t = malloc(sizeof(*t));
+    char *buf = malloc(TEXTPS_OUT_BYTES);
+    int rc = -1;
+
+    if (t && buf && textps_begin(t, out_fd, o) == 0) {
+        for (;;) {
+            if (cancel && atomic_load(cancel)) break;
+            ssize_t n = read(in_fd, buf, TEXTPS_OUT_BYTES);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+            if (n == 0) {
+                rc = textps_end(t);
+                break;
+            }
+            if (textps_feed(t, buf, n) != 0) break;
+        }
+    }
+    free(buf);
+    free(t);
+    return rc;
+}
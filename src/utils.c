@@ -1,9 +1,15 @@
 #define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include "utils.h"
+#include "exec.h"
+#include "imgps.h"
+#include "textps.h"
+#include "netif.h"
+#include "pages.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
@@ -12,53 +18,49 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <ctype.h>
-
-/* Helper: check if command exists */
-static int command_exists(const char *cmd) {
-    char test_cmd[256];
-    snprintf(test_cmd, sizeof(test_cmd), "command -v %s >/dev/null 2>&1", cmd);
-    return system(test_cmd) == 0;
-}
-
-/* Helper: get ImageMagick command (magick for v7, convert for v6) */
-static const char *get_imagemagick_cmd(void) {
-    static int checked = 0;
-    static const char *cmd = NULL;
-
-    if (!checked) {
-        if (command_exists("magick")) {
-            cmd = "magick";
-        } else if (command_exists("convert")) {
-            cmd = "convert";
-        }
-        checked = 1;
+#include <errno.h>
+
+/* Helper: ImageMagick's convert into av[0..] ("magick convert" for v7,
+ * "convert" for v6); returns the next free index, or -1 if not installed */
+static int imagemagick_argv(const char **av) {
+    if (exec_find("magick")) {
+        av[0] = "magick";
+        av[1] = "convert";
+        return 2;
+    }
+    if (exec_find("convert")) {
+        av[0] = "convert";
+        return 1;
     }
-    return cmd;
+    return -1;
 }
 
 /* Helper: create temp file with extension */
 static char *create_temp_file(const char *prefix, const char *ext) {
     char tmpl[256];
     snprintf(tmpl, sizeof(tmpl), "/tmp/%s_XXXXXX%s", prefix, ext);
-    int fd = mkstemps(tmpl, strlen(ext));
+    int fd = mkostemps(tmpl, strlen(ext), O_CLOEXEC);
     if (fd < 0) return NULL;
     close(fd);
     return strdup(tmpl);
 }
 
-/* Helper: run command and check status */
-static int run_command(const char *cmd) {
-    int status = system(cmd);
-    if (status != 0) {
-        fprintf(stderr, "Command failed (status %d): %s\n", status, cmd);
-    }
+/* Helper: run a converter that writes its own output file; cancellable,
+ * and killed if it hangs */
+static int run_command(const char *const argv[], const atomic_int *cancel) {
+    return exec_run(argv, EXEC_NULL, EXEC_NULL, EXEC_CONVERT_TIMEOUT_MS, cancel) == 0;
+}
+
+int wait_converter(pid_t pid, const atomic_int *cancel) {
+    int status = exec_wait(pid, 0, cancel);
+    if (status > 0) fprintf(stderr, "Converter failed (status %d)\n", status);
     return status == 0;
 }
 
 /* create temporary filename with suffix; caller must free returned pointer */
 char *create_temp_with_suffix(const char *suffix) {
     char tmpl[] = "/tmp/myprinter-XXXXXX";
-    int fd = mkstemp(tmpl);
+    int fd = mkostemp(tmpl, O_CLOEXEC);
     if (fd < 0) return NULL;
     close(fd);
     size_t len = strlen(tmpl) + strlen(suffix) + 1;
@@ -70,96 +72,92 @@ char *create_temp_with_suffix(const char *suffix) {
     return out;
 }
 
-char *create_temp_ps_from_text(const char *text, int color_mode)
+/* text is set in black, so grayscale needs no extra pass */
+char *create_temp_ps_from_text(const char *text, int color_mode, const atomic_int *cancel)
 {
+    (void)color_mode;
     char *out_file = create_temp_file("lprun_text", ".ps");
     if (!out_file) return NULL;
 
-    FILE *f = fopen(out_file, "w");
-    if (!f) {
+    int fd = open(out_file, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    struct textps *t = malloc(sizeof(*t));
+    int ok = fd >= 0 && t && !(cancel && atomic_load(cancel)) &&
+             textps_begin(t, fd, NULL) == 0 &&
+             textps_feed(t, text, strlen(text)) == 0 &&
+             textps_end(t) == 0;
+    free(t);
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (!ok) {
+        unlink(out_file);
         free(out_file);
         return NULL;
     }
+    return out_file;
+}
 
-    /* Write simple PostScript text document */
-    fprintf(f, "%%!PS-Adobe-3.0\n"
-               "/Courier findfont 12 scalefont setfont\n"
-               "72 720 moveto\n"  // 1 inch from left, 10 inches from bottom
-               "(%s) show\n"
-               "showpage\n", text);
-    fclose(f);
-
-    /* If grayscale requested, convert the PS file */
-    if (color_mode == 2) {
-        char *gray_file = create_temp_file("lprun_text_gray", ".ps");
-        if (!gray_file) {
-            free(out_file);
-            return NULL;
-        }
-
-        const char *img_cmd = get_imagemagick_cmd();
-        if (img_cmd) {
-            char cmd[512];
-            /* Use ImageMagick to convert to grayscale */
-            if (strcmp(img_cmd, "magick") == 0) {
-                snprintf(cmd, sizeof(cmd), "magick convert %s -colorspace Gray %s",
-                         out_file, gray_file);
-            } else {
-                snprintf(cmd, sizeof(cmd), "convert %s -colorspace Gray %s",
-                         out_file, gray_file);
-            }
-
-            if (run_command(cmd)) {
-                unlink(out_file);
-                free(out_file);
-                return gray_file;
-            }
-        }
-
-        /* ImageMagick not available or failed, keep original */
-        if (gray_file) {
-            unlink(gray_file);
-            free(gray_file);
-        }
+char *convert_text_to_ps(const char *path, const atomic_int *cancel)
+{
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        perror(path);
+        return NULL;
+    }
+    char *out_file = create_temp_file("lprun_text", ".ps");
+    int fd = out_file ? open(out_file, O_WRONLY | O_TRUNC | O_CLOEXEC) : -1;
+
+    const char *base = strrchr(path, '/');
+    struct textps_opts o = { .title = base ? base + 1 : path };
+    int ok = fd >= 0 && textps_convert_fd(in, fd, &o, cancel) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    close(in);
+    if (!ok && out_file) {
+        unlink(out_file);
+        free(out_file);
+        out_file = NULL;
     }
-
     return out_file;
 }
 
-char *convert_image_to_ps(const char *path, int color_mode)
+char *convert_image_to_ps(const char *path, int color_mode, const atomic_int *cancel)
 {
     char *out_file = create_temp_file("lprun_img", ".ps");
     if (!out_file) return NULL;
 
-    const char *img_cmd = get_imagemagick_cmd();
-    if (!img_cmd) {
+    /* JPEG, PNG and PNM are encoded here when the variant allows */
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        int fd = open(out_file, O_WRONLY | O_TRUNC | O_CLOEXEC);
+        int rc = fd >= 0 ? imgps_convert_fd(in, fd, color_mode, cancel) : -1;
+        if (fd >= 0 && close(fd) != 0 && rc == 0) rc = -1;
+        close(in);
+        if (rc == 0) return out_file;
+        if (rc != IMGPS_UNSUPPORTED) {
+            unlink(out_file);
+            free(out_file);
+            return NULL;
+        }
+    }
+
+    const char *av[8];
+    int n = imagemagick_argv(av);
+    if (n < 0) {
         fprintf(stderr, "ImageMagick not found (neither 'magick' nor 'convert')\n");
+        unlink(out_file);
         free(out_file);
         return NULL;
     }
 
-    char cmd[512];
+    av[n++] = path;
     if (color_mode == 2) {
         /* Grayscale conversion */
-        if (strcmp(img_cmd, "magick") == 0) {
-            snprintf(cmd, sizeof(cmd), "magick convert \"%s\" -colorspace Gray \"%s\"",
-                     path, out_file);
-        } else {
-            snprintf(cmd, sizeof(cmd), "convert \"%s\" -colorspace Gray \"%s\"",
-                     path, out_file);
-        }
-    } else {
-        /* Normal conversion */
-        if (strcmp(img_cmd, "magick") == 0) {
-            snprintf(cmd, sizeof(cmd), "magick convert \"%s\" \"%s\"",
-                     path, out_file);
-        } else {
-            snprintf(cmd, sizeof(cmd), "convert \"%s\" \"%s\"",
-                     path, out_file);
-        }
+        av[n++] = "-colorspace";
+        av[n++] = "Gray";
     }
+    av[n++] = out_file;
+    av[n] = NULL;
 
-    if (!run_command(cmd)) {
+    if (!run_command(av, cancel)) {
+        unlink(out_file);
         free(out_file);
         return NULL;
     }
@@ -168,106 +166,321 @@ char *convert_image_to_ps(const char *path, int color_mode)
 }
 
 
-char *convert_pdf_to_ps(const char *path, int color_mode)
+/* Helper: the page selection as converter arguments. GhostScript takes
+ * any selection (-sPageList for several ranges); pdftops only one span */
+struct page_args {
+    const char *gs[3];          /* NULL terminated */
+    const char *pdftops[5];
+    char first[32], last[32], f[16], l[16], list[PAGES_MAX_RANGES * 24];
+};
+
+static void page_args(struct page_args *pa, const struct page_ranges *pages)
+{
+    int g = 0, p = 0, first, last;
+    memset(pa, 0, sizeof(*pa));
+    if (!pages || pages->n == 0) return;
+
+    pages_span(pages, &first, &last);
+    if (pages_contiguous(pages)) {
+        snprintf(pa->first, sizeof(pa->first), "-dFirstPage=%d", first);
+        pa->gs[g++] = pa->first;
+        if (last) {
+            snprintf(pa->last, sizeof(pa->last), "-dLastPage=%d", last);
+            pa->gs[g++] = pa->last;
+        }
+    } else {
+        int n = snprintf(pa->list, sizeof(pa->list), "-sPageList=");
+        pages_format(pages, pa->list + n, sizeof(pa->list) - n);
+        pa->gs[g++] = pa->list;
+    }
+
+    snprintf(pa->f, sizeof(pa->f), "%d", first);
+    pa->pdftops[p++] = "-f";
+    pa->pdftops[p++] = pa->f;
+    if (last) {
+        snprintf(pa->l, sizeof(pa->l), "%d", last);
+        pa->pdftops[p++] = "-l";
+        pa->pdftops[p++] = pa->l;
+    }
+}
+
+/* Helper: GhostScript's argv for PDF to PostScript into av (20 slots).
+ * Grayscale happens in the same pass and keeps text and vectors */
+static void gs_argv(const char **av, const char *path, const char *output, int gray,
+                    const struct page_args *pa)
+{
+    int n = 0;
+    av[n++] = "gs";
+    av[n++] = "-q";
+    av[n++] = "-dNOPAUSE";
+    av[n++] = "-dBATCH";
+    av[n++] = "-dSAFER";
+    av[n++] = "-sDEVICE=ps2write";
+    if (gray) {
+        av[n++] = "-sColorConversionStrategy=Gray";
+        av[n++] = "-dProcessColorModel=/DeviceGray";
+    }
+    av[n++] = "-dPDFSETTINGS=/printer";
+    av[n++] = "-dCompatibilityLevel=1.4";
+    av[n++] = "-dAutoRotatePages=/None";
+    av[n++] = "-dEmbedAllFonts=true";
+    for (int i = 0; pa->gs[i]; i++) av[n++] = pa->gs[i];
+    av[n++] = output;
+    av[n++] = "-f";
+    av[n++] = path;
+    av[n] = NULL;
+}
+
+/* Grayscale without GhostScript: the color operators are redefined to
+ * set the equivalent gray, so text and vectors stay as they are.
+ * setcolor keeps the current color space (its operand count depends on
+ * it) and sets a neutral color in that space. Sampled images keep their
+ * colors */
+static const char gray_prolog[] =
+    "%%BeginResource: procset lprun-gray 1.0 0\n"
+    "/setrgbcolor { setrgbcolor currentgray setgray } bind def\n"
+    "/sethsbcolor { sethsbcolor currentgray setgray } bind def\n"
+    "/setcmykcolor { setcmykcolor currentgray setgray } bind def\n"
+    "/setcolor { setcolor currentcolorspace 0 get\n"
+    "  dup /DeviceRGB eq { pop currentgray dup dup setcolor }\n"
+    "  { /DeviceCMYK eq { 0 0 0 1 currentgray sub setcolor } if } ifelse } bind def\n"
+    "%%EndResource\n";
+
+/* Helper: copy PostScript from in to out with gray_prolog placed after the
+ * DSC header (or the first line), ahead of the document's own prolog */
+static int copy_with_gray_prolog(const char *in, const char *out)
+{
+    int ifd = open(in, O_RDONLY | O_CLOEXEC);
+    int ofd = open(out, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    char buf[65536];
+    int ok = ifd >= 0 && ofd >= 0;
+
+    ssize_t n = ok ? read(ifd, buf, sizeof(buf)) : -1;
+    if (n <= 0) ok = 0;
+    if (ok) {
+        size_t head;
+        char *end = memmem(buf, n, "%%EndComments", 13);
+        char *nl = memchr(end ? end : buf, '\n', n - (end ? end - buf : 0));
+        head = nl ? (size_t)(nl + 1 - buf) : (size_t)n;
+        ok = write(ofd, buf, head) == (ssize_t)head &&
+             write(ofd, gray_prolog, sizeof(gray_prolog) - 1) == (ssize_t)(sizeof(gray_prolog) - 1) &&
+             write(ofd, buf + head, n - head) == (ssize_t)(n - head);
+    }
+    while (ok && (n = read(ifd, buf, sizeof(buf))) > 0) {
+        ok = write(ofd, buf, n) == n;
+    }
+    if (n < 0) ok = 0;
+    if (ifd >= 0) close(ifd);
+    if (ofd >= 0 && close(ofd) != 0) ok = 0;
+    return ok;
+}
+
+/* Helper: the selected pages of a DSC PostScript file into out */
+static int extract_pages_file(const char *in, const char *out, const struct page_ranges *pages,
+                              const atomic_int *cancel)
+{
+    int ifd = open(in, O_RDONLY | O_CLOEXEC);
+    int ofd = open(out, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    int ok = ifd >= 0 && ofd >= 0 && pages_extract_ps(ifd, ofd, pages, cancel) >= 0;
+    if (ifd >= 0) close(ifd);
+    if (ofd >= 0 && close(ofd) != 0) ok = 0;
+    return ok;
+}
+
+char *convert_ps_pages(const char *path, const struct page_ranges *pages,
+                       const atomic_int *cancel)
+{
+    char *out_file = create_temp_file("lprun_pages", ".ps");
+    if (out_file && !extract_pages_file(path, out_file, pages, cancel)) {
+        unlink(out_file);
+        free(out_file);
+        out_file = NULL;
+    }
+    return out_file;
+}
+
+char *convert_pdf_to_ps(const char *path, int color_mode, const struct page_ranges *pages,
+                        const atomic_int *cancel)
 {
     char *out_file = create_temp_file("lprun_pdf", ".ps");
     if (!out_file) return NULL;
+    char output[1100];
+    snprintf(output, sizeof(output), "-sOutputFile=%s", out_file);
+    const char *gs[20];
+    struct page_args pa;
+    page_args(&pa, pages);
+    int split = pages && !pages_contiguous(pages);
+
+    /* Grayscale or scattered pages: one GhostScript pass */
+    int tried_gs = (color_mode == 2 || split) && exec_find("gs");
+    if (tried_gs) {
+        gs_argv(gs, path, output, color_mode == 2, &pa);
+        if (run_command(gs, cancel)) return out_file;
+    }
 
     /* Try pdftops first (from poppler-utils) - it doesn't use ImageMagick */
-    if (command_exists("pdftops")) {
-        char cmd[512];
-        snprintf(cmd, sizeof(cmd), "pdftops \"%s\" \"%s\"", path, out_file);
-
-        if (run_command(cmd)) {
-            /* pdftops doesn't support grayscale conversion, so we need to post-process */
+    if (exec_find("pdftops")) {
+        const char *av[10];
+        int n = 0;
+        av[n++] = "pdftops";
+        for (int i = 0; pa.pdftops[i]; i++) av[n++] = pa.pdftops[i];
+        av[n++] = path;
+        av[n++] = out_file;
+        av[n] = NULL;
+
+        if (run_command(av, cancel)) {
+            /* pdftops converted the whole span: drop the pages between,
+             * counting from the span's first page */
+            if (split) {
+                struct page_ranges rel = *pages;
+                for (int i = 0; i < rel.n; i++) {
+                    rel.r[i].first -= pages->r[0].first - 1;
+                    if (rel.r[i].last) rel.r[i].last -= pages->r[0].first - 1;
+                }
+                char *sel_file = create_temp_file("lprun_pdf_pages", ".ps");
+                if (!sel_file || !extract_pages_file(out_file, sel_file, &rel, cancel)) {
+                    if (sel_file) unlink(sel_file);
+                    free(sel_file);
+                    unlink(out_file);
+                    free(out_file);
+                    return NULL;
+                }
+                unlink(out_file);
+                free(out_file);
+                out_file = sel_file;
+            }
+            /* pdftops can't do grayscale: add the gray operators */
             if (color_mode == 2) {
                 char *gray_file = create_temp_file("lprun_pdf_gray", ".ps");
-                if (gray_file) {
-                    const char *img_cmd = get_imagemagick_cmd();
-                    if (img_cmd) {
-                        char convert_cmd[512];
-                        /* Use appropriate command based on ImageMagick version */
-                        if (strcmp(img_cmd, "magick") == 0) {
-                            snprintf(convert_cmd, sizeof(convert_cmd),
-                                     "magick convert \"%s\" -colorspace Gray \"%s\" 2>/dev/null",
-                                     out_file, gray_file);
-                        } else {
-                            snprintf(convert_cmd, sizeof(convert_cmd),
-                                     "convert \"%s\" -colorspace Gray \"%s\" 2>/dev/null",
-                                     out_file, gray_file);
-                        }
-
-                        /* Run conversion silently */
-                        if (system(convert_cmd) == 0) {
-                            unlink(out_file);
-                            free(out_file);
-                            return gray_file;
-                        }
-                    }
-                    /* Conversion failed, keep original */
-                    free(gray_file);
+                if (gray_file && copy_with_gray_prolog(out_file, gray_file)) {
+                    unlink(out_file);
+                    free(out_file);
+                    return gray_file;
                 }
+                /* Conversion failed, keep original */
+                if (gray_file) unlink(gray_file);
+                free(gray_file);
             }
             return out_file;
         }
     }
 
-    /* Try GhostScript (preferred for grayscale) */
-    if (command_exists("gs")) {
-        char cmd[1024];
-        if (color_mode == 2) {
-            /* Convert to grayscale PS using GhostScript */
-            snprintf(cmd, sizeof(cmd),
-                "gs -q -dNOPAUSE -dBATCH -sDEVICE=ps2write "
-                "-sColorConversionStrategy=Gray -dProcessColorModel=/DeviceGray "
-                "-dPDFSETTINGS=/printer -dCompatibilityLevel=1.4 "
-                "-dAutoRotatePages=/None -dEmbedAllFonts=true "
-                "-sOutputFile=\"%s\" \"%s\" 2>/dev/null",
-                out_file, path);
-        } else {
-            /* Normal PS conversion */
-            snprintf(cmd, sizeof(cmd),
-                "gs -q -dNOPAUSE -dBATCH -sDEVICE=ps2write "
-                "-dPDFSETTINGS=/printer -dCompatibilityLevel=1.4 "
-                "-dAutoRotatePages=/None -dEmbedAllFonts=true "
-                "-sOutputFile=\"%s\" \"%s\" 2>/dev/null",
-                out_file, path);
-        }
-
-        if (run_command(cmd)) {
+    /* Try GhostScript */
+    if (!tried_gs && exec_find("gs")) {
+        gs_argv(gs, path, output, 0, &pa);
+        if (run_command(gs, cancel)) {
             return out_file;
         }
     }
 
-    /* All methods failed */
-    fprintf(stderr, "Failed to convert PDF to PS. Install poppler-utils (pdftops) or ghostscript (gs).\n");
+    /* All methods failed (or cancelled) */
+    unlink(out_file);
     free(out_file);
+    if (cancel && atomic_load(cancel)) return NULL;
+    fprintf(stderr, "Failed to convert PDF to PS. Install poppler-utils (pdftops) or ghostscript (gs).\n");
     return NULL;
 }
 
-/* get first non-loopback IPv4 interface and return base /24 CIDR like "192.168.1.0/24" */
+int stream_image_to_ps(const char *path, int color_mode, pid_t *pid)
+{
+    const char *av[8];
+    int n = imagemagick_argv(av);
+    if (n < 0) {
+        fprintf(stderr, "ImageMagick not found (neither 'magick' nor 'convert')\n");
+        return -1;
+    }
+
+    av[n++] = path;
+    if (color_mode == 2) {
+        av[n++] = "-colorspace";
+        av[n++] = "Gray";
+    }
+    av[n++] = "ps:-";
+    av[n] = NULL;
+    return exec_spawn(av, EXEC_NULL, EXEC_PIPE, EXEC_NULL, pid);
+}
+
+int stream_pdf_to_ps(const char *path, int color_mode, const struct page_ranges *pages,
+                     pid_t *pid)
+{
+    const char *av[20];
+    struct page_args pa;
+    page_args(&pa, pages);
+
+    /* pdftops can't do grayscale or scattered pages in one pass; GhostScript can */
+    if (color_mode != 2 && (!pages || pages_contiguous(pages)) && exec_find("pdftops")) {
+        int n = 0;
+        av[n++] = "pdftops";
+        for (int i = 0; pa.pdftops[i]; i++) av[n++] = pa.pdftops[i];
+        av[n++] = path;
+        av[n++] = "-";
+        av[n] = NULL;
+    } else if (exec_find("gs")) {
+        gs_argv(av, path, "-sOutputFile=-", color_mode == 2, &pa);
+    } else {
+        fprintf(stderr, "Failed to convert PDF to PS. Install poppler-utils (pdftops) or ghostscript (gs).\n");
+        return -1;
+    }
+    return exec_spawn(av, EXEC_NULL, EXEC_PIPE, EXEC_NULL, pid);
+}
+
+int pdf_streams(int color_mode, const struct page_ranges *pages)
+{
+    return (color_mode != 2 && (!pages || pages_contiguous(pages))) || exec_find("gs") != NULL;
+}
+
+/* subnet of the most relevant interface with its real prefix, e.g. "192.168.0.0/22" */
 char *get_local_subnet_cidr(void) {
-    struct ifaddrs *ifaddr, *ifa;
-    if (getifaddrs(&ifaddr) == -1) return NULL;
-    char host[NI_MAXHOST];
-    for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
-        if (!ifa->ifa_addr) continue;
-        if (ifa->ifa_addr->sa_family == AF_INET) {
-            struct sockaddr_in *sa = (struct sockaddr_in *)ifa->ifa_addr;
-            if (sa->sin_addr.s_addr == htonl(INADDR_LOOPBACK)) continue;
-            inet_ntop(AF_INET, &sa->sin_addr, host, sizeof(host));
-            /* compute base /24 */
-            unsigned int a,b,c,d;
-            if (sscanf(host, "%u.%u.%u.%u", &a,&b,&c,&d) == 4) {
-                char *res = malloc(32);
-                snprintf(res, 32, "%u.%u.%u.0/24", a,b,c);
-                freeifaddrs(ifaddr);
-                return res;
-            }
-        }
+    struct netif *ifs;
+    int n = netif_list(&ifs);
+    if (n <= 0) {
+        free(ifs);
+        return NULL;
     }
-    freeifaddrs(ifaddr);
-    return NULL;
+    char *res = malloc(32);
+    if (res) netif_cidr(&ifs[0], res, 32);
+    free(ifs);
+    return res;
+}
+
+/* paper from /etc/papersize (libpaper's default): A4 or Letter, in points */
+void default_paper_size(double *w, double *h) {
+    char name[32] = "";
+    FILE *f = fopen("/etc/papersize", "re");
+    if (f) {
+        if (!fgets(name, sizeof(name), f)) name[0] = '\0';
+        fclose(f);
+    }
+    if (strncasecmp(name, "a4", 2) == 0) {
+        *w = 595;
+        *h = 842;
+    } else {
+        *w = 612;
+        *h = 792;
+    }
+}
+
+/* $XDG_CACHE_HOME/lprun (default ~/.cache/lprun), created if missing;
+ * caller must free returned pointer */
+char *get_cache_dir(void) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char base[512];
+
+    if (xdg && xdg[0] == '/') snprintf(base, sizeof(base), "%s", xdg);
+    else if (home) snprintf(base, sizeof(base), "%s/.cache", home);
+    else return NULL;
+
+    mkdir(base, 0700);
+    size_t len = strlen(base) + sizeof("/lprun");
+    char *dir = malloc(len);
+    if (!dir) return NULL;
+    snprintf(dir, len, "%s/lprun", base);
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
 }
 
 int ends_with_ci(const char *s, const char *suffix) {
@@ -291,15 +504,8 @@ void trim(char *s) {
     *(end+1) = 0;
 }
 
-/* escape helper - naive, wraps in single quotes */
-const char *escape_shell_arg(const char *s) {
-    /* naive: relies on filenames without single quotes; safe in most home-use cases */
-    return s;
-}
-
-
 long get_file_size(const char *path) {
-    FILE *f = fopen(path, "rb");
+    FILE *f = fopen(path, "rbe");
     if (!f) return -1;
     fseek(f, 0, SEEK_END);
     long s = ftell(f);
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Run the test programs 'make test' built. A test exits 0 when it passes,
+# 77 when it can't run here (no loopback multicast, ...) and anything
+# else when it fails.
+
+cd "$(dirname "$0")" || exit 1
+BIN=${TEST_BIN_DIR:-../build/tests}
+
+pass=0
+fail=0
+skip=0
+for t in "$BIN"/test_*; do
+    [ -x "$t" ] || continue
+    name=${t##*/}
+    "$t"
+    case $? in
+        0)  echo "PASS  $name"; pass=$((pass + 1)) ;;
+        77) echo "SKIP  $name"; skip=$((skip + 1)) ;;
+        *)  echo "FAIL  $name"; fail=$((fail + 1)) ;;
+    esac
+done
+
+echo "$pass passed, $fail failed, $skip skipped"
+[ "$fail" -eq 0 ]
@@ -0,0 +1,24 @@
+#ifndef LPRUN_TEST_H
+#define LPRUN_TEST_H
+#include <stdio.h>
+
+/* exit status for "can't run here" (what ctest's SKIP_RETURN_CODE and
+ * run_tests.sh expect) */
+#define TEST_SKIP 77
+
+static int test_failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                \
+        }                                                                   \
+    } while (0)
+
+#define SKIP(why)                                                           \
+    do {                                                                    \
+        fprintf(stderr, "skipped: %s\n", why);                              \
+        return TEST_SKIP;                                                   \
+    } while (0)
+#endif
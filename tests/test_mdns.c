@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include "mdns.h"
+#include "test.h"
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define GROUP "224.0.0.251"
+#define INSTANCE "Test Laser._pdl-datastream._tcp.local"
+#define HOST "testlaser.local"
+#define SRV_PORT 9101
+#define PDL "application/pdf,image/pwg-raster"
+
+/* ---- a minimal responder: every query gets PTR, SRV, TXT and A ---- */
+
+struct pkt {
+    unsigned char b[1500];
+    size_t len;
+};
+
+static void put16(struct pkt *p, unsigned v) {
+    p->b[p->len++] = (unsigned char)(v >> 8);
+    p->b[p->len++] = (unsigned char)v;
+}
+
+static void put_name(struct pkt *p, const char *name) {
+    while (*name) {
+        size_t l = strcspn(name, ".");
+        p->b[p->len++] = (unsigned char)l;
+        memcpy(p->b + p->len, name, l);
+        p->len += l;
+        name += l;
+        if (*name == '.') name++;
+    }
+    p->b[p->len++] = 0;
+}
+
+/* owner, type, class and TTL; returns where rdlength goes */
+static size_t begin_rr(struct pkt *p, const char *owner, unsigned type) {
+    put_name(p, owner);
+    put16(p, type);
+    put16(p, 0x8001);               /* IN, cache flush */
+    put16(p, 0);
+    put16(p, 120);
+    size_t at = p->len;
+    put16(p, 0);
+    return at;
+}
+
+static void end_rr(struct pkt *p, size_t at) {
+    size_t n = p->len - at - 2;
+    p->b[at] = (unsigned char)(n >> 8);
+    p->b[at + 1] = (unsigned char)n;
+}
+
+static void put_txt(struct pkt *p, const char *kv) {
+    p->b[p->len++] = (unsigned char)strlen(kv);
+    memcpy(p->b + p->len, kv, strlen(kv));
+    p->len += strlen(kv);
+}
+
+static void build_answer(struct pkt *p) {
+    memset(p, 0, sizeof(*p));
+    p->len = 12;
+    p->b[2] = 0x84;                 /* response, authoritative */
+    p->b[7] = 4;                    /* answers */
+
+    size_t at = begin_rr(p, "_pdl-datastream._tcp.local", 12);
+    put_name(p, INSTANCE);
+    end_rr(p, at);
+
+    at = begin_rr(p, INSTANCE, 33);
+    put16(p, 0);
+    put16(p, 0);
+    put16(p, SRV_PORT);
+    put_name(p, HOST);
+    end_rr(p, at);
+
+    at = begin_rr(p, INSTANCE, 16);
+    put_txt(p, "txtvers=1");
+    put_txt(p, "pdl=" PDL);
+    put_txt(p, "Color=T");
+    put_txt(p, "Duplex=F");
+    end_rr(p, at);
+
+    at = begin_rr(p, HOST, 1);
+    put16(p, 0x7f00);
+    put16(p, 0x0001);               /* 127.0.0.1 */
+    end_rr(p, at);
+}
+
+struct responder {
+    int fd;
+    int queries;
+    volatile int stop;
+};
+
+static void *respond(void *arg) {
+    struct responder *r = arg;
+    struct pkt answer;
+    build_answer(&answer);
+    while (!r->stop) {
+        struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        unsigned char q[1500];
+        struct sockaddr_in from;
+        socklen_t fl = sizeof(from);
+        ssize_t n = recvfrom(r->fd, q, sizeof(q), 0, (struct sockaddr *)&from, &fl);
+        if (n < 12 || (q[2] & 0x80)) continue;      /* queries only */
+        r->queries++;
+        /* the browser asks from an ephemeral port: answer it directly */
+        sendto(r->fd, answer.b, answer.len, 0, (struct sockaddr *)&from, fl);
+    }
+    return NULL;
+}
+
+/* a UDP socket on an ephemeral port that is a member of GROUP on lo */
+static int join_group(int *port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+    socklen_t len = sizeof(a);
+    struct ip_mreq mr;
+    inet_pton(AF_INET, GROUP, &mr.imr_multiaddr);
+    mr.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+        getsockname(fd, (struct sockaddr *)&a, &len) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mr, sizeof(mr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(a.sin_port);
+    return fd;
+}
+
+int main(void) {
+    struct responder r = { 0 };
+    int port;
+    r.fd = join_group(&port);
+    if (r.fd < 0) SKIP("no multicast on the loopback interface");
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, respond, &r) != 0) SKIP("no threads");
+
+    /* a private port, so a real mDNS daemon on 5353 stays out of it */
+    struct mdns_opts o = { .timeout_ms = 1000, .first_only = 1, .group = GROUP,
+                           .port = port, .iface_addr = "127.0.0.1" };
+    struct mdns_printer *found;
+    int n = mdns_browse(&o, &found);
+
+    r.stop = 1;
+    pthread_join(tid, NULL);
+    close(r.fd);
+    if (n == 0 && r.queries == 0) {
+        free(found);
+        SKIP("multicast doesn't loop back here");
+    }
+
+    CHECK(n == 1);
+    if (n >= 1) {
+        CHECK(strcmp(found[0].name, "Test Laser") == 0);
+        CHECK(strcmp(found[0].service, "_pdl-datastream._tcp") == 0);
+        CHECK(strcmp(found[0].host, HOST) == 0);
+        CHECK(strcmp(found[0].ip, "127.0.0.1") == 0);
+        CHECK(found[0].port == SRV_PORT);
+        CHECK(strcmp(found[0].pdl, PDL) == 0);
+        CHECK(found[0].color == 1);
+        CHECK(found[0].duplex == 0);
+    }
+    free(found);
+    return test_failures ? 1 : 0;
+}
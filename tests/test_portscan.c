@@ -0,0 +1,54 @@
+#define _GNU_SOURCE
+#include "portscan.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* a TCP socket on 127.0.0.1 and an ephemeral port; listening or not */
+static int loopback_socket(int listening, int *port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(a);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&a, sizeof(a)) != 0 ||
+        (listening && listen(fd, 16) != 0) ||
+        getsockname(fd, (struct sockaddr *)&a, &len) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    *port = ntohs(a.sin_port);
+    return fd;
+}
+
+int main(void) {
+    int open_port, closed_port;
+    int lfd = loopback_socket(1, &open_port);
+    int cfd = loopback_socket(0, &closed_port);     /* bound, never accepts */
+    if (lfd < 0 || cfd < 0) SKIP("no loopback TCP");
+
+    /* the listener is on 127.0.0.1 only: its neighbours refuse */
+    const int ports[] = { closed_port, open_port };
+    struct portscan_opts o = { .ports = ports, .nports = 2, .concurrency = 4,
+                               .timeout_ms = 1000 };
+    struct portscan_hit *hits;
+    int n = portscan_range(INADDR_LOOPBACK, INADDR_LOOPBACK + 3, &o, &hits);
+    CHECK(n == 1);
+    if (n >= 1) {
+        CHECK(strcmp(hits[0].ip, "127.0.0.1") == 0);
+        CHECK(hits[0].port == open_port);
+        CHECK(hits[0].rtt_ms >= 0 && hits[0].rtt_ms < o.timeout_ms);
+    }
+    free(hits);
+
+    /* the same through the CIDR form */
+    n = portscan_cidr("127.0.0.1/32", &o, &hits);
+    CHECK(n == 1 && hits[0].port == open_port);
+    free(hits);
+
+    close(lfd);
+    close(cfd);
+    return test_failures ? 1 : 0;
+}